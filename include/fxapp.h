@@ -31,6 +31,9 @@
 
 #include "fxcursor.h"
 #include "fxobject.h"
+#include "fxrecord.h"
+#include "fxregion.h"
+#include "fxstats.h"
 #include "fxstring.h"
 #include "fxvisual.h"
 #include "fxwindow.h"
@@ -47,7 +50,9 @@ enum DtkDefaultCursor {
 enum {
 	ID_QUIT = 1,    /// Terminate the application normally
 	ID_DUMP,      /// Dump the current widget tree
-	ID_HOVER
+	ID_HOVER,
+	ID_POSTED,    /// Messages were posted from another thread
+	ID_SIGNAL     /// Signals were delivered
 };
 
 /* All ways of being modal */
@@ -57,6 +62,28 @@ enum dkModality {
   MODAL_FOR_POPUP         /* Modal for popup (always dispatch to popup) */
 };
 
+/* Ways of updating the GUI */
+enum dkUpdateMode {
+  UPDATE_TREE,            /* Walk the whole widget tree on each refresh */
+  UPDATE_DIRTY            /* Update only registered windows and windows marked dirty */
+};
+
+/* Chore priority classes, most urgent first */
+enum dkChorePriority {
+  CHORE_INPUT,            /* Work input handling waits for */
+  CHORE_PAINT,            /* Work that must be done before painting, like layout */
+  CHORE_BACKGROUND,       /* Everything else */
+  CHORE_LAST
+};
+
+/* Input event modes */
+enum dkInputMode {
+  INPUT_NONE   = 0,       /* Inactive */
+  INPUT_READ   = 1,       /* Read input fd */
+  INPUT_WRITE  = 2,       /* Write input fd */
+  INPUT_EXCEPT = 4        /* Except input fd */
+};
+
 struct dtkRectangle {
 	short x;
 	short y;
@@ -71,6 +98,22 @@ struct dtkHash {
 	unsigned int   free;        // Number of free entries
 };
 
+struct dtkSelHash {
+	struct dtkSelEntry *table;  // Hash table
+	unsigned int   total;       // Table size
+	unsigned int   used;        // Number of used entries
+	unsigned int   free;        // Number of free entries
+};
+
+/* Pointer sample folded into a motion event */
+struct dkMotionSample {
+  int               win_x;          /* Window-relative x-coord */
+  int               win_y;          /* Window-relative y-coord */
+  int               root_x;         /* Root x-coord */
+  int               root_y;         /* Root y-coord */
+  DKuint            time;           /* Time of the sample */
+};
+
 /* dkEvent */
 struct dkEvent {
   DKuint            type;           /* Event type */
@@ -82,6 +125,8 @@ struct dkEvent {
   int               state;          /* Mouse button and modifier key state */
   int               code;           /* Button, Keysym, or mode; DDE Source */
   struct dstr       text;           /* Text of keyboard event */
+  int               repeat;         /* Key presses this one stands for; a receiver applying them all sets it to 1 */
+  DKuint            serial;         /* Sequence number of the user input being handled, 0 if none */
   int               last_x;         /* Window-relative x-coord of previous mouse location */
   int               last_y;         /* Window-relative y-coord of previous mouse location */
   int               click_x;        /* Window-relative x-coord of mouse press */
@@ -92,8 +137,11 @@ struct dkEvent {
   DKuint            click_button;   /* Mouse button pressed */
   int               click_count;    /* Click-count */
   DKbool            moved;          /* Moved cursor since press */
+  const struct dkMotionSample *samples;  /* Motion folded into this motion event, oldest first */
+  int               nsamples;       /* Number of samples */
 
   struct dtkRectangle rect;         /* Rectangle */
+  struct dkRegion  *region;         /* Exact area to repaint within rect, or NULL */
   int synthetic;                    /* True if synthetic expose event */
 };
 
@@ -106,6 +154,7 @@ struct dkApp {
   char **appArgv;       /* Argument vector */
 
   int display_opened;
+  DKbool headless;      /* Running without a display; see fxnull.c */
   void *display;        /* Display we're talking to */
   char *dpy;            /* Initial display guess */
   struct dkWindow *activeWindow; /* Active toplevel window */
@@ -126,9 +175,22 @@ struct dkApp {
 
 	struct dkWindow        *refresher;           /* GUI refresher pointer */
 	struct dkWindow        *refresherstop;       /* GUI refresher end pointer */
+	int                     updatemode;          /* How the GUI is updated */
+	DKlong                  updatebudget;        /* Time spent on GUI updates per idle iteration (ns) */
+	DKbool                  inputfirst;          /* Cut idle work short when user input is waiting */
+	struct dkWindow       **updaters;            /* Windows registered for updates */
+	int                     nupdaters;           /* Number of registered windows */
+	int                     maxupdaters;         /* Allocated size of updaters */
+	struct dtkHash         *updaterindex;        /* Position in updaters by window */
+	struct dkWindow       **dirty;               /* Windows waiting for an update, oldest first */
+	int                     dirtyhead;           /* First window in dirty still waiting */
+	int                     ndirty;              /* End of windows in dirty */
+	int                     maxdirty;            /* Allocated size of dirty */
+	struct dtkHash         *dirtyindex;          /* Windows waiting for an update */
 
 	struct dkWindow *root;                       /* Pointer to the root window */
 	dkCursor *cursor[DEF_TEXT_CURSOR + 1]; /* Default cursors */
+	struct dkInput *inputs;       /* Input file descriptors being watched */
 	int ninputs;                  /* Number of inputs */
 	int maxinput;                 /* Maximum input number */
   DKuint           clickSpeed;  /* Double click speed */
@@ -149,12 +211,34 @@ struct dkApp {
 	DKColor          selMenuTextColor;    /* Select foreground color in menus */
 	DKColor          selMenuBackColor;    /* Select background color in menus */
 
-  struct fxTimer         *timers;              /* List of timers, sorted by time */
-  struct dkChore         *chores;              /* List of chores */
-  struct dkRepaint       *repaints;            /* Unhandled repaint rectangles */
+  struct fxTimer        **timers;              /* Heap of timers, earliest first */
+  int                     ntimers;             /* Number of timers in heap */
+  int                     maxtimers;           /* Allocated size of heap */
+  DKuint                  timerseq;            /* Timer insertion sequence */
+  struct dtkSelHash      *timerindex;          /* Timers by target and message */
+  struct dkChore         *chores[CHORE_LAST];  /* Lists of chores by priority */
+  struct dkChore         *choretail[CHORE_LAST]; /* Last chore in each list */
+  struct dtkSelHash      *choreindex;          /* Chores by target and message */
+  DKuint                  choreseq;            /* Chore insertion sequence */
+  DKlong                  chorebudget;         /* Time spent on chores per idle iteration (ns) */
+  DKlong                  choredeadline;       /* When running chores must yield (steady ns), 0 if none is running */
+  struct dkRepaint       *repaints;            /* Windows with unhandled repaints */
+  struct dkRepaint       *repainttail;         /* Last window in repaints list */
+  struct dtkHash         *repaintindex;        /* Repaints by window */
+  DKlong                  frameinterval;       /* Time between frames (ns), 0 for no frame clock */
+  DKlong                  framedue;            /* When next frame may be painted (steady ns) */
   struct fxTimer         *timerrecs;           /* List of recycled timer records */
   struct dkChore         *chorerecs;           /* List of recycled chore records */
   struct dkRepaint       *repaintrecs;         /* List of recycled repaint records */
+  struct dkPosted *volatile posthead;          /* Posted messages, newest end */
+  struct dkPosted        *posttail;            /* Posted messages, oldest end */
+  struct dkPosted        *poststub;            /* Stub record of posted messages queue */
+  volatile int            postwake;            /* Wakeup signalled for posted messages */
+  struct dkStats         *stats;               /* Event loop statistics, or NULL */
+  struct dkRecorder      *recorder;            /* Event recording in progress, or NULL */
+  struct dkReplayer      *replayer;            /* Event replay in progress, or NULL */
+  DKuint                  inputserial;         /* Sequence number of the last user input */
+  DKuint                  stackserial;         /* Stacking order given to the last window created or raised */
 
 #ifndef WIN32
   DKID             wmMotifHints;        /* Motif hints */
@@ -168,11 +252,39 @@ struct dkApp {
   void            *r_fds;               /* Set of file descriptors for read */
   void            *w_fds;               /* Set of file descriptors for write */
   void            *e_fds;               /* Set of file descriptors for exceptions */
+  int              reactor;             /* Reactor (epoll) descriptor, or -1 */
+  void            *ready;               /* Descriptors found ready by last wait */
+  int              nready;              /* Number of ready descriptors */
+  int              timerfd;             /* Timer descriptor for earliest timer, or -1 */
+  DKlong           timerdue;            /* Due time the timer descriptor is armed for */
+  int              wakefd[2];           /* Wakeup descriptors, read and write end */
+  void            *signals;             /* Signal handlers by signal number, or NULL */
+  void            *sigmask;             /* Set of signals being handled */
+  int              sigfd[2];            /* Signal descriptors, read and write end */
+  void            *batch;               /* Events read from the display in one go */
+  int              batchhead;           /* Next event in batch */
+  int              nbatch;              /* Number of events in batch */
+  int              maxbatch;            /* Allocated size of batch */
+  void            *xcb;                 /* XCB connection underneath the display, or NULL */
+  unsigned int     hovercookie;         /* Sequence number of pointer query for next hover check */
+  int              hoverpending;        /* Pointer query for next hover check was sent */
+  void            *copies;              /* Scroll copies not yet done by the server */
+  int              ncopies;             /* Number of copies */
+  int              maxcopies;           /* Allocated size of copies */
+  DKuint           paintinput;          /* User input whose damage was released last, 0 if none */
+  DKuint           painttime;           /* Its event time (ms) */
+  void            *folds;               /* Motion folded into each event of the batch */
+  void            *samples;             /* Samples of the folded motion */
+  DKbool           xinput;              /* Take pointer input through XInput2 if the server has it */
+  int              xiopcode;            /* XInput2 extension opcode, or 0 if not in use */
+  void            *scrollers;           /* Smooth scrolling valuators of the pointer devices */
+  int              nscrollers;          /* Number of valuators */
 #else
   DKDragType      *xselTypeList;        /* Selection type list */
   DKuint           xselNumTypes;        /* Selection number of types on list */
   DKID             stipples[17];        /* Standard stipple bitmaps */
   void           **handles;             /* Waitable object handles */
+  void            *wakeup;              /* Wakeup event handle */
 #endif
 };
 
@@ -187,15 +299,35 @@ int   dkAppRun(App *app);
 void  dkAppExit(struct dkApp *app, int value);
 void  dkAppStop(struct dkApp *app, int value);
 void  DtkAppRefresh(App *app);
+void dkAppSetUpdateMode(struct dkApp *app, int mode, DKuint budget);
+void dkAppAddUpdate(struct dkApp *app, struct dkWindow *w);
+void dkAppRemoveUpdate(struct dkApp *app, struct dkWindow *w);
+void dkAppMarkDirty(struct dkApp *app, struct dkWindow *w);
+void dkAppMarkTargetDirty(struct dkApp *app, struct dkObject *tgt);
 void dkAppAddChore(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr);
+void dkAppAddChorePriority(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr, int priority);
 void dkAppRemoveChore(struct dkApp *app, struct dkObject* tgt, DKSelector sel);
+void dkAppSetChoreBudget(struct dkApp *app, DKuint budget);
+DKlong dkAppChoreTimeLeft(struct dkApp *app);
 void fxAppAddTimeout(struct dkApp *app, struct dkObject *tgt, DKSelector sel, DKuint ms, void *ptr);
 void fxAppRemoveTimeout(struct dkApp *app, struct dkObject *tgt, DKSelector sel);
+DKbool dkAppAddInput(struct dkApp *app, DKInputHandle fd, DKuint mode, struct dkObject *tgt, DKSelector sel, void *ptr);
+DKbool dkAppRemoveInput(struct dkApp *app, DKInputHandle fd, DKuint mode);
+DKbool dkAppPostMessage(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr);
+DKbool dkAppAddSignal(struct dkApp *app, int sig, struct dkObject *tgt, DKSelector sel);
+DKbool dkAppRemoveSignal(struct dkApp *app, int sig);
 void dkAppEnterWindow(struct dkApp *app, struct dkWindow *window, struct dkWindow *ancestor);
 void dkAppLeaveWindow(struct dkApp *app, struct dkWindow *window, struct dkWindow *ancestor);
 void dkAppAddRepaint(struct dkApp *app, DKID win, int x, int y, int w, int h, DKbool synth);
 void dkAppRemoveRepaints(struct dkApp *app, DKID win, int x, int y, int w, int h);
 void dkAppScrollRepaints(struct dkApp *app, DKID win, int dx, int dy);
+void dkAppTrackCopy(struct dkApp *app, DKID win, int dx, int dy);
+void dkAppSetFrameRate(struct dkApp *app, DKuint fps);
+void dkAppSetInputPriority(struct dkApp *app, DKbool enable);
+void dkAppSetStats(struct dkApp *app, DKbool enable);
+void dkAppDumpStats(struct dkApp *app, FILE *fp);
+DKbool dkAppRecord(struct dkApp *app, const char *filename);
+DKbool dkAppReplay(struct dkApp *app, const char *filename, double speed, DKbool quit);
 
 /* composite.c */
 dtkWindow * DtkNewCompositeRoot(App *app, FXVisual *v);
@@ -240,4 +372,12 @@ void *DtkHashRemove(struct dtkHash *h, void* key);
 void *DtkHashFind(struct dtkHash *h, void *key);
 void DtkHashClear(struct dtkHash *h);
 
+/* Hash functions keyed by target and message */
+struct dtkSelHash *DtkSelHashNew(void);
+void DtkSelHashFree(struct dtkSelHash *h);
+void DtkSelHashResize(struct dtkSelHash *h, unsigned int m);
+void *DtkSelHashReplace(struct dtkSelHash *h, void *key, DKSelector sel, void *value);
+void *DtkSelHashRemove(struct dtkSelHash *h, void *key, DKSelector sel);
+void *DtkSelHashFind(struct dtkSelHash *h, void *key, DKSelector sel);
+
 #endif /* FX_APP_H */
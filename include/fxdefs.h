@@ -136,6 +136,13 @@ typedef void*                  DKID;
 typedef unsigned short         DKushort;
 typedef unsigned int           DKuint;
 
+/* Handle to file descriptor or waitable object */
+#ifndef WIN32
+typedef int                    DKInputHandle;
+#else
+typedef void*                  DKInputHandle;
+#endif
+
 /* RGBA pixel value */
 typedef DKuint                 DKColor;
 
@@ -155,6 +162,12 @@ typedef DKushort               DKDragType;
 /* Make selector from message type and message id */
 #define DKSEL(type,id) ((((DKuint)(id))&0xffff) | (((DKuint)(type))<<16))
 
+/* Get type from selector */
+#define DKSELTYPE(s) ((DKSelector)(((s)>>16)&0xffff))
+
+/* Get ID from selector */
+#define DKSELID(s) ((DKSelector)((s)&0xffff))
+
 /* Define one function */
 #define FXMAPFUNC(type,key,func) {DKSEL(type, key), DKSEL(type, key), &func}
 
@@ -25,6 +25,7 @@ void DtkDrvAppNew(App *app);
 
 int dtkDrvOpenDisplay(App *app, char *dpyname);
 int dtkDrvRunOneEvent(App *app, int blocking);
+void dtkDrvSelectPointer(struct dkWindow *w);
 
 /* drv visual.c */
 void DtkDrvCreateVisual(FXVisual *v);
@@ -34,4 +35,10 @@ unsigned long dtkDrvVisualGetPixel(FXVisual *v, unsigned int clr);
 void DtkDrvCreateWindow(struct dkWindow *w);
 void DtkDrvWindowShow(struct dkWindow *w);
 
+/* drv null.c */
+void dtkNullCreateRoot(struct dkWindow *w);
+void dtkNullCreateWindow(struct dkWindow *w);
+void dtkNullExpose(struct dkWindow *w);
+DKuint dtkNullKeysym(DKuint sym, DKuint state);
+
 #endif /* FX_DRV_H */
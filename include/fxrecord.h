@@ -0,0 +1,127 @@
+/******************************************************************************
+ *                                                                            *
+ *                E v e n t   R e c o r d   a n d   R e p l a y               *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#ifndef FX_RECORD_H
+#define FX_RECORD_H
+
+#include <stdio.h>
+
+#include "fxdefs.h"
+#include "fxstats.h"
+
+struct dkWindow;
+
+/* Deepest window that can be recorded */
+#define DK_RECDEPTH 32
+
+/* Longest wait for an event to settle when replaying as fast as possible (ns) */
+#define DK_REPLAYSETTLE 100000000
+
+/* Record type of a timer firing; other types are X event types */
+#define REC_TIMER 1
+
+/*
+** One recorded event.  Windows are identified by the path of window
+** keys from the root down, which is the same from one run to the next
+** as long as the program builds its widgets in the same order; window
+** ids are not.
+*/
+struct dkRecEvent {
+  int           type;                   /* X event type, or REC_TIMER */
+  DKlong        when;                   /* Time since recording started (ns) */
+  int           depth;                  /* Length of path */
+  DKuint        path[DK_RECDEPTH];      /* Window keys from the root down */
+  int           synthetic;              /* Sent by another client */
+  int           x, y;                   /* Window-relative position */
+  int           x_root, y_root;         /* Root-relative position */
+  int           width, height;          /* Size, for expose and configure */
+  DKuint        state;                  /* Button and modifier state */
+  DKuint        detail;                 /* Button, keysym, crossing mode or timer message */
+  DKuint        time;                   /* Server time (ms) */
+};
+
+/* Event recorder */
+struct dkRecorder {
+  FILE         *fp;                     /* Recording */
+  DKlong        started;                /* When recording started (steady ns) */
+  DKlong        last;                   /* Time of previous record */
+  DKuint        lasttime;               /* Server time of previous record */
+  DKulong       count;                  /* Records written */
+};
+
+/* Event replayer */
+struct dkReplayer {
+  FILE         *fp;                     /* Recording */
+  double        speed;                  /* Speed relative to recording, 0 for as fast as possible */
+  DKbool        quit;                   /* Stop the application when done */
+  DKlong        started;                /* When replay started (steady ns) */
+  DKlong        last;                   /* Time of previous record */
+  DKuint        lasttime;               /* Server time of previous record */
+  struct dkRecEvent next;               /* Next record */
+  DKbool        havenext;               /* Next record is valid */
+  DKlong        pending;                /* When the event being handled was due, or 0 */
+  DKulong       injected;               /* Events injected */
+  DKulong       skipped;                /* Events not injected */
+  DKulong       unsettled;              /* Events that did not settle in time */
+  DKulong       timers;                 /* Timer firings in the recording */
+  DKulong       fired;                  /* Timer firings during replay */
+  struct dkStatHist latency;            /* Time from due until handled */
+};
+
+/* Find path of window keys from the root to window; returns depth, or -1 if too deep */
+int dkRecordWindowPath(struct dkWindow *window, DKuint *path);
+
+/* Find window with path of window keys under root */
+struct dkWindow *dkRecordFindWindow(struct dkWindow *root, const DKuint *path, int depth);
+
+/* Start recording to file; NULL if it can not be created */
+struct dkRecorder *dkRecorderNew(const char *filename);
+void dkRecorderDel(struct dkRecorder *rec);
+
+/* Write event; its when field is filled in */
+void dkRecorderWrite(struct dkRecorder *rec, struct dkRecEvent *ev);
+
+/* Write timer firing */
+void dkRecorderTimer(struct dkRecorder *rec, DKuint message);
+
+/* Open recording for replay at speed times the recorded speed, or as
+ * fast as possible if speed is 0; NULL if it can not be read */
+struct dkReplayer *dkReplayerNew(const char *filename, double speed, DKbool quit);
+void dkReplayerDel(struct dkReplayer *rp);
+
+/* Next event to replay, or NULL at end of recording; timer firings in
+ * the recording are counted and passed over */
+const struct dkRecEvent *dkReplayerPeek(struct dkReplayer *rp);
+
+/* When next event is due (steady ns); 0 if it is due right away */
+DKlong dkReplayerDue(struct dkReplayer *rp);
+
+/* Move on to the following event, counting this one as injected or not */
+void dkReplayerNext(struct dkReplayer *rp, DKbool injected);
+
+/* Event being handled has settled at time now if idle, or is taken as
+ * settled if it has been waiting longer than DK_REPLAYSETTLE; returns
+ * TRUE if no event is waiting to settle */
+DKbool dkReplayerSettle(struct dkReplayer *rp, DKlong now, DKbool idle);
+
+/* Print throughput and latency */
+void dkReplayerReport(struct dkReplayer *rp, FILE *fp);
+
+#endif /* FX_RECORD_H */
@@ -0,0 +1,81 @@
+/******************************************************************************
+ *                                                                            *
+ *                         R e g i o n    C l a s s                           *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#ifndef FX_REGION_H
+#define FX_REGION_H
+
+#include "fxdefs.h"
+
+/* Box with exclusive lower-right corner */
+struct dkBox {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+};
+
+/*
+** Region is a banded list of boxes, like X regions: boxes are sorted
+** by y1 then x1; boxes with the same y1 form a band and share y2; boxes
+** in a band neither overlap nor touch, and adjacent bands with the same
+** spans are merged.  So each region has exactly one representation.
+*/
+struct dkRegion {
+  struct dkBox  extents;        /* Bounding box */
+  struct dkBox *rects;          /* Boxes, in band order */
+  int           numRects;       /* Number of boxes */
+  int           size;           /* Allocated number of boxes */
+};
+
+/* Initialize empty region */
+void dkRegionInit(struct dkRegion *r);
+
+/* Release storage held by region */
+void dkRegionDestroy(struct dkRegion *r);
+
+/* Make region empty, keeping its storage */
+void dkRegionReset(struct dkRegion *r);
+
+/* Return true if region is empty */
+DKbool dkRegionEmpty(const struct dkRegion *r);
+
+/* Return true if region overlaps rectangle */
+DKbool dkRegionOverlaps(const struct dkRegion *r, int x, int y, int w, int h);
+
+/* Move region by dx,dy */
+void dkRegionOffset(struct dkRegion *r, int dx, int dy);
+
+/* Make dst a copy of src */
+DKbool dkRegionCopy(struct dkRegion *dst, const struct dkRegion *src);
+
+/*
+** Set operations; dst may be one of the operands.  These return FALSE,
+** leaving dst unchanged, only if out of memory.
+*/
+DKbool dkRegionUnion(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b);
+DKbool dkRegionSubtract(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b);
+DKbool dkRegionIntersect(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b);
+
+/* Add, remove or clip to rectangle x,y,w,h */
+DKbool dkRegionUnionRect(struct dkRegion *r, int x, int y, int w, int h);
+DKbool dkRegionSubtractRect(struct dkRegion *r, int x, int y, int w, int h);
+DKbool dkRegionIntersectRect(struct dkRegion *r, int x, int y, int w, int h);
+
+#endif /* FX_REGION_H */
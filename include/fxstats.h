@@ -0,0 +1,125 @@
+/******************************************************************************
+ *                                                                            *
+ *                 E v e n t   L o o p   S t a t i s t i c s                  *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#ifndef FX_STATS_H
+#define FX_STATS_H
+
+#include <stdio.h>
+
+#include "fxdefs.h"
+#include "fxobject.h"
+
+/* Number of histogram buckets; bucket 0 counts durations under 1us, and
+ * bucket i counts durations of 2^(i-1) up to 2^i microseconds */
+#define DK_STATBUCKETS 24
+
+/* Number of event types tracked separately */
+#define DK_STATTYPES 64
+
+/* What the event loop was doing */
+enum dkStatSource {
+  STAT_EVENT,             /* Dispatching an event */
+  STAT_TIMER,             /* Handling a timeout */
+  STAT_CHORE,             /* Running a chore */
+  STAT_UPDATE,            /* Sending SEL_UPDATE to a widget */
+  STAT_INPUT,             /* Handling input activity */
+  STAT_WAIT,              /* Blocked waiting for something to happen */
+  STAT_PAINT,             /* Painting the damage of a window */
+  STAT_LAST
+};
+
+/* Queues sampled on each pass through the event loop */
+enum dkStatQueue {
+  STATQ_TIMERS,           /* Timers */
+  STATQ_CHORES,           /* Chores */
+  STATQ_REPAINTS,         /* Windows with damage */
+  STATQ_DIRTY,            /* Windows waiting for an update */
+  STATQ_EVENTS,           /* Events queued by the display connection */
+  STATQ_LAST
+};
+
+/* Histogram of durations */
+struct dkStatHist {
+  DKulong count;                        /* Number of samples */
+  DKlong  total;                        /* Sum of durations (ns) */
+  DKlong  max;                          /* Longest duration (ns) */
+  DKulong buckets[DK_STATBUCKETS];      /* Samples by duration */
+};
+
+/* Queue depth samples */
+struct dkStatDepth {
+  DKulong samples;                      /* Number of samples */
+  DKulong total;                        /* Sum of depths */
+  int     max;                          /* Deepest seen */
+  int     last;                         /* Last depth */
+};
+
+/* Per-class statistics */
+struct dkStatClass {
+  struct dkStatClass *next;             /* Next class */
+  const struct dkMetaClass *meta;       /* Class of the receiver */
+  struct dkStatHist   hist;             /* Handler durations */
+  struct dkStatHist   latency;          /* Delays from user input to the flush of its paint */
+};
+
+/* Event loop statistics */
+struct dkStats {
+  DKlong              started;          /* When collection started (steady ns) */
+  struct dkStatHist   sources[STAT_LAST];    /* Durations by source */
+  struct dkStatHist   types[DK_STATTYPES];   /* Event dispatch durations by event type */
+  struct dkStatDepth  queues[STATQ_LAST];    /* Queue depths */
+  struct dkStatClass *classes;          /* Handler durations by receiver class */
+  struct dtkHash     *classindex;       /* Classes by metaclass */
+  struct dkStatHist   inputdelay;       /* Delays from user input to its dispatch */
+  DKuint              inputlag;         /* Least lag of the event clock seen so far (ms) */
+  DKbool              haveinputlag;     /* Whether inputlag is set */
+};
+
+struct dkStats *dkStatsNew(void);
+void dkStatsDel(struct dkStats *st);
+void dkStatsReset(struct dkStats *st);
+
+/* Record that source spent ns nanoseconds; type is the event type for
+ * STAT_EVENT, and obj the receiver, if any */
+void dkStatsAdd(struct dkStats *st, int source, int type, const struct dkObject *obj, DKlong ns);
+
+/* Record the delay of user input being dispatched at now; time is the
+ * event time (ms) from the window system clock.  The delay is measured
+ * against the least lag between the two clocks seen so far, so it is
+ * what the event loop added on top of delivery. */
+void dkStatsInputDelay(struct dkStats *st, DKuint time, DKlong now);
+
+/* Record the delay from user input at event time (ms) to the flush at
+ * now of the paint of a window of class meta it caused */
+void dkStatsLatency(struct dkStats *st, const struct dkMetaClass *meta, DKuint time, DKlong now);
+
+/* Record depth of queue q */
+void dkStatsQueue(struct dkStats *st, int q, int depth);
+
+/* Add duration (ns) to histogram */
+void dkStatHistAdd(struct dkStatHist *h, DKlong ns);
+
+/* Approximate duration (ns) below which the given fraction of samples fall */
+DKlong dkStatHistPercentile(const struct dkStatHist *h, double fraction);
+
+/* Print report; typename maps event types to names, and may be NULL */
+void dkStatsDump(struct dkStats *st, FILE *fp, const char *(*typename)(int type));
+
+#endif /* FX_STATS_H */
@@ -26,6 +26,7 @@
 
 #include "fxfont.h"
 #include "fxscrollarea.h"
+#include "fxtextbuffer.h"
 
 /// Text widget options
 enum {
@@ -40,6 +41,13 @@ enum {
 };
 
 
+/// Messages
+enum {
+  TEXT_ID_COUNT = ID_LAST,            /// Count lines of mapped file
+  TEXT_ID_WRAP                        /// Wrap lines in the background
+};
+
+
 /// Selection modes
 enum FXTextSelectionMode {
   SELECT_CHARS,
@@ -85,6 +93,31 @@ struct dkHiliteStyle {
 };
 
 
+/* Rows of a line when word wrapping */
+struct dkTextRows {
+  int   gen;                  /* Wrap generation rows were made in, 0 if none */
+  int   nrows;                /* Number of rows */
+  int  *breaks;               /* Offsets of starts of rows after the first */
+};
+
+/* Rows of all lines when word wrapping; lines are kept in a ring with a
+ * gap, so edits in one place move few of them and lines dropped from the
+ * start move none, and the rows of its slots are added up in a Fenwick
+ * tree, so the rows before a line take O(log n) */
+struct dkTextWrap {
+  struct dkTextRows *lines;   /* Rows of lines, or NULL if not wrapping */
+  int  *sums;                 /* Fenwick tree of rows of slots, from 1 */
+  int   nlines;               /* Number of lines */
+  int   size;                 /* Number of lines allocated */
+  int   head;                 /* Slot of first line, or of gap if it comes first */
+  int   gap;                  /* Lines before gap */
+  int   gen;                  /* Generation of current wrap width */
+  int   rows;                 /* Rows of all lines, lines not wrapped yet counting one */
+  int   scan;                 /* Next line to wrap in the background */
+  int   left;                 /* Lines left to look at in the background */
+};
+
+
 /**
 * Text mutation callback data passed with the SEL_INSERTED,
 * SEL_REPLACED, and SEL_DELETED messages; both old and new
@@ -113,14 +146,12 @@ struct FXTextChange {
 
 struct dkText {
   struct dkScrollArea base;
-  char *buffer;                    /* Text buffer being edited */
-  char *sbuffer;                   /* Text style buffer */
+  struct dkTextBuffer text;        /* Text and styles being edited */
+  struct dkTextWrap wrap;          /* Rows of lines when word wrapping */
   int         *visrows;            /* Starts of rows in buffer */
   int          length;             /* Length of the actual text in the buffer */
   int          nvisrows;           /* Number of visible rows */
   int          nrows;              /* Total number of rows */
-  int          gapstart;            // Start of the insertion point (the gap)
-  int          gapend;              // End of the insertion point+1
   int          toppos;              // Start position of first visible row
   int          keeppos;             // Position to keep on top visible row
   int          toprow;              // Row number of first visible row
@@ -146,7 +177,10 @@ struct dkText {
   int          tabcolumns;          // Tab columns
   int          barwidth;            // Line number width
   int          barcolumns;          // Line number columns
+  int          maxlines;            // Most lines kept, or 0
+  int          maxbytes;            // Most bytes kept, or 0
   struct dkFont *font;                // Text font
+  DKushort       asciiwidths[128];    // Widths of ASCII characters in font, 0 if not measured
   DKColor        textColor;           // Normal text color
   DKColor        selbackColor;        // Select background color
   DKColor        seltextColor;        // Select text color
@@ -172,10 +206,82 @@ struct dkText {
   int          graby;               // Grab point y
   DKuchar        mode;                // Mode widget is in
   DKbool         modified;            // User has modified text
+  DKbool         styled;              // Styles of text are shown
 };
 
 struct dkText *dkTextNew(struct dkComposite *p, struct dkObject *tgt, DKSelector sel, DKuint opts, int x, int y, int w, int h, int pl, int pr, int pt, int pb);
 
+/* Replace m bytes at pos by n bytes of text */
+void dkTextReplaceText(struct dkText *txt, int pos, int m, const char *text, int n);
+void dkTextReplaceStyledText(struct dkText *txt, int pos, int m, const char *text, int n, int style);
+
+/* Append n bytes of text at the end of the buffer */
+void dkTextAppendText(struct dkText *txt, const char *text, int n);
+void dkTextAppendStyledText(struct dkText *txt, const char *text, int n, int style);
+
+/* Insert n bytes of text at position pos into the buffer */
+void dkTextInsertText(struct dkText *txt, int pos, const char *text, int n);
+
+/* Remove n bytes of text at position pos from the buffer */
+void dkTextRemoveText(struct dkText *txt, int pos, int n);
+
+/* Change the text in the buffer to new text */
+void dkTextSetText(struct dkText *txt, const char *text, int n);
+void dkTextSetStyledText(struct dkText *txt, const char *text, int n, int style);
+
+/*
+** Change the text in the buffer to the contents of file, which is mapped
+** rather than read, so huge files open at once.  Lines are counted in
+** the background, and the row count grows as they are.  Edits are kept
+** apart from the file, which is never written.  Returns FALSE if the
+** file can not be mapped.
+*/
+DKbool dkTextMapFile(struct dkText *txt, const char *filename);
+
+/* Change style of text range */
+void dkTextChangeStyle(struct dkText *txt, int pos, int n, int style);
+
+/* Set styled text mode */
+void dkTextSetStyled(struct dkText *txt, DKbool styled);
+
+/*
+** Bound the scrollback: whenever the text grows past maxlines lines or
+** maxbytes bytes, whole lines are dropped from the front until it fits
+** again; 0 means no bound.  Meant for logging windows, which append at
+** the end; their memory and cost per append then stay constant.
+*/
+void dkTextSetScrollback(struct dkText *txt, int maxlines, int maxbytes);
+
+/* Extract n bytes of text from position pos */
+void dkTextExtractText(struct dkText *txt, char *text, int pos, int n);
+
+/* Return length of buffer */
+int dkTextGetLength(struct dkText *txt);
+
+/* Return number of rows in buffer */
+int dkTextGetNumRows(struct dkText *txt);
+
+/* Count number of newlines */
+int dkTextCountLines(struct dkText *txt, int start, int end);
+
+/* Return position of begin of line containing position pos */
+int dkTextLineStart(struct dkText *txt, int pos);
+
+/* Return position of end of line containing position pos */
+int dkTextLineEnd(struct dkText *txt, int pos);
+
+/* Return start of next line */
+int dkTextNextLine(struct dkText *txt, int pos, int nl);
+
+/* Return start of previous line */
+int dkTextPrevLine(struct dkText *txt, int pos, int nl);
+
+/* Return number of line containing position pos, counting from 0 */
+int dkTextLineOfPos(struct dkText *txt, int pos);
+
+/* Return position of start of line, counting from 0 */
+int dkTextPosOfLine(struct dkText *txt, int line);
+
 #if 0
 
 class FXAPI FXText : public FXScrollArea {
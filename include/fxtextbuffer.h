@@ -0,0 +1,119 @@
+/******************************************************************************
+ *                                                                            *
+ *                        T e x t   B u f f e r                               *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#ifndef FX_TEXTBUFFER_H
+#define FX_TEXTBUFFER_H
+
+#include "fxdefs.h"
+
+struct dkTextChunk;
+
+/* Piece of text; pieces form a balanced tree in document order */
+struct dkTextPiece {
+  struct dkTextPiece *left;       /* Pieces before this one */
+  struct dkTextPiece *right;      /* Pieces after this one */
+  const char         *text;       /* Bytes of piece */
+  struct dkTextChunk *chunk;      /* Chunk holding bytes, or NULL if mapped */
+  int                 length;     /* Number of bytes in piece */
+  int                 size;       /* Number of bytes in subtree */
+  int                 lines;      /* Number of newlines in piece */
+  int                 sublines;   /* Number of newlines in subtree */
+  DKuint              priority;   /* Heap order which keeps tree balanced */
+  DKuchar             style;      /* Style of all bytes in piece */
+  DKbool              counted;    /* Whether newlines have been counted */
+};
+
+/* Block of storage for added text; blocks are never moved or resized,
+ * so pieces can point into them, and are freed when no piece does */
+struct dkTextChunk {
+  struct dkTextChunk *next;       /* Older chunk */
+  struct dkTextChunk *prev;       /* Newer chunk */
+  int                 refs;       /* Pieces pointing into chunk */
+  int                 used;       /* Bytes used */
+  int                 size;       /* Bytes allocated */
+  char                data[1];    /* Storage */
+};
+
+/*
+** Text buffer is a piece table: the text is a sequence of pieces, each
+** referring to bytes which are never changed once written.  Edits only
+** split, add and drop pieces, so they take O(log n) time in the number
+** of pieces no matter where they happen.  Pieces also count newlines,
+** so lines and positions convert into each other in O(log n) time.
+** The text may start out as a mapped file, whose newlines are counted
+** from the front as far as lines are asked for, or in the background.
+*/
+struct dkTextBuffer {
+  struct dkTextPiece *root;       /* Tree of pieces */
+  struct dkTextChunk *chunks;     /* Storage for added text, newest first */
+  int                 length;     /* Number of bytes of text */
+  DKuint              seed;       /* State of priority generator */
+  struct dkTextPiece *last;       /* Piece last looked up, or NULL */
+  int                 lastpos;    /* Position of piece last looked up */
+  int                 counted;    /* Newlines are counted in all pieces before this position */
+  const char         *map;        /* Mapped file, or NULL */
+  long                maplength;  /* Bytes mapped */
+};
+
+/* Initialize empty buffer */
+void dkTextBufferInit(struct dkTextBuffer *b);
+
+/* Release storage held by buffer */
+void dkTextBufferDestroy(struct dkTextBuffer *b);
+
+/* Make empty buffer b hold the contents of file, mapped read-only; the
+ * file is shared, not copied, and its newlines are not counted yet.
+ * Returns FALSE if the file can not be mapped. */
+DKbool dkTextBufferMap(struct dkTextBuffer *b, const char *filename);
+
+/* Count newlines up to at least position pos; returns TRUE if all of
+ * them are counted */
+DKbool dkTextBufferCount(struct dkTextBuffer *b, int pos);
+
+/* Replace m bytes at pos by n bytes of text in the given style; returns
+ * FALSE, leaving the buffer unchanged, only if out of memory */
+DKbool dkTextBufferReplace(struct dkTextBuffer *b, int pos, int m, const char *text, int n, int style);
+
+/* Change style of n bytes at pos */
+DKbool dkTextBufferChangeStyle(struct dkTextBuffer *b, int pos, int n, int style);
+
+/* Return contiguous bytes starting at pos, and their number in n */
+const char *dkTextBufferPeek(struct dkTextBuffer *b, int pos, int *n);
+
+/* Return byte at pos */
+int dkTextBufferGetByte(struct dkTextBuffer *b, int pos);
+
+/* Return style at pos */
+int dkTextBufferGetStyle(struct dkTextBuffer *b, int pos);
+
+/* Copy n bytes at pos to text */
+void dkTextBufferExtract(struct dkTextBuffer *b, char *text, int pos, int n);
+
+/* Return number of newlines in buffer counted so far */
+int dkTextBufferGetLines(const struct dkTextBuffer *b);
+
+/* Return number of newlines before pos, which is the line of pos */
+int dkTextBufferLinesBefore(struct dkTextBuffer *b, int pos);
+
+/* Return start of line, which follows the newline ending the line
+ * before; that is 0 for line 0, and the length past the last line */
+int dkTextBufferLineStart(struct dkTextBuffer *b, int line);
+
+#endif /* FX_TEXTBUFFER_H */
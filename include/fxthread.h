@@ -40,6 +40,27 @@ struct dkMutex {
 */
 DKlong dkThreadTime();
 
+/*
+** Return time in nanoseconds since some arbitrary start time; unlike
+** dkThreadTime() this is not affected by changes to the system clock.
+*/
+DKlong dkThreadSteadyTime();
+
+/*
+** Atomically replace the pointer at ptr with v and return the old
+** pointer; acts as a full memory barrier.
+*/
+void *dkAtomicSwapPtr(void *volatile *ptr, void *v);
+
+/* Atomically read the pointer at ptr (acquire) */
+void *dkAtomicGetPtr(void *volatile *ptr);
+
+/* Atomically store v into the pointer at ptr (release) */
+void dkAtomicPutPtr(void *volatile *ptr, void *v);
+
+/* Atomically replace the int at ptr with v and return the old value */
+int dkAtomicSwapInt(volatile int *ptr, int v);
+
 void dkMutexInit(struct dkMutex *pthis, DKbool recursive);
 void dkMutexLock(struct dkMutex *m);
 DKbool dkMutexTryLock(struct dkMutex *m);
@@ -54,6 +54,7 @@
 #define FLAG_SCROLLINSIDE 0x00100000     /* Scroll only when inside */
 #define FLAG_SCROLLING    0x00200000     /* Right mouse scrolling */
 #define FLAG_OWNED        0x00400000
+#define FLAG_MOTIONHINT   0x00800000     /* Motion only on demand */
 
 /// Layout hints for child widgets
 enum {
@@ -252,6 +253,7 @@ struct dkWindow {
 	struct dkWindow *prev;               /* Previous Sibling */
 	struct dkWindow *focus;              /* Focus Child */
 	unsigned int wk;                     /* Window Key */
+	DKuint stack;                        /* Stacking order among siblings, topmost highest */
 
   struct dkComposeContext *composeContext;  /* Compose context */
   struct dkCursor *defaultCursor;           /* Normal Cursor */
@@ -300,10 +302,13 @@ int dkWindowGetCursorPosition(struct dkWindow *w, int *x, int *y, DKuint *button
 void dkWindowTranslateCoordinatesTo(struct dkWindow *pthis, int *tox, int *toy, struct dkWindow *towindow, int fromx, int fromy);
 void dkWindowTranslateCoordinatesFrom(struct dkWindow *pthis, int *tox, int *toy, struct dkWindow *fromwindow, int fromx, int fromy);
 int dkWindowContainsChild(struct dkWindow *pthis, struct dkWindow *child);
+struct dkWindow *dkWindowGetChildAt(struct dkWindow *pthis, int x, int y);
 void dkWindowUpdateRect(struct dkWindow *win, int x, int y, int w, int h);
 void dkWindowUpdate(struct dkWindow *win);
 void dkWindowGrab(struct dkWindow *win);
 void dkWindowUngrab(struct dkWindow *win);
+void dkWindowSetMotionHint(struct dkWindow *win, DKbool hint);
+DKbool dkWindowGetMotionHint(struct dkWindow *win);
 int dkWindowAcquireSelection(struct dkWindow *w, DKDragType *types, DKuint numtypes);
 
 /* Message handlers */
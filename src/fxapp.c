@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #ifdef WIN32
@@ -36,6 +37,29 @@
 #ifdef HAVE_XRANDR_H
 #include <X11/extensions/Xrandr.h>
 #endif /* X11 */
+#ifdef HAVE_X11_XLIB_XCB_H
+#include <X11/Xlib-xcb.h>
+#endif
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+#include <X11/extensions/XInput2.h>
+#endif
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
 #endif /* WIN32 */
 
 #include "fxapp.h"
@@ -43,7 +67,10 @@
 #include "fxdrv.h"
 #include "fxfont.h"
 #include "fxkeys.h"
+#include "fxregion.h"
 #include "fxrootwindow.h"
+#include "fxrecord.h"
+#include "fxstats.h"
 #include "fxthread.h"
 #include "fxutils.h"
 
@@ -225,13 +252,62 @@ static const BYTE stipple_patterns[17][16]={
 
 #endif
 
+/* Maximum number of ready descriptors reported by one wait */
+#define DK_MAXREADY 64
+
+/* Maximum number of posted messages delivered in one go */
+#define DK_MAXPOSTED 256
+
+/* Maximum number of signals read from the signal descriptor in one go */
+#define DK_MAXSIGNALS 32
+
+/* Maximum number of windows painted for user input traced per frame */
+#define DK_MAXTRACED 64
+
+/* Maximum number of X events read from the display in one go */
+#define DK_MAXBATCH 1024
+
+/* Windows tracked at once while compressing a batch */
+#define DK_BATCHWINDOWS 32
+
+/* Mouse wheel amount of one notch */
+#define DK_WHEELNOTCH 120
+
+#ifndef WIN32
+/* Motion folded into an event of the batch */
+struct dkFold {
+  int           first;          /* First sample, or next motion in the chain while compressing */
+  int           count;          /* Number of samples */
+};
+
+/* Smooth scrolling valuator of a pointer device */
+struct dkScroller {
+  int           device;         /* Device */
+  int           number;         /* Valuator */
+  double        increment;      /* Distance of one notch */
+  double        last;           /* Last value seen */
+  double        rest;           /* Wheel amount not yet delivered */
+  DKbool        havelast;       /* Whether last is known */
+};
+
+/* Scroll copy the server may not have done yet */
+struct dkCopy {
+  DKID          window;         /* Window scrolled */
+  unsigned long serial;         /* Request number of the copy */
+  int           dx;             /* Scroll amount */
+  int           dy;
+};
+#endif
+
 /* Timer record */
 struct fxTimer {
-	struct fxTimer       *next;              // Next timeout in list
+	struct fxTimer       *next;              // Next timeout in recycle list
 	struct dkObject      *target;            // Receiver object
 	void                 *data;              // User data
 	DKSelector            message;           // Message sent to receiver
-	DKlong                due;               // When timer is due (ns)
+	DKlong                due;               // When timer is due (steady ns)
+	DKuint                seq;               // Insertion sequence, for ties
+	int                   index;             // Position in timer heap
 };
 
 
@@ -244,18 +320,45 @@ extern DKuint wkbMapKeyCode(UINT msg, WPARAM wParam, LPARAM lParam);
 /* Idle record */
 struct dkChore {
   struct dkChore       *next;              // Next chore in list
+  struct dkChore       *prev;              // Previous chore in list
+  struct dkObject      *target;            // Receiver object
+  void                 *data;              // User data
+  DKSelector            message;           // Message sent to receiver
+  DKuint                seq;               // Insertion sequence
+  int                   priority;          // Priority class
+};
+
+/* Input handler record */
+struct dkHandler {
   struct dkObject      *target;            // Receiver object
   void                 *data;              // User data
   DKSelector            message;           // Message sent to receiver
 };
 
-/* A repaint event record */
+/* Input record */
+struct dkInput {
+  struct dkHandler      read;              // Handler for read activity
+  struct dkHandler      write;             // Handler for write activity
+  struct dkHandler      excpt;             // Handler for exceptional conditions
+};
+
+/* Posted message record */
+struct dkPosted {
+  struct dkPosted *volatile next;          // Next message in queue
+  struct dkObject      *target;            // Receiver object
+  void                 *data;              // User data
+  DKSelector            message;           // Message type and id sent to receiver
+};
+
+/* A repaint record; one per damaged window */
 struct dkRepaint {
-  struct dkRepaint      *next;              // Next repaint in list
+  struct dkRepaint      *next;              // Next damaged window
+  struct dkRepaint      *prev;              // Previous damaged window
   DKID                   window;            // Window ID of the dirty window
-  struct dtkRectangle    rect;              // Dirty rectangle
-  int                    hint;              // Hint for compositing
+  struct dkRegion        region;            // Dirty region
   DKbool                 synth;             // Synthetic expose event or real one?
+  DKuint                 input;             // Earliest user input the damage came from, 0 if none
+  DKuint                 inputtime;         // Its event time (ms)
 };
 
 struct fx_invocation {
@@ -269,18 +372,31 @@ struct fx_invocation {
 
 #ifdef WIN32
 static void getSystemFont(struct dkFontDesc *fontdesc);
+#else
+static const char *dtkDrvEventName(int type);
 #endif
+static DKbool dtkDrvInputPending(App *app);
 struct dkWindow *dkAppFindWindowAt(struct dkApp *app, int rx, int ry, DKID window);
 struct dkWindow *dkAppGetFocusWindow(struct dkApp *app);
+static void dkAppOpenWakeup(struct dkApp *app);
+static void dkAppCloseWakeup(struct dkApp *app);
+static void dkAppCloseSignals(struct dkApp *app);
+static struct dkPosted *dkAppPostPop(struct dkApp *app);
 
 /* Define message target functions */
 long dkApp_onCmdHover(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data);
 long dkApp_onCmdQuit(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data);
+long dkApp_onPosted(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data);
+long dkApp_onSignal(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data);
+long dkApp_onCmdDump(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data);
 
 static struct dkMapEntry dkAppMapEntry[] = {
   FXMAPFUNC(SEL_TIMEOUT, ID_HOVER, dkApp_onCmdHover),
   FXMAPFUNC(SEL_TIMEOUT, ID_QUIT, dkApp_onCmdQuit),
-  FXMAPFUNC(SEL_COMMAND, ID_QUIT, dkApp_onCmdQuit)
+  FXMAPFUNC(SEL_COMMAND, ID_QUIT, dkApp_onCmdQuit),
+  FXMAPFUNC(SEL_COMMAND, ID_DUMP, dkApp_onCmdDump),
+  FXMAPFUNC(SEL_IO_READ, ID_POSTED, dkApp_onPosted),
+  FXMAPFUNC(SEL_IO_READ, ID_SIGNAL, dkApp_onSignal)
 };
 
 static struct dkMetaClass dkAppMetaClass = {
@@ -312,11 +428,29 @@ long dkApp_onCmdHover(void *pthis, struct dkObject *obj, DKSelector selhi, DKSel
 {
   int x, y;
   DKuint buttons;
+  DKbool known = FALSE;
   struct dkWindow *window;
   struct dkApp *app = (struct dkApp *)pthis;
+#ifdef HAVE_X11_XLIB_XCB_H
+  xcb_query_pointer_cookie_t cookie;
+  xcb_query_pointer_reply_t *reply;
+
+  /* Collect the answer to the query sent with the last check, whether
+   * it is used or not, so it is never taken for a later one */
+  if (app->hoverpending) {
+    cookie.sequence = app->hovercookie;
+    if ((reply = xcb_query_pointer_reply((xcb_connection_t*)app->xcb, cookie, NULL)) != NULL) {
+      x = reply->root_x;
+      y = reply->root_y;
+      known = TRUE;
+      free(reply);
+    }
+    app->hoverpending = FALSE;
+  }
+#endif
 
   if (!app->mouseGrabWindow && app->cursorWindow && app->cursorWindow != (struct dkWindow *)app->root) {
-    dkWindowGetCursorPosition((struct dkWindow *)app->root, &x, &y, &buttons);
+    if (!known) dkWindowGetCursorPosition((struct dkWindow *)app->root, &x, &y, &buttons);
     if ((window = dkAppFindWindowAt(app, x, y, 0)) == NULL || !dkWindowContainsChild(DtkWindowGetShell(window), app->cursorWindow)) {
       app->event.type = SEL_LEAVE;
       app->event.root_x = x;
@@ -326,6 +460,14 @@ long dkApp_onCmdHover(void *pthis, struct dkObject *obj, DKSelector selhi, DKSel
     }
   }
   fxAppAddTimeout(app, (struct dkObject *)app, ID_HOVER, 200, NULL);
+#ifdef HAVE_X11_XLIB_XCB_H
+  /* Ask now where the pointer is, so the answer is waiting next time;
+   * only if the next check will look */
+  if (app->xcb && !app->mouseGrabWindow && app->cursorWindow && app->cursorWindow != (struct dkWindow *)app->root) {
+    app->hovercookie = xcb_query_pointer((xcb_connection_t*)app->xcb, XDefaultRootWindow((Display*)app->display)).sequence;
+    app->hoverpending = TRUE;
+  }
+#endif
   return 0;
 }
 
@@ -348,6 +490,15 @@ dkApp_onCmdQuit(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector
   return 1;
 }
 
+/* Dump event loop statistics, if being collected */
+long
+dkApp_onCmdDump(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data)
+{
+  struct dkApp *app = (struct dkApp *)pthis;
+  dkAppDumpStats(app, stderr);
+  return 1;
+}
+
 long
 dkApp_handle(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data)
 {
@@ -364,6 +515,7 @@ struct dkApp *
 dkAppNew(void)
 {
 	struct dkApp *ret;
+	int i;
 
 	/* allocate and send off to base class */
 	ret = calloc(1, sizeof(struct dkApp));
@@ -384,13 +536,41 @@ dkAppNew(void)
 
   ret->refresher = NULL;                      /* GUI refresher pointer */
   ret->refresherstop = NULL;                  /* GUI refresher end pointer */
+  ret->updatemode = UPDATE_TREE;              /* Walk the whole tree */
+  ret->updatebudget = 2000000;                /* Spend at most 2ms per idle iteration on GUI updates */
+  ret->inputfirst = FALSE;                    /* Idle work runs to the end of its budget */
+  ret->updaters = NULL;                       /* No windows registered for updates */
+  ret->nupdaters = 0;
+  ret->maxupdaters = 0;
+  ret->updaterindex = DtkHashNew();
+  ret->dirty = NULL;                          /* No dirty windows */
+  ret->dirtyhead = 0;
+  ret->ndirty = 0;
+  ret->maxdirty = 0;
+  ret->dirtyindex = DtkHashNew();
   ret->timers = NULL;                         /* No timers present */
-  ret->chores = NULL;                         /* No chores present */
+  ret->ntimers = 0;
+  ret->maxtimers = 0;
+  ret->timerseq = 0;
+  ret->timerindex = DtkSelHashNew();          /* Timers by target and message */
+  for (i = 0; i < CHORE_LAST; i++) {
+    ret->chores[i] = NULL;                    /* No chores present */
+    ret->choretail[i] = NULL;
+  }
+  ret->choreindex = DtkSelHashNew();          /* Chores by target and message */
+  ret->choreseq = 0;
+  ret->chorebudget = 2000000;                 /* Spend at most 2ms per idle iteration on chores */
+  ret->choredeadline = 0;
   ret->repaints = NULL;                       /* No outstanding repaints */
+  ret->repainttail = NULL;
+  ret->repaintindex = DtkHashNew();           /* Repaints by window */
+  ret->frameinterval = 1000000000 / 60;       /* Paint at most 60 frames per second */
+  ret->framedue = 0;
   ret->timerrecs = NULL;                      /* No timer records */
   ret->chorerecs = NULL;                      /* No chore records */
   ret->repaintrecs = NULL;                    /* No repaint records */
 
+  ret->inputs = calloc(sizeof(struct dkInput), 8);  /* Input file descriptors */
   ret->ninputs = 8;                           /* Number of these */
   ret->maxinput = -1;                         /* Maximum input number */
 
@@ -404,6 +584,10 @@ dkAppNew(void)
   ret->event.rect.w = 0;
   ret->event.rect.h = 0;
   ret->event.synthetic = 0;
+  ret->event.repeat = 1;
+  ret->event.serial = 0;
+  ret->event.samples = NULL;
+  ret->event.nsamples = 0;
   dstr_init(&ret->event.text);
 
   /* Clear sticky mod state */
@@ -437,6 +621,35 @@ dkAppNew(void)
   ret->r_fds = calloc(sizeof(fd_set), 1);        /* Read File Descriptor set */
   ret->w_fds = calloc(sizeof(fd_set), 1);        /* Write File Descriptor set */
   ret->e_fds = calloc(sizeof(fd_set), 1);        /* Except File Descriptor set */
+#ifdef HAVE_SYS_EPOLL_H
+  ret->reactor = epoll_create1(EPOLL_CLOEXEC);   /* Reactor; falls back to select() */
+#else
+  ret->reactor = -1;
+#endif
+  if (ret->reactor >= 0) {
+#ifdef HAVE_SYS_EPOLL_H
+    ret->ready = calloc(sizeof(struct epoll_event), DK_MAXREADY);
+#endif
+  } else {
+    ret->ready = calloc(sizeof(fd_set), 3);      /* Ready read, write, except sets */
+  }
+  ret->nready = 0;
+  ret->signals = NULL;                           /* No signal handlers */
+  ret->sigmask = NULL;
+  ret->sigfd[0] = ret->sigfd[1] = -1;            /* Signal descriptors opened on first use */
+  ret->timerfd = -1;                             /* Timer descriptor */
+  ret->timerdue = 0;
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+  if (ret->reactor >= 0) {
+    struct epoll_event ev;
+    if ((ret->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0) {
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = ret->timerfd;
+      epoll_ctl(ret->reactor, EPOLL_CTL_ADD, ret->timerfd, &ev);
+    }
+  }
+#endif
 /* MS-Windows specific inits */
 #else
   /* SELECTION */
@@ -446,6 +659,13 @@ dkAppNew(void)
   ret->handles = calloc(sizeof(void *), ret->ninputs);   /* Same size as inputs array */
 #endif
 
+  /* Messages posted from other threads */
+  ret->poststub = calloc(sizeof(struct dkPosted), 1);
+  ret->posthead = ret->poststub;
+  ret->posttail = ret->poststub;
+  ret->postwake = 0;
+  dkAppOpenWakeup(ret);
+
   /* Other settings */
   ret->clickSpeed = 400;
   ret->blinkSpeed = 500;
@@ -486,10 +706,16 @@ dtk_app_opendisplay(App *app)
   DKTRACE((100, "dkApp: opening display.\n"));
 
 	DtkWindowHashNew();
-	dtkDrvOpenDisplay(app, app->dpy);
+
+  /* Headless; the null driver stands in for the display */
+  if (app->headless) {
+    DKTRACE((100, "dkApp: running headless.\n"));
+  } else {
+    dtkDrvOpenDisplay(app, app->dpy);
 #ifndef WIN32
     app->wmMotifHints = XInternAtom(app->display, "_MOTIF_WM_HINTS", 0);
 #endif
+  }
 
   /* Clear sticky mod state */
   app->stickyMods = 0;
@@ -498,11 +724,13 @@ dtk_app_opendisplay(App *app)
   dkMutexLock(&app->appMutex);
 
   /* We have been initialized */
-  app->display_opened = 1;
+  if (!app->headless) app->display_opened = 1;
 }
 
 void dkAppInit(App *app, int argc, char *argv[])
 {
+  const char *replay = NULL;
+  double speed = 1.0;
   int i, j;
 #ifdef WIN32
   struct dkFontDesc fontdesc;
@@ -514,6 +742,9 @@ void dkAppInit(App *app, int argc, char *argv[])
 #ifndef WIN32
   /* Try locate display */
   if((d = getenv("DISPLAY")) != NULL) app->dpy = d;
+
+  /* Run without a display */
+  if ((d = getenv("DK_HEADLESS")) != NULL && *d && strcmp(d, "0") != 0) app->headless = TRUE;
 #endif
 
   /* Parse out DK args */
@@ -530,6 +761,66 @@ void dkAppInit(App *app, int argc, char *argv[])
       continue;
     }
 
+    /* Run without a display */
+    if (strcmp(argv[j], "-headless") == 0) {
+#ifndef WIN32
+      app->headless = TRUE;
+#else
+      printf("dkAppInit: -headless is not supported on this platform.\n");
+#endif
+      j++;
+      continue;
+    }
+
+    /* Take pointer input through XInput2 */
+    if (strcmp(argv[j], "-xinput2") == 0) {
+#ifndef WIN32
+      app->xinput = TRUE;
+#else
+      printf("dkAppInit: -xinput2 is not supported on this platform.\n");
+#endif
+      j++;
+      continue;
+    }
+
+    /* Record events to file */
+    if (strcmp(argv[j], "-record") == 0) {
+      if (++j >= argc) {
+        printf("dkAppInit: missing argument for -record.\n");
+        exit(1);
+      }
+      if (!dkAppRecord(app, argv[j])) printf("dkAppInit: unable to record to %s.\n", argv[j]);
+      j++;
+      continue;
+    }
+
+    /* Replay events from file, then quit */
+    if (strcmp(argv[j], "-replay") == 0) {
+      if (++j >= argc) {
+        printf("dkAppInit: missing argument for -replay.\n");
+        exit(1);
+      }
+      replay = argv[j++];
+      continue;
+    }
+
+    /* Speed of replay relative to recording; 0 is as fast as possible */
+    if (strcmp(argv[j], "-replayspeed") == 0) {
+      if (++j >= argc) {
+        printf("dkAppInit: missing argument for -replayspeed.\n");
+        exit(1);
+      }
+      speed = strtod(argv[j++], NULL);
+      continue;
+    }
+
+    /* Cut idle work short for user input */
+    if (strcmp(argv[j], "-inputpriority") == 0) {
+      dkAppSetInputPriority(app, TRUE);
+      j++;
+      continue;
+    }
+
     /* Copy program arguments */
     argv[i++] = argv[j++];
   }
@@ -538,6 +829,12 @@ void dkAppInit(App *app, int argc, char *argv[])
   argv[i] = NULL;
   argc = i;
 
+  /* Start replay */
+  if (replay && !dkAppReplay(app, replay, speed, TRUE)) {
+    printf("dkAppInit: unable to replay %s.\n", replay);
+    exit(1);
+  }
+
   /* Remember arguments */
   app->appArgv = argv;
   app->appArgc = argc;
@@ -577,6 +874,15 @@ void dkAppCreate(App *app)
 void
 fxAppRefresh(App *app)
 {
+  int i;
+
+  /* Only the windows registered for updates need to be refreshed */
+  if (app->updatemode == UPDATE_DIRTY) {
+    for (i = 0; i < app->nupdaters; i++)
+      dkAppMarkDirty(app, app->updaters[i]);
+    return;
+  }
+
   if (app->refresher == NULL)
     app->refresher = app->root;
 
@@ -586,9 +892,288 @@ fxAppRefresh(App *app)
 void
 dkAppDel(struct dkApp *app)
 {
+  struct dkRepaint *r;
+  struct dkPosted *p;
+
+  /* Drop damage of windows nobody will paint anymore */
+  while ((r = app->repaints) != NULL) {
+    app->repaints = r->next;
+    dkRegionDestroy(&r->region);
+    free(r);
+  }
+  while ((r = app->repaintrecs) != NULL) {
+    app->repaintrecs = r->next;
+    dkRegionDestroy(&r->region);
+    free(r);
+  }
+  DtkHashFree(app->repaintindex);
+  free(app->updaters);
+  free(app->dirty);
+  DtkHashFree(app->updaterindex);
+  DtkHashFree(app->dirtyindex);
+
+  /* Drop messages nobody will deliver anymore */
+  while ((p = dkAppPostPop(app)) != NULL)
+    free(p);
+  free(app->poststub);
+  dkAppCloseWakeup(app);
+  dkAppCloseSignals(app);
+#ifndef WIN32
+  if (app->reactor >= 0) close(app->reactor);
+  if (app->timerfd >= 0) close(app->timerfd);
+  free(app->ready);
+  free(app->batch);
+  free(app->folds);
+  free(app->samples);
+  free(app->scrollers);
+  free(app->copies);
+  free(app->r_fds);
+  free(app->w_fds);
+  free(app->e_fds);
+#else
+  free(app->handles);
+#endif
+  free(app->inputs);
+  free(app->timers);
+  if (app->stats) dkStatsDel(app->stats);
+  if (app->recorder) dkRecorderDel(app->recorder);
+  if (app->replayer) dkReplayerDel(app->replayer);
+  DtkSelHashFree(app->timerindex);
+  DtkSelHashFree(app->choreindex);
   free(app);
 }
 
+/*
+  Notes:
+  - In UPDATE_DIRTY mode, a refresh no longer walks the whole widget
+    tree; only windows registered with dkAppAddUpdate get SEL_UPDATE on
+    each refresh, and a window can be queued for a single update with
+    dkAppMarkDirty, for example by its target when its state changed.
+  - Dirty windows are updated oldest first, for at most updatebudget per
+    idle iteration, so a large dirty set does not hold up events.  The
+    walk of the whole tree in UPDATE_TREE mode has the same budget.
+  - A window is in the dirty set once; removing it just drops it from the
+    index, and its stale entry in the queue is skipped.
+*/
+
+/* Set how the GUI is updated; budget is the time in microseconds spent
+ * on dirty windows per idle iteration, 0 to keep the current budget */
+void dkAppSetUpdateMode(struct dkApp *app, int mode, DKuint budget)
+{
+  app->updatemode = mode;
+  if (budget) app->updatebudget = (DKlong)budget * 1000;
+  if (mode == UPDATE_DIRTY) {
+    app->refresher = app->refresherstop = NULL;
+  }
+}
+
+/* Queue window for one update */
+void dkAppMarkDirty(struct dkApp *app, struct dkWindow *w)
+{
+  int n;
+
+  if (!w || DtkHashFind(app->dirtyindex, w)) return;
+  if (app->ndirty == app->maxdirty) {
+    if (app->dirtyhead > 0) {
+      memmove(app->dirty, app->dirty + app->dirtyhead, sizeof(struct dkWindow *) * (app->ndirty - app->dirtyhead));
+      app->ndirty -= app->dirtyhead;
+      app->dirtyhead = 0;
+    } else {
+      n = FXMAX(32, app->maxdirty * 2);
+      if (!fx_resize((void**)&app->dirty, sizeof(struct dkWindow *) * n)) return;
+      app->maxdirty = n;
+    }
+  }
+  app->dirty[app->ndirty++] = w;
+  DtkHashInsert(app->dirtyindex, w, w);
+}
+
+/* Queue all registered windows of target for one update */
+void dkAppMarkTargetDirty(struct dkApp *app, struct dkObject *tgt)
+{
+  int i;
+
+  for (i = 0; i < app->nupdaters; i++) {
+    if (app->updaters[i]->target == tgt) dkAppMarkDirty(app, app->updaters[i]);
+  }
+}
+
+/* Register window to be updated on each refresh */
+void dkAppAddUpdate(struct dkApp *app, struct dkWindow *w)
+{
+  int n;
+
+  if (!w || DtkHashFind(app->updaterindex, w)) return;
+  if (app->nupdaters == app->maxupdaters) {
+    n = FXMAX(32, app->maxupdaters * 2);
+    if (!fx_resize((void**)&app->updaters, sizeof(struct dkWindow *) * n)) return;
+    app->maxupdaters = n;
+  }
+  app->updaters[app->nupdaters++] = w;
+  DtkHashInsert(app->updaterindex, w, (void *)(DKuval)app->nupdaters);
+  dkAppMarkDirty(app, w);
+}
+
+/* Unregister window, and drop any update it is waiting for */
+void dkAppRemoveUpdate(struct dkApp *app, struct dkWindow *w)
+{
+  int i;
+
+  DtkHashRemove(app->dirtyindex, w);
+  if ((i = (int)(DKuval)DtkHashRemove(app->updaterindex, w)) == 0) return;
+  app->updaters[i - 1] = app->updaters[--app->nupdaters];
+  if (i - 1 < app->nupdaters)
+    DtkHashReplace(app->updaterindex, app->updaters[i - 1], (void *)(DKuval)i);
+}
+
+/* Send SEL_UPDATE to dirty windows, oldest first, until none are left or
+ * the budget is used up; returns TRUE if some are left */
+static DKbool dkAppUpdateDirty(struct dkApp *app)
+{
+  DKlong start, now, deadline;
+  struct dkWindow *w;
+
+  now = dkThreadSteadyTime();
+  deadline = now + app->updatebudget;
+  while (app->dirtyhead < app->ndirty) {
+    w = app->dirty[app->dirtyhead++];
+    if (!DtkHashRemove(app->dirtyindex, w)) continue;
+    start = now;
+    ((struct dkObject *)w)->handle(w, (struct dkObject *)app, SEL_UPDATE, 0, NULL);
+    now = dkThreadSteadyTime();
+    if (app->stats) dkStatsAdd(app->stats, STAT_UPDATE, -1, (struct dkObject *)w, now - start);
+    if (deadline <= now || (app->inputfirst && dtkDrvInputPending(app))) break;
+  }
+  if (app->dirtyhead < app->ndirty) return TRUE;
+  app->dirtyhead = app->ndirty = 0;
+  return FALSE;
+}
+
+/* Send SEL_UPDATE to windows of the tree walk until it gets back where
+ * it started or the budget is used up; returns TRUE if some are left */
+static DKbool dkAppUpdateTree(struct dkApp *app)
+{
+  DKlong start, now, deadline;
+  struct dkWindow *w;
+
+  now = dkThreadSteadyTime();
+  deadline = now + app->updatebudget;
+  while ((w = app->refresher) != NULL) {
+    start = now;
+    ((struct dkObject *)w)->handle(w, (struct dkObject *)app, SEL_UPDATE, 0, NULL);
+    now = dkThreadSteadyTime();
+    if (app->stats) dkStatsAdd(app->stats, STAT_UPDATE, -1, (struct dkObject *)w, now - start);
+    if (!app->refresher) break;
+    if (app->refresher->first) {
+      app->refresher = app->refresher->first;
+    } else {
+      while (app->refresher->parent) {
+        if (app->refresher->next) {
+          app->refresher = app->refresher->next;
+          break;
+        }
+        app->refresher = app->refresher->parent;
+      }
+    }
+    if (app->refresher == app->refresherstop) break;
+    if (deadline <= now || (app->inputfirst && dtkDrvInputPending(app))) return TRUE;
+  }
+  app->refresher = app->refresherstop = NULL;
+  return FALSE;
+}
+
+/* Set the rate at which damage is painted, in frames per second; with
+ * 0 there is no frame clock and damage is painted box by box whenever
+ * the application is idle.  Windows paints through WM_PAINT, which the
+ * system already coalesces, so this only applies to X11. */
+void dkAppSetFrameRate(struct dkApp *app, DKuint fps)
+{
+  app->frameinterval = fps ? 1000000000 / fps : 0;
+  app->framedue = 0;
+}
+
+/* With input priority, painting and GUI updates stop between windows
+ * as soon as the user pressed a key or button, and resume after it has
+ * been dispatched; chores always do */
+void dkAppSetInputPriority(struct dkApp *app, DKbool enable)
+{
+  app->inputfirst = enable;
+}
+
+/* Start or stop collecting event loop statistics; starting again
+ * clears the statistics collected so far */
+void dkAppSetStats(struct dkApp *app, DKbool enable)
+{
+  if (enable) {
+    if (app->stats) dkStatsReset(app->stats); else app->stats = dkStatsNew();
+  } else if (app->stats) {
+    dkStatsDel(app->stats);
+    app->stats = NULL;
+  }
+}
+
+/* Print event loop statistics */
+void dkAppDumpStats(struct dkApp *app, FILE *fp)
+{
+  if (!app->stats) {
+    fprintf(fp, "Event loop statistics are not being collected\n");
+    return;
+  }
+#ifndef WIN32
+  dkStatsDump(app->stats, fp, dtkDrvEventName);
+#else
+  dkStatsDump(app->stats, fp, NULL);
+#endif
+}
+
+/* Start recording the events and timer firings to file, replacing
+ * any recording in progress; NULL just stops recording */
+DKbool dkAppRecord(struct dkApp *app, const char *filename)
+{
+  if (app->recorder) {
+    dkRecorderDel(app->recorder);
+    app->recorder = NULL;
+  }
+#ifndef WIN32
+  if (filename && (app->recorder = dkRecorderNew(filename)) == NULL) return FALSE;
+  return TRUE;
+#else
+  return filename == NULL;
+#endif
+}
+
+/* Start replaying a recording, at speed times the recorded speed or as
+ * fast as the application keeps up if speed is 0; when it is done, the
+ * throughput and latency are printed, and the application stopped if
+ * quit is set.  Only the user input is replayed; exposures, configures
+ * and so on come from the display as usual. */
+DKbool dkAppReplay(struct dkApp *app, const char *filename, double speed, DKbool quit)
+{
+  if (app->replayer) {
+    dkReplayerDel(app->replayer);
+    app->replayer = NULL;
+  }
+#ifndef WIN32
+  if (filename && (app->replayer = dkReplayerNew(filename, speed, quit)) == NULL) return FALSE;
+  return TRUE;
+#else
+  return filename == NULL;
+#endif
+}
+
+/* Sample the depths of the queues */
+static void dkAppStatsQueues(struct dkApp *app)
+{
+  dkStatsQueue(app->stats, STATQ_TIMERS, app->ntimers);
+  dkStatsQueue(app->stats, STATQ_CHORES, app->choreindex->used);
+  dkStatsQueue(app->stats, STATQ_REPAINTS, app->repaintindex->used);
+  dkStatsQueue(app->stats, STATQ_DIRTY, app->dirtyindex->used);
+#ifndef WIN32
+  if (app->display_opened)
+    dkStatsQueue(app->stats, STATQ_EVENTS, XQLength((Display*)app->display) + app->nbatch - app->batchhead);
+#endif
+}
+
 int dkAppRun(App *app)
 {
   struct fx_invocation inv;
@@ -617,17 +1202,100 @@ void dkAppStop(struct dkApp *app, int value)
   }
 }
 
-/* Add timeout, sorted by time */
+/*
+  Notes:
+  - Timers are kept in a binary heap ordered by due time, and indexed by
+    target and message so add, reschedule and remove are O(log n).
+  - Timers due at the same time fire most recently added first; this is
+    the order the sorted timer list used to produce.
+*/
+
+/* Return TRUE if timer a fires before timer b */
+static int fxTimerBefore(struct fxTimer *a, struct fxTimer *b)
+{
+  return a->due < b->due || (a->due == b->due && (int)(a->seq - b->seq) > 0);
+}
+
+/* Move timer at position i up toward the root of the heap */
+static void fxAppTimerUp(struct dkApp *app, int i)
+{
+  struct fxTimer *t = app->timers[i];
+  int p;
+
+  while (i > 0) {
+    p = (i - 1) >> 1;
+    if (!fxTimerBefore(t, app->timers[p])) break;
+    app->timers[i] = app->timers[p];
+    app->timers[i]->index = i;
+    i = p;
+  }
+  app->timers[i] = t;
+  t->index = i;
+}
+
+/* Move timer at position i down toward the leaves of the heap */
+static void fxAppTimerDown(struct dkApp *app, int i)
+{
+  struct fxTimer *t = app->timers[i];
+  int c;
+
+  while ((c = 2 * i + 1) < app->ntimers) {
+    if (c + 1 < app->ntimers && fxTimerBefore(app->timers[c + 1], app->timers[c])) c++;
+    if (!fxTimerBefore(app->timers[c], t)) break;
+    app->timers[i] = app->timers[c];
+    app->timers[i]->index = i;
+    i = c;
+  }
+  app->timers[i] = t;
+  t->index = i;
+}
+
+/* Restore heap order after the due time of the timer at position i changed */
+static void fxAppTimerMoved(struct dkApp *app, int i)
+{
+  if (i > 0 && fxTimerBefore(app->timers[i], app->timers[(i - 1) >> 1]))
+    fxAppTimerUp(app, i);
+  else
+    fxAppTimerDown(app, i);
+}
+
+/* Take timer out of the heap and the index */
+static void fxAppTimerUnlink(struct dkApp *app, struct fxTimer *t)
+{
+  struct fxTimer *last;
+  int i = t->index;
+
+  DtkSelHashRemove(app->timerindex, t->target, t->message);
+  last = app->timers[--app->ntimers];
+  if (last != t) {
+    app->timers[i] = last;
+    last->index = i;
+    fxAppTimerMoved(app, i);
+  }
+}
+
+/* Add timeout, or reschedule it if we already have it */
 void
 fxAppAddTimeout(struct dkApp *app, struct dkObject *tgt, FXSelector sel, DKuint ms, void *ptr)
 {
 	DKlong milliseconds = 1000000;
 	DKlong nsec = ms * milliseconds;
-	struct fxTimer *t, **tt;
+	struct fxTimer *t;
+
+	/* If we already have this timeout message, update it */
+	if ((t = DtkSelHashFind(app->timerindex, tgt, sel)) != NULL) {
+		t->data = ptr;
+		t->due = dkThreadSteadyTime() + nsec;
+		t->seq = ++app->timerseq;
+		fxAppTimerMoved(app, t->index);
+		return;
+	}
 
-	for (tt = &app->timers; (t = *tt) != NULL; tt = &t->next) {
-    /* If we already have this timeout message, update it */
-		if (t->target == tgt && t->message == sel){ *tt = t->next; goto a; }
+	/* Make room in the heap */
+	if (app->ntimers >= app->maxtimers) {
+		int n = app->maxtimers ? app->maxtimers * 2 : 16;
+		if (!fx_resize((void**)&app->timers, sizeof(struct fxTimer *) * n)) return;
+		app->maxtimers = n;
 	}
 
 	if (app->timerrecs) {
@@ -637,30 +1305,30 @@ fxAppAddTimeout(struct dkApp *app, struct dkObject *tgt, FXSelector sel, DKuint
 		t = malloc(sizeof(struct fxTimer));
 	}
 
-a:
-  t->data = ptr;
+	t->next = NULL;
+	t->data = ptr;
 	t->target = tgt;
-	t->due = dkThreadTime() + nsec;
+	t->due = dkThreadSteadyTime() + nsec;
 	t->message = sel;
+	t->seq = ++app->timerseq;
 
-  /* Place the timer into the list after any items that are due before it */
-  for (tt = &app->timers; *tt && ((*tt)->due < t->due); tt = &(*tt)->next);
-
-	t->next = *tt;
-	*tt = t;
+	/* Place the timer into the heap */
+	app->timers[app->ntimers] = t;
+	t->index = app->ntimers++;
+	fxAppTimerUp(app, t->index);
+	DtkSelHashReplace(app->timerindex, tgt, sel, t);
 }
 
-/* Remove timeout identified by tgt and sel from the list */
+/* Remove timeout identified by tgt and sel */
 void
 fxAppRemoveTimeout(struct dkApp *app, struct dkObject *tgt, DKSelector sel)
 {
-	struct fxTimer *t, **tt;
+	struct fxTimer *t;
 
-	for (tt = &app->timers; (t = *tt) != NULL; tt = &t->next) {
-		if (t->target == tgt && t->message == sel) {
-			*tt = t->next; t->next = app->timerrecs; app->timerrecs = t;
-			break;
-		}
+	if ((t = DtkSelHashFind(app->timerindex, tgt, sel)) != NULL) {
+		fxAppTimerUnlink(app, t);
+		t->next = app->timerrecs;
+		app->timerrecs = t;
 	}
 }
 
@@ -668,90 +1336,752 @@ fxAppRemoveTimeout(struct dkApp *app, struct dkObject *tgt, DKSelector sel)
 void
 fxAppHandleTimeouts(struct dkApp *app)
 {
-  DKlong now;
+  DKlong now, start;
   struct fxTimer *t;
 
-  now = dkThreadTime();
-  while (app->timers) {
-    if (now < app->timers->due) break;
-    t = app->timers;
-    app->timers = t->next;
+  now = dkThreadSteadyTime();
+  while (app->ntimers) {
+    if (now < app->timers[0]->due) break;
+    t = app->timers[0];
+    fxAppTimerUnlink(app, t);
+    start = app->stats ? dkThreadSteadyTime() : 0;
     if (t->target && t->target->handle(t->target, (struct dkObject *)app, SEL_TIMEOUT, t->message, t->data))
       fxAppRefresh(app);
+    if (app->stats) dkStatsAdd(app->stats, STAT_TIMER, -1, t->target, dkThreadSteadyTime() - start);
+    if (app->recorder) dkRecorderTimer(app->recorder, t->message);
+    if (app->replayer) app->replayer->fired++;
     t->next = app->timerrecs;
     app->timerrecs = t;
   }
 }
 
-/* Add chore to the END of the list */
-void dkAppAddChore(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr)
+/*
+  Notes:
+  - Chores are kept in one list per priority class.  Idle processing runs
+    input-critical chores first, then paint chores, then background
+    chores, so background work never holds up what the user sees.
+  - Chores run in batches until chorebudget is used up or the display
+    has input for us.  A batch only runs chores that were there when it
+    started, so a chore that adds itself again waits for the next
+    iteration, and events get a turn in between.
+  - A long chore yields by doing its work in pieces; it checks
+    dkAppChoreTimeLeft, and adds itself again when that runs out.
+*/
+
+/* Take chore out of its list and the index */
+static void dkAppChoreUnlink(struct dkApp *app, struct dkChore *c)
 {
-	struct dkChore *c, **cc;
-	for (cc = &app->chores; (c = *cc) != NULL; cc = &c->next) {
-		if (c->target == tgt && c->message == sel) {
-			*cc = c->next; goto a;
-		}
-	}
+	DtkSelHashRemove(app->choreindex, c->target, c->message);
+	if (c->prev) c->prev->next = c->next; else app->chores[c->priority] = c->next;
+	if (c->next) c->next->prev = c->prev; else app->choretail[c->priority] = c->prev;
+	c->next = c->prev = NULL;
+}
 
-	if (app->chorerecs) {
+/* Add chore to the END of the list of its priority class */
+void dkAppAddChorePriority(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr, int priority)
+{
+	struct dkChore *c;
+
+	if (priority < 0 || priority >= CHORE_LAST) priority = CHORE_BACKGROUND;
+
+	/* If we already have this chore, move it to the end */
+	if ((c = DtkSelHashFind(app->choreindex, tgt, sel)) != NULL) {
+		dkAppChoreUnlink(app, c);
+	} else if (app->chorerecs) {
 		c = app->chorerecs;
 		app->chorerecs = c->next;
 	} else {
 		c = malloc(sizeof(struct dkChore));
 	}
-a:	c->data = ptr;
+	c->data = ptr;
 	c->target = tgt;
 	c->message = sel;
-	for (cc = &app->chores; *cc; cc = &(*cc)->next);
+	c->seq = ++app->choreseq;
+	c->priority = priority;
 	c->next = NULL;
-	*cc = c;
+	c->prev = app->choretail[priority];
+	if (app->choretail[priority]) app->choretail[priority]->next = c; else app->chores[priority] = c;
+	app->choretail[priority] = c;
+	DtkSelHashReplace(app->choreindex, tgt, sel, c);
+}
+
+/* Add background chore to the END of the list */
+void dkAppAddChore(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr)
+{
+	dkAppAddChorePriority(app, tgt, sel, ptr, CHORE_BACKGROUND);
 }
 
 /* Remove chore identified by tgt and sel from the list */
 void dkAppRemoveChore(struct dkApp *app, struct dkObject* tgt, DKSelector sel)
 {
-	struct dkChore *c, **cc;
+	struct dkChore *c;
 
-	for (cc = &app->chores; (c = *cc) != NULL; cc = &c->next) {
-		if (c->target == tgt && c->message == sel) {
-			*cc = c->next; c->next = app->chorerecs; app->chorerecs = c;
-			break;
-		}
+	if ((c = DtkSelHashFind(app->choreindex, tgt, sel)) != NULL) {
+		dkAppChoreUnlink(app, c);
+		c->next = app->chorerecs;
+		app->chorerecs = c;
 	}
 }
 
-/* Find window from root x, y, starting from given window */
-struct dkWindow *dkAppFindWindowAt(struct dkApp *app, int rx, int ry, DKID window)
+/* Set the time in microseconds spent on chores per idle iteration; with
+ * 0, one chore is run per iteration */
+void dkAppSetChoreBudget(struct dkApp *app, DKuint budget)
 {
-  if (app->display_opened) {
-#ifndef WIN32
-    Window rootwin, child;
-    int wx, wy;
-
-    rootwin = XDefaultRootWindow((Display *)app->display);
-    if (!window) window = rootwin;
-    while (1) {
-      if (!XTranslateCoordinates((Display*)app->display, rootwin, window, rx, ry, &wx, &wy, &child)) return NULL;
-      if (child == None) break;
-      window = child;
-    }
-#else
-    POINT point;
-    point.x = rx;
-    point.y = ry;
-    window = WindowFromPoint(point);  /* FIXME this finds only enabled/visible windows */
-#endif
-    return DtkFindWindowWithId(window);
-  }
-  return NULL;
+	app->chorebudget = (DKlong)budget * 1000;
 }
 
-/*******************************************************************************/
-
-/* Generate SEL_LEAVE */
-void dkAppLeaveWindow(struct dkApp *app, struct dkWindow *window, struct dkWindow *ancestor)
+/* Time left (ns) before the chore being run should yield; 0 when the
+ * budget is used up, or outside of chores */
+DKlong dkAppChoreTimeLeft(struct dkApp *app)
 {
-  if (window && window->parent && window != ancestor) {
+	DKlong left;
+
+	if (!app->choredeadline) return 0;
+	left = app->choredeadline - dkThreadSteadyTime();
+	return left > 0 ? left : 0;
+}
+
+/* Run chores of priority up to last, most urgent first, until the batch
+ * is done, the budget is used up or input is pending; returns TRUE if
+ * chores are left */
+static DKbool dkAppRunChores(struct dkApp *app, int last)
+{
+	struct dkChore *c;
+	DKuint seq = app->choreseq;
+	DKlong start, now;
+	int p;
+
+	now = dkThreadSteadyTime();
+	app->choredeadline = now + app->chorebudget;
+	for (p = 0; p <= last; p++) {
+		while ((c = app->chores[p]) != NULL && (int)(c->seq - seq) <= 0) {
+			dkAppChoreUnlink(app, c);
+			start = now;
+			if (c->target && c->target->handle(c->target, (struct dkObject *)app, SEL_CHORE, c->message, c->data))
+				fxAppRefresh(app);
+			now = dkThreadSteadyTime();
+			if (app->stats) dkStatsAdd(app->stats, STAT_CHORE, -1, c->target, now - start);
+			c->next = app->chorerecs;
+			app->chorerecs = c;
+			if (app->choredeadline <= now || dtkDrvInputPending(app)) goto done;
+		}
+	}
+done:
+	app->choredeadline = 0;
+	return app->choreindex->used != 0;
+}
+
+#ifndef WIN32
+
+/* Return the modes for which handlers are installed on an input */
+static DKuint dkInputMode(struct dkInput *in)
+{
+  DKuint mode = INPUT_NONE;
+  if (in->read.target) mode |= INPUT_READ;
+  if (in->write.target) mode |= INPUT_WRITE;
+  if (in->excpt.target) mode |= INPUT_EXCEPT;
+  return mode;
+}
+
+/* Tell the reactor the set of modes watched on fd changed */
+static DKbool dkAppWatchInput(struct dkApp *app, int fd, DKuint oldmode, DKuint newmode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+  int op;
+
+  if (app->reactor >= 0) {
+    if (oldmode == newmode) return TRUE;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (newmode & INPUT_READ) ev.events |= EPOLLIN;
+    if (newmode & INPUT_WRITE) ev.events |= EPOLLOUT;
+    if (newmode & INPUT_EXCEPT) ev.events |= EPOLLPRI;
+    op = (oldmode == INPUT_NONE) ? EPOLL_CTL_ADD : (newmode == INPUT_NONE) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if (epoll_ctl(app->reactor, op, fd, &ev) < 0 && newmode != INPUT_NONE) {
+      DKTRACE((100, "dkApp: unable to watch fd=%d errno=%d\n", fd, errno));
+      return FALSE;
+    }
+    return TRUE;
+  }
+#endif
+  if (FD_SETSIZE <= fd) return FALSE;
+  if (newmode & INPUT_READ) FD_SET(fd, (fd_set*)app->r_fds); else FD_CLR(fd, (fd_set*)app->r_fds);
+  if (newmode & INPUT_WRITE) FD_SET(fd, (fd_set*)app->w_fds); else FD_CLR(fd, (fd_set*)app->w_fds);
+  if (newmode & INPUT_EXCEPT) FD_SET(fd, (fd_set*)app->e_fds); else FD_CLR(fd, (fd_set*)app->e_fds);
+  return TRUE;
+}
+
+/* Add input; the target is sent SEL_IO_READ, SEL_IO_WRITE or SEL_IO_EXCEPT
+ * with message sel and data ptr when fd becomes ready for the given mode */
+DKbool dkAppAddInput(struct dkApp *app, DKInputHandle fd, DKuint mode, struct dkObject *tgt, DKSelector sel, void *ptr)
+{
+  struct dkInput *in;
+  DKuint oldmode;
+  int n;
+
+  if (mode == INPUT_NONE || fd < 0) return FALSE;
+
+  /* Grow the input table so fd can index it directly */
+  if (fd >= app->ninputs) {
+    n = FXMAX(fd + 1, app->ninputs * 2);
+    if (!fx_resize((void**)&app->inputs, sizeof(struct dkInput) * n)) return FALSE;
+    memset(app->inputs + app->ninputs, 0, sizeof(struct dkInput) * (n - app->ninputs));
+    app->ninputs = n;
+  }
+  in = &app->inputs[fd];
+  oldmode = dkInputMode(in);
+  if (!dkAppWatchInput(app, fd, oldmode, oldmode | mode)) return FALSE;
+  if (mode & INPUT_READ) {
+    in->read.target = tgt;
+    in->read.message = sel;
+    in->read.data = ptr;
+  }
+  if (mode & INPUT_WRITE) {
+    in->write.target = tgt;
+    in->write.message = sel;
+    in->write.data = ptr;
+  }
+  if (mode & INPUT_EXCEPT) {
+    in->excpt.target = tgt;
+    in->excpt.message = sel;
+    in->excpt.data = ptr;
+  }
+  if (fd > app->maxinput) app->maxinput = fd;
+  return TRUE;
+}
+
+/* Remove input for the given modes */
+DKbool dkAppRemoveInput(struct dkApp *app, DKInputHandle fd, DKuint mode)
+{
+  struct dkInput *in;
+  DKuint oldmode;
+
+  if (mode == INPUT_NONE || fd < 0 || fd > app->maxinput) return FALSE;
+  in = &app->inputs[fd];
+  oldmode = dkInputMode(in);
+  dkAppWatchInput(app, fd, oldmode, oldmode & ~mode);
+  if (mode & INPUT_READ) memset(&in->read, 0, sizeof(struct dkHandler));
+  if (mode & INPUT_WRITE) memset(&in->write, 0, sizeof(struct dkHandler));
+  if (mode & INPUT_EXCEPT) memset(&in->excpt, 0, sizeof(struct dkHandler));
+  while (app->maxinput >= 0 && dkInputMode(&app->inputs[app->maxinput]) == INPUT_NONE)
+    app->maxinput--;
+  return TRUE;
+}
+
+#else
+
+/* Add input; fd is a waitable object handle, mode is ignored */
+DKbool dkAppAddInput(struct dkApp *app, DKInputHandle fd, DKuint mode, struct dkObject *tgt, DKSelector sel, void *ptr)
+{
+  int in;
+
+  if (mode == INPUT_NONE || fd == INVALID_HANDLE_VALUE || fd == NULL) return FALSE;
+  for (in = 0; in <= app->maxinput; in++) {
+    if (app->handles[in] == fd) break;
+  }
+  if (in > app->maxinput) {
+    if (in >= MAXIMUM_WAIT_OBJECTS - 1) return FALSE;
+    if (in >= app->ninputs) {
+      if (!fx_resize((void**)&app->inputs, sizeof(struct dkInput) * app->ninputs * 2)) return FALSE;
+      if (!fx_resize((void**)&app->handles, sizeof(void*) * app->ninputs * 2)) return FALSE;
+      memset(app->inputs + app->ninputs, 0, sizeof(struct dkInput) * app->ninputs);
+      app->ninputs *= 2;
+    }
+    memset(&app->inputs[in], 0, sizeof(struct dkInput));
+    app->handles[in] = fd;
+    app->maxinput = in;
+  }
+  app->inputs[in].read.target = tgt;
+  app->inputs[in].read.message = sel;
+  app->inputs[in].read.data = ptr;
+  return TRUE;
+}
+
+/* Remove input */
+DKbool dkAppRemoveInput(struct dkApp *app, DKInputHandle fd, DKuint mode)
+{
+  int in;
+
+  for (in = 0; in <= app->maxinput; in++) {
+    if (app->handles[in] == fd) {
+      app->handles[in] = app->handles[app->maxinput];
+      app->inputs[in] = app->inputs[app->maxinput];
+      app->maxinput--;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+#endif
+
+/* Send an I/O message to an input handler */
+static void dkAppDispatchInput(struct dkApp *app, struct dkHandler *h, DKuint type)
+{
+  DKlong start = app->stats ? dkThreadSteadyTime() : 0;
+  if (h->target && h->target->handle(h->target, (struct dkObject *)app, type, h->message, h->data))
+    fxAppRefresh(app);
+  if (app->stats) dkStatsAdd(app->stats, STAT_INPUT, -1, h->target, dkThreadSteadyTime() - start);
+}
+
+/*
+  Notes:
+  - Messages posted by other threads go on an intrusive multi-producer,
+    single-consumer queue; producers only swap the head pointer, so they
+    never contend on the application mutex or block each other.
+  - The queue always holds at least one record, the stub; the event loop
+    is the only consumer and the only one to touch posttail.
+  - A producer signals the wakeup descriptor only when no wakeup is
+    pending yet, so a burst of posts costs one write and one read.
+  - The wakeup descriptor is an ordinary input of the application, so
+    the reactor wakes up for posted messages just like for any fd.
+*/
+
+#ifndef WIN32
+
+/* Create wakeup descriptor and watch it for posted messages */
+static void dkAppOpenWakeup(struct dkApp *app)
+{
+  int fds[2] = { -1, -1 };
+  int i;
+
+  app->wakefd[0] = app->wakefd[1] = -1;
+#ifdef HAVE_SYS_EVENTFD_H
+  fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+  if (fds[0] < 0) {
+    if (pipe(fds) < 0) {
+      DKTRACE((100, "dkApp: unable to create wakeup descriptor errno=%d\n", errno));
+      return;
+    }
+    for (i = 0; i < 2; i++) {
+      fcntl(fds[i], F_SETFL, O_NONBLOCK);
+      fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+  }
+  app->wakefd[0] = fds[0];
+  app->wakefd[1] = fds[1];
+  dkAppAddInput(app, app->wakefd[0], INPUT_READ, (struct dkObject *)app, ID_POSTED, NULL);
+}
+
+/* Close wakeup descriptor */
+static void dkAppCloseWakeup(struct dkApp *app)
+{
+  if (app->wakefd[0] < 0) return;
+  dkAppRemoveInput(app, app->wakefd[0], INPUT_READ);
+  if (app->wakefd[1] != app->wakefd[0]) close(app->wakefd[1]);
+  close(app->wakefd[0]);
+  app->wakefd[0] = app->wakefd[1] = -1;
+}
+
+/* Wake up the event loop; may be called from any thread */
+static void dkAppSignalWakeup(struct dkApp *app)
+{
+  DKulong one = 1;
+
+  /* A full pipe means a wakeup is pending anyway */
+  if (app->wakefd[1] >= 0 && write(app->wakefd[1], &one, (app->wakefd[1] == app->wakefd[0]) ? sizeof(one) : 1) < 0) {
+    /* Nothing to do */
+  }
+}
+
+/* Consume pending wakeups */
+static void dkAppClearWakeup(struct dkApp *app)
+{
+  char buf[64];
+
+  if (app->wakefd[0] < 0) return;
+  while (read(app->wakefd[0], buf, sizeof(buf)) > 0) {
+    if (app->wakefd[1] == app->wakefd[0]) break;
+  }
+}
+
+#else
+
+/* Create wakeup event and watch it for posted messages */
+static void dkAppOpenWakeup(struct dkApp *app)
+{
+  app->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);   /* Auto-reset */
+  if (app->wakeup)
+    dkAppAddInput(app, app->wakeup, INPUT_READ, (struct dkObject *)app, ID_POSTED, NULL);
+}
+
+/* Close wakeup event */
+static void dkAppCloseWakeup(struct dkApp *app)
+{
+  if (!app->wakeup) return;
+  dkAppRemoveInput(app, app->wakeup, INPUT_READ);
+  CloseHandle(app->wakeup);
+  app->wakeup = NULL;
+}
+
+/* Wake up the event loop; may be called from any thread */
+static void dkAppSignalWakeup(struct dkApp *app)
+{
+  if (app->wakeup) SetEvent(app->wakeup);
+}
+
+/* Consume pending wakeups; the event resets itself */
+static void dkAppClearWakeup(struct dkApp *app)
+{
+}
+
+#endif
+
+/* Append a record to the posted messages queue */
+static void dkAppPostPush(struct dkApp *app, struct dkPosted *p)
+{
+  struct dkPosted *prev;
+
+  p->next = NULL;
+  prev = dkAtomicSwapPtr((void *volatile *)&app->posthead, p);
+  dkAtomicPutPtr((void *volatile *)&prev->next, p);
+}
+
+/* Take the oldest record off the posted messages queue; returns NULL if
+ * the queue is empty, or if a producer has not finished linking its
+ * record yet, in which case its wakeup will bring us back. */
+static struct dkPosted *dkAppPostPop(struct dkApp *app)
+{
+  struct dkPosted *tail = app->posttail;
+  struct dkPosted *next = dkAtomicGetPtr((void *volatile *)&tail->next);
+
+  if (tail == app->poststub) {
+    if (next == NULL) return NULL;
+    app->posttail = tail = next;
+    next = dkAtomicGetPtr((void *volatile *)&tail->next);
+  }
+  if (next) {
+    app->posttail = next;
+    return tail;
+  }
+  if (tail != dkAtomicGetPtr((void *volatile *)&app->posthead)) return NULL;
+
+  /* Last record; put the stub behind it so it can be taken off */
+  dkAppPostPush(app, app->poststub);
+  next = dkAtomicGetPtr((void *volatile *)&tail->next);
+  if (next) {
+    app->posttail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+/* Post message to target from any thread; the message is delivered
+ * from the event loop as if sent by the application.  The target must
+ * stay alive, and data valid, until the message is delivered. */
+DKbool dkAppPostMessage(struct dkApp *app, struct dkObject *tgt, DKSelector sel, void *ptr)
+{
+  struct dkPosted *p;
+
+  if (!tgt) return FALSE;
+  if ((p = malloc(sizeof(struct dkPosted))) == NULL) return FALSE;
+  p->target = tgt;
+  p->message = sel;
+  p->data = ptr;
+  dkAppPostPush(app, p);
+  if (dkAtomicSwapInt(&app->postwake, 1) == 0)
+    dkAppSignalWakeup(app);
+  return TRUE;
+}
+
+/* Deliver messages posted from other threads */
+long dkApp_onPosted(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data)
+{
+  struct dkApp *app = (struct dkApp *)pthis;
+  struct dkPosted *p;
+  long refresh = 0;
+  int n;
+
+  dkAppClearWakeup(app);
+  dkAtomicSwapInt(&app->postwake, 0);
+  for (n = 0; n < DK_MAXPOSTED; n++) {
+    if ((p = dkAppPostPop(app)) == NULL) return refresh;
+    if (p->target->handle(p->target, (struct dkObject *)app, DKSELTYPE(p->message), DKSELID(p->message), p->data))
+      refresh = 1;
+    free(p);
+  }
+
+  /* More left; let other events have a turn first */
+  if (dkAtomicSwapInt(&app->postwake, 1) == 0)
+    dkAppSignalWakeup(app);
+  return refresh;
+}
+
+/*
+  Notes:
+  - Signals are taken in the event loop, not in signal context: a signal
+    being handled is blocked and read from a signalfd, which is an
+    ordinary input of the application, so the receiver may do anything a
+    message handler may do.
+  - Blocking only covers the calling thread and the threads it starts
+    afterwards, so signals should be added before starting other threads.
+  - Without signalfd, an asynchronous handler writes the signal number
+    down a pipe instead; that write is all it does in signal context.
+  - The receiver gets SEL_SIGNAL with its message and the signal number
+    as data.  As with any signal, several firings before the loop gets
+    to them may be delivered once.
+*/
+
+#ifndef WIN32
+
+/* Write end of signal pipe, for the asynchronous handler */
+static int dkSignalPipe = -1;
+
+/* Pass signal number on to the event loop */
+static void dkAppSignalHandler(int sig)
+{
+  int saved = errno;
+  unsigned char c = (unsigned char)sig;
+
+  /* A full pipe means the loop has plenty to read already */
+  if (write(dkSignalPipe, &c, 1) < 0) {
+    /* Nothing to do */
+  }
+  errno = saved;
+}
+
+/* Create signal descriptor and watch it for signals */
+static DKbool dkAppOpenSignals(struct dkApp *app)
+{
+  int fds[2] = { -1, -1 };
+  int i;
+
+  if (app->sigfd[0] >= 0) return TRUE;
+  if (!app->signals) {
+    app->signals = calloc(sizeof(struct dkHandler), NSIG);
+    app->sigmask = calloc(sizeof(sigset_t), 1);
+    if (!app->signals || !app->sigmask) return FALSE;
+    sigemptyset((sigset_t *)app->sigmask);
+  }
+#ifdef HAVE_SYS_SIGNALFD_H
+  fds[0] = fds[1] = signalfd(-1, (sigset_t *)app->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
+  if (fds[0] < 0) {
+    if (pipe(fds) < 0) {
+      DKTRACE((100, "dkApp: unable to create signal descriptor errno=%d\n", errno));
+      return FALSE;
+    }
+    for (i = 0; i < 2; i++) {
+      fcntl(fds[i], F_SETFL, O_NONBLOCK);
+      fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    dkSignalPipe = fds[1];
+  }
+  app->sigfd[0] = fds[0];
+  app->sigfd[1] = fds[1];
+  dkAppAddInput(app, app->sigfd[0], INPUT_READ, (struct dkObject *)app, ID_SIGNAL, NULL);
+  return TRUE;
+}
+
+/* Start or stop taking signal in the event loop */
+static DKbool dkAppWatchSignal(struct dkApp *app, int sig, DKbool on)
+{
+  sigset_t *mask = (sigset_t *)app->sigmask;
+  struct sigaction sa;
+
+  if (on) sigaddset(mask, sig); else sigdelset(mask, sig);
+#ifdef HAVE_SYS_SIGNALFD_H
+  if (app->sigfd[1] == app->sigfd[0]) {
+    sigset_t one;
+
+    sigemptyset(&one);
+    sigaddset(&one, sig);
+    if (on) pthread_sigmask(SIG_BLOCK, &one, NULL);
+    if (signalfd(app->sigfd[0], mask, 0) < 0 && on) {
+      sigdelset(mask, sig);
+      pthread_sigmask(SIG_UNBLOCK, &one, NULL);
+      return FALSE;
+    }
+    if (!on) pthread_sigmask(SIG_UNBLOCK, &one, NULL);
+    return TRUE;
+  }
+#endif
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on ? dkAppSignalHandler : SIG_DFL;
+  sa.sa_flags = on ? SA_RESTART : 0;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(sig, &sa, NULL) < 0) {
+    if (on) sigdelset(mask, sig);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Stop taking signals and close signal descriptor */
+static void dkAppCloseSignals(struct dkApp *app)
+{
+  struct dkHandler *handlers = (struct dkHandler *)app->signals;
+  int sig;
+
+  if (app->sigfd[0] >= 0) {
+    for (sig = 1; sig < NSIG; sig++) {
+      if (handlers[sig].target) dkAppWatchSignal(app, sig, FALSE);
+    }
+    dkAppRemoveInput(app, app->sigfd[0], INPUT_READ);
+    if (app->sigfd[1] != app->sigfd[0]) {
+      dkSignalPipe = -1;
+      close(app->sigfd[1]);
+    }
+    close(app->sigfd[0]);
+    app->sigfd[0] = app->sigfd[1] = -1;
+  }
+  free(app->signals);
+  free(app->sigmask);
+  app->signals = NULL;
+  app->sigmask = NULL;
+}
+
+/* Send message sel to target tgt from the event loop when signal sig
+ * fires; replaces the receiver if the signal was already being taken */
+DKbool dkAppAddSignal(struct dkApp *app, int sig, struct dkObject *tgt, DKSelector sel)
+{
+  struct dkHandler *h;
+
+  if (sig <= 0 || sig >= NSIG || !tgt) return FALSE;
+  if (!dkAppOpenSignals(app)) return FALSE;
+  h = &((struct dkHandler *)app->signals)[sig];
+  if (!h->target && !dkAppWatchSignal(app, sig, TRUE)) return FALSE;
+  h->target = tgt;
+  h->message = sel;
+  h->data = NULL;
+  return TRUE;
+}
+
+/* Stop taking signal sig; it gets its default action again */
+DKbool dkAppRemoveSignal(struct dkApp *app, int sig)
+{
+  struct dkHandler *h;
+
+  if (sig <= 0 || sig >= NSIG || !app->signals) return FALSE;
+  h = &((struct dkHandler *)app->signals)[sig];
+  if (!h->target) return FALSE;
+  memset(h, 0, sizeof(struct dkHandler));
+  return dkAppWatchSignal(app, sig, FALSE);
+}
+
+/* Deliver signals that fired */
+long dkApp_onSignal(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data)
+{
+  struct dkApp *app = (struct dkApp *)pthis;
+  struct dkHandler *h;
+  int sigs[DK_MAXSIGNALS];
+  long refresh = 0;
+  ssize_t got;
+  int n = 0, i;
+
+#ifdef HAVE_SYS_SIGNALFD_H
+  if (app->sigfd[1] == app->sigfd[0]) {
+    struct signalfd_siginfo info[DK_MAXSIGNALS];
+
+    if ((got = read(app->sigfd[0], info, sizeof(info))) > 0) {
+      for (n = 0; n < (int)(got / sizeof(info[0])); n++) sigs[n] = (int)info[n].ssi_signo;
+    }
+  } else
+#endif
+  {
+    unsigned char buf[DK_MAXSIGNALS];
+
+    if ((got = read(app->sigfd[0], buf, sizeof(buf))) > 0) {
+      for (n = 0; n < (int)got; n++) sigs[n] = buf[n];
+    }
+  }
+
+  /* Look each one up again, as receivers may remove signals */
+  for (i = 0; i < n; i++) {
+    if (!app->signals || sigs[i] <= 0 || sigs[i] >= NSIG) continue;
+    h = &((struct dkHandler *)app->signals)[sigs[i]];
+    if (h->target && h->target->handle(h->target, (struct dkObject *)app, SEL_SIGNAL, h->message, (void *)(long)sigs[i]))
+      refresh = 1;
+  }
+  return refresh;
+}
+
+#else
+
+/* Signals are not taken in the event loop on MS-Windows */
+static void dkAppCloseSignals(struct dkApp *app)
+{
+}
+
+DKbool dkAppAddSignal(struct dkApp *app, int sig, struct dkObject *tgt, DKSelector sel)
+{
+  return FALSE;
+}
+
+DKbool dkAppRemoveSignal(struct dkApp *app, int sig)
+{
+  return FALSE;
+}
+
+long dkApp_onSignal(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *data)
+{
+  return 0;
+}
+
+#endif
+
+/* Find window from root x, y, starting from given window */
+struct dkWindow *dkAppFindWindowAt(struct dkApp *app, int rx, int ry, DKID window)
+{
+  if (app->display_opened) {
+#ifndef WIN32
+    struct dkWindow *found, *c;
+    Window rootwin, child;
+    int wx, wy;
+
+    /* Ask the server only until we are inside one of our shells; from
+     * there on down the layout is ours, so we look it up ourselves */
+    rootwin = XDefaultRootWindow((Display *)app->display);
+    if (!window) window = rootwin;
+    while (1) {
+      if (!XTranslateCoordinates((Display*)app->display, rootwin, window, rx, ry, &wx, &wy, &child)) return NULL;
+      if ((found = DtkFindWindowWithId(window)) != NULL && found->parent) {
+        if (child == None) return found;
+        while ((c = dkWindowGetChildAt(found, wx, wy)) != NULL) {
+          wx -= c->xpos;
+          wy -= c->ypos;
+          found = c;
+        }
+        return found;
+      }
+      if (child == None) break;
+      window = child;
+    }
+#else
+    POINT point;
+    point.x = rx;
+    point.y = ry;
+    window = WindowFromPoint(point);  /* FIXME this finds only enabled/visible windows */
+#endif
+    return DtkFindWindowWithId(window);
+  }
+  if (app->headless) {
+    struct dkWindow *root = (struct dkWindow *)app->root;
+    struct dkWindow *found, *c;
+    int wx, wy;
+
+    /* All the layout is ours, so look it up from the root down */
+    found = window ? DtkFindWindowWithId(window) : root;
+    if (!found) return NULL;
+    dkWindowTranslateCoordinatesFrom(found, &wx, &wy, root, rx, ry);
+    while ((c = dkWindowGetChildAt(found, wx, wy)) != NULL) {
+      wx -= c->xpos;
+      wy -= c->ypos;
+      found = c;
+    }
+    return found != root ? found : NULL;
+  }
+  return NULL;
+}
+
+/*******************************************************************************/
+
+/* Generate SEL_LEAVE */
+void dkAppLeaveWindow(struct dkApp *app, struct dkWindow *window, struct dkWindow *ancestor)
+{
+  if (window && window->parent && window != ancestor) {
     app->event.type = SEL_LEAVE;
     dkWindowTranslateCoordinatesFrom(window, &app->event.win_x, &app->event.win_y, (struct dkWindow *)app->root, app->event.root_x, app->event.root_y);
     if (((struct dkObject *)window)->handle(window, (struct dkObject *)app, SEL_LEAVE, 0, &app->event))
@@ -1338,18 +2668,30 @@ dtkDrvDispatchEvent(MSG *msg)
 	return 1;
 }
 
+/* Check if the user pressed or released a key or button, without
+ * removing anything from the queue */
+static DKbool dtkDrvInputPending(App *app)
+{
+  return HIWORD(GetQueueStatus(QS_KEY | QS_MOUSEBUTTON)) != 0;
+}
+
 int
 dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
 {
   int allinputs;
   DWORD signalled;
+  DKlong start;
 
   /* Set to no-op just in case */
   msg->message = 0;
 
+  /* Sample queue depths */
+  if (app->stats)
+    dkAppStatsQueues(app);
+
   /* Handle all past due timers */
-  if (app->timers)
-    dkAppHandleTimeouts(app);
+  if (app->ntimers)
+    fxAppHandleTimeouts(app);
 
   /* Check non-immediate signals that may have fired */
   /* TODO: Handle this */
@@ -1369,35 +2711,20 @@ dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
 	if (signalled == WAIT_TIMEOUT) {
 
     /* Do our chores :-) */
-    if (app->chores) {
-      struct dkChore *c = app->chores;
-      app->chores = c->next;
-      if (c->target && c->target->handle(c->target, (struct dkObject *)app, SEL_CHORE, c->message, c->data))
-        fxAppRefresh(app);
-      c->next = app->chorerecs;
-      app->chorerecs = c;
-    }
+    dkAppRunChores(app, CHORE_BACKGROUND);
 
     /* GUI updating:- walk the whole widget tree. */
     if (app->refresher) {
-      ((struct dkObject *)app->refresher)->handle(app->refresher, (struct dkObject *)app, SEL_UPDATE, 0, NULL);
-      if (app->refresher->first) {
-        app->refresher = app->refresher->first;
-      } else {
-        while (app->refresher->parent) {
-          if (app->refresher->next) {
-            app->refresher = app->refresher->next;
-            break;
-          }
-          app->refresher = app->refresher->parent;
-        }
-      }
-      if (app->refresher != app->refresherstop) return 0;
-      app->refresher = app->refresherstop = NULL;
+      if (dkAppUpdateTree(app)) return 0;
+    }
+
+    /* GUI updating:- only the dirty windows. */
+    else if (app->ndirty) {
+      if (dkAppUpdateDirty(app)) return 0;
     }
 
     /* There are more chores to do */
-    if (app->chores) return 0;
+    if (app->choreindex->used) return 0;
 
     /* No updates or chores pending, so return at this point if
      * not blocking */
@@ -1414,12 +2741,12 @@ dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
 
     /* If there are timers, block only a little time */
     allinputs = app->maxinput + 1;
-    if (app->timers) {
+    if (app->ntimers) {
       DKlong interval;
       DWORD delta;
 
       /* All that testing above may have taken some time... */
-      interval = app->timers->due - dkThreadTime();
+      interval = app->timers[0]->due - dkThreadSteadyTime();
 
       /* Some timers are already due; do them right away! */
       if (interval <= 0) return 0;
@@ -1430,8 +2757,10 @@ dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
       dkMutexUnlock(&app->appMutex);
 
       /* Now we will block */
+      start = app->stats ? dkThreadSteadyTime() : 0;
       signalled = MsgWaitForMultipleObjects(allinputs,
           app->handles, FALSE, delta, QS_ALLINPUT);
+      if (app->stats) dkStatsAdd(app->stats, STAT_WAIT, -1, NULL, dkThreadSteadyTime() - start);
 
       /* Enter critical section */
       dkMutexLock(&app->appMutex);
@@ -1443,8 +2772,10 @@ dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
       /* Exit critical section */
       dkMutexUnlock(&app->appMutex);
 
+      start = app->stats ? dkThreadSteadyTime() : 0;
       signalled = MsgWaitForMultipleObjects(allinputs,
           app->handles, FALSE, INFINITE, QS_ALLINPUT);
+      if (app->stats) dkStatsAdd(app->stats, STAT_WAIT, -1, NULL, dkThreadSteadyTime() - start);
 
       /* Enter critical section */
       dkMutexLock(&app->appMutex);
@@ -1454,6 +2785,12 @@ dtkDrvGetNextEvent(App *app, MSG *msg, int blocking)
 	/* Timed out, so do timeouts */
 	if (signalled == WAIT_TIMEOUT) return 0;
 
+	/* One of the inputs was signalled */
+	if (WAIT_OBJECT_0 <= signalled && signalled < WAIT_OBJECT_0 + (DWORD)allinputs) {
+		dkAppDispatchInput(app, &app->inputs[signalled - WAIT_OBJECT_0].read, SEL_IO_READ);
+		return 0;
+	}
+
 	/* Got message from the GUI? */
 	if (signalled != WAIT_OBJECT_0+allinputs) return 0;
 
@@ -1470,9 +2807,17 @@ int
 dtkDrvRunOneEvent(App *app, int blocking)
 {
 	MSG msg;
+	DKlong start;
 
 	if (dtkDrvGetNextEvent(app, &msg, blocking)) {
+		start = app->stats ? dkThreadSteadyTime() : 0;
+		if (app->stats && ((WM_KEYFIRST <= msg.message && msg.message <= WM_KEYLAST) ||
+		    (WM_LBUTTONDOWN <= msg.message && msg.message <= WM_MBUTTONDBLCLK)))
+			dkStatsInputDelay(app->stats, (DKuint)msg.time, start);
 		dtkDrvDispatchEvent(&msg);
+		if (app->stats) {
+			dkStatsAdd(app->stats, STAT_EVENT, -1, (struct dkObject *)DtkFindWindowWithId((DKID)msg.hwnd), dkThreadSteadyTime() - start);
+		}
 		return 1;
 	}
 	return 0;
@@ -1484,130 +2829,712 @@ dtkDrvRunOneEvent(App *app, int blocking)
 void translateKeyEvent(struct dstr *str, XEvent *event)
 {
   char buffer[40]; KeySym sym; DKwchar w;
-  XLookupString(&event->xkey, buffer, sizeof(buffer), &sym, NULL);
+  if (event->xkey.display)
+    XLookupString(&event->xkey, buffer, sizeof(buffer), &sym, NULL);
+  else
+    sym = dtkNullKeysym(event->xkey.keycode, event->xkey.state);
   w = dkkeysym2ucs(sym);
   dstr_initw2(str, &w, 1);
 }
 
 static int dtkDrvDispatchEvent(App *app, XEvent *ev);
 
-/* Smart rectangle compositing algorithm */
-void dkAppAddRepaint(struct dkApp *app, DKID win, int x, int y, int w, int h, DKbool synth)
+/* Name of X event type, for statistics */
+static const char *dtkDrvEventName(int type)
 {
-  int px, py, pw, ph, hint, area;
-  struct dkRepaint *r, **pr;
-
-  hint = w * h;
-  w += x;
-  h += y;
-  do {
-
-    /* Find overlap with outstanding rectangles */
-    for (r = app->repaints, pr = &app->repaints; r; pr = &r->next, r = r->next) {
-      if (r->window == win) {
-        /* Tentatively conglomerate rectangles */
-        px = FXMIN(x, r->rect.x);
-        py = FXMIN(y, r->rect.y);
-        pw = FXMAX(w, r->rect.w);
-        ph = FXMAX(h, r->rect.h);
-        area = (pw - px) * (ph - py);
-
-        /* New area MUCH bigger than sum; forget about it */
-        if (area > (hint + r->hint) * 2) continue;
-
-        /* Take old paintrect out of the list */
-        *pr = r->next;
-        r->next = app->repaintrecs;
-        app->repaintrecs = r;
-
-        /* New rectangle */
-        synth |= r->synth;        /* Synthethic is preserved! */
-        hint = area;
-        x = px;
-        y = py;
-        w = pw;
-        h = ph;
-        break;
-      }
-    }
-  } while (r);
-
-  /* Get rectangle, recycled if possible */
-  if (app->repaintrecs) {
-    r = app->repaintrecs;
-    app->repaintrecs = r->next;
-  } else {
-    r = malloc(sizeof(struct dkRepaint));
-  }
+  static const char *const names[] = {
+    NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+    "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+    "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose", "VisibilityNotify",
+    "CreateNotify", "DestroyNotify", "UnmapNotify", "MapNotify", "MapRequest",
+    "ReparentNotify", "ConfigureNotify", "ConfigureRequest", "GravityNotify",
+    "ResizeRequest", "CirculateNotify", "CirculateRequest", "PropertyNotify",
+    "SelectionClear", "SelectionRequest", "SelectionNotify", "ColormapNotify",
+    "ClientMessage", "MappingNotify", "GenericEvent"
+  };
+  if (0 <= type && type < (int)ARRAYNUMBER(names)) return names[type];
+  return NULL;
+}
 
-  /* Fill it */
+/* Record event for one of our windows */
+static void dtkDrvRecordEvent(App *app, XEvent *ev)
+{
+  struct dkWindow *window;
+  struct dkRecEvent rec;
+  int n;
+
+  if ((window = DtkFindWindowWithId(ev->xany.window)) == NULL) return;
+  memset(&rec, 0, sizeof(rec));
+  if ((rec.depth = dkRecordWindowPath(window, rec.path)) < 0) return;
+  rec.type = ev->xany.type;
+  rec.synthetic = ev->xany.send_event;
+  switch (ev->xany.type) {
+  case KeyPress:
+  case KeyRelease:
+    rec.x = ev->xkey.x;
+    rec.y = ev->xkey.y;
+    rec.x_root = ev->xkey.x_root;
+    rec.y_root = ev->xkey.y_root;
+    rec.state = ev->xkey.state;
+    rec.detail = ev->xkey.display ? (DKuint)XLookupKeysym(&ev->xkey, 0) : ev->xkey.keycode;   /* Keycodes differ between servers */
+    rec.time = ev->xkey.time;
+
+    /* Repeats folded into a press are written one by one, so replay
+     * does not depend on how events were batched */
+    for (n = (ev->xany.type == KeyPress) ? (int)ev->xkey.subwindow : 1; n > 1; n--)
+      dkRecorderWrite(app->recorder, &rec);
+    break;
+  case ButtonPress:
+  case ButtonRelease:
+    rec.x = ev->xbutton.x;
+    rec.y = ev->xbutton.y;
+    rec.x_root = ev->xbutton.x_root;
+    rec.y_root = ev->xbutton.y_root;
+    rec.state = ev->xbutton.state;
+    rec.detail = ev->xbutton.button;
+    rec.time = ev->xbutton.time;
+
+    /* A wheel press is written once per notch it adds up to */
+    if (ev->xany.type == ButtonPress && (ev->xbutton.button == Button4 || ev->xbutton.button == Button5)) {
+      for (n = ((int)ev->xbutton.subwindow + DK_WHEELNOTCH / 2) / DK_WHEELNOTCH; n > 1; n--)
+        dkRecorderWrite(app->recorder, &rec);
+    }
+    break;
+  case MotionNotify:
+    rec.state = ev->xmotion.state;
+
+    /* Motion folded into it goes first, sample by sample */
+    for (n = 0; n < app->event.nsamples; n++) {
+      rec.x = app->event.samples[n].win_x;
+      rec.y = app->event.samples[n].win_y;
+      rec.x_root = app->event.samples[n].root_x;
+      rec.y_root = app->event.samples[n].root_y;
+      rec.time = app->event.samples[n].time;
+      dkRecorderWrite(app->recorder, &rec);
+    }
+    rec.x = ev->xmotion.x;
+    rec.y = ev->xmotion.y;
+    rec.x_root = ev->xmotion.x_root;
+    rec.y_root = ev->xmotion.y_root;
+    rec.time = ev->xmotion.time;
+    break;
+  case EnterNotify:
+  case LeaveNotify:
+    rec.x = ev->xcrossing.x;
+    rec.y = ev->xcrossing.y;
+    rec.x_root = ev->xcrossing.x_root;
+    rec.y_root = ev->xcrossing.y_root;
+    rec.state = ev->xcrossing.state;
+    rec.detail = ev->xcrossing.mode | (ev->xcrossing.detail << 8);
+    rec.time = ev->xcrossing.time;
+    break;
+  case FocusIn:
+  case FocusOut:
+    rec.detail = ev->xfocus.mode | (ev->xfocus.detail << 8);
+    break;
+  case Expose:
+  case GraphicsExpose:
+    rec.x = ev->xexpose.x;
+    rec.y = ev->xexpose.y;
+    rec.width = ev->xexpose.width;
+    rec.height = ev->xexpose.height;
+    break;
+  case ConfigureNotify:
+    rec.x = ev->xconfigure.x;
+    rec.y = ev->xconfigure.y;
+    rec.width = ev->xconfigure.width;
+    rec.height = ev->xconfigure.height;
+    break;
+  }
+  dkRecorderWrite(app->recorder, &rec);
+}
+
+/* Take the next recorded event if it is due; user input is rebuilt
+ * for the window with the same path, anything else is passed over */
+static int dtkDrvReplayEvent(App *app, XEvent *ev)
+{
+  struct dkReplayer *rp = app->replayer;
+  const struct dkRecEvent *rec;
+  struct dkWindow *window;
+  Window root;
+  DKlong due;
+
+  /* As fast as possible still waits for the previous event to settle */
+  if (rp->speed == 0.0 && rp->pending) return 0;
+
+  while ((rec = dkReplayerPeek(rp)) != NULL) {
+    due = dkReplayerDue(rp);
+    if (due && dkThreadSteadyTime() < due) return 0;
+    window = dkRecordFindWindow((struct dkWindow *)app->root, rec->path, rec->depth);
+    if (!window || !window->xid) {
+      dkReplayerNext(rp, FALSE);
+      continue;
+    }
+    root = app->display ? XDefaultRootWindow((Display*)app->display) : None;
+    memset(ev, 0, sizeof(XEvent));
+    ev->xany.type = rec->type;
+    ev->xany.send_event = rec->synthetic;
+    ev->xany.display = (Display*)app->display;
+    ev->xany.window = window->xid;
+    switch (rec->type) {
+    case KeyPress:
+    case KeyRelease:
+      ev->xkey.root = root;
+      ev->xkey.x = rec->x;
+      ev->xkey.y = rec->y;
+      ev->xkey.x_root = rec->x_root;
+      ev->xkey.y_root = rec->y_root;
+      ev->xkey.state = rec->state;
+      /* With no display the keysym goes in place of the keycode */
+      ev->xkey.keycode = app->display ? XKeysymToKeycode((Display*)app->display, (KeySym)rec->detail) : rec->detail;
+      ev->xkey.time = rec->time;
+      ev->xkey.same_screen = True;
+      break;
+    case ButtonPress:
+    case ButtonRelease:
+      ev->xbutton.root = root;
+      ev->xbutton.x = rec->x;
+      ev->xbutton.y = rec->y;
+      ev->xbutton.x_root = rec->x_root;
+      ev->xbutton.y_root = rec->y_root;
+      ev->xbutton.state = rec->state;
+      ev->xbutton.button = rec->detail;
+      ev->xbutton.time = rec->time;
+      ev->xbutton.same_screen = True;
+      break;
+    case MotionNotify:
+      ev->xmotion.root = root;
+      ev->xmotion.x = rec->x;
+      ev->xmotion.y = rec->y;
+      ev->xmotion.x_root = rec->x_root;
+      ev->xmotion.y_root = rec->y_root;
+      ev->xmotion.state = rec->state;
+      ev->xmotion.time = rec->time;
+      ev->xmotion.same_screen = True;
+      break;
+    case EnterNotify:
+    case LeaveNotify:
+      ev->xcrossing.root = root;
+      ev->xcrossing.x = rec->x;
+      ev->xcrossing.y = rec->y;
+      ev->xcrossing.x_root = rec->x_root;
+      ev->xcrossing.y_root = rec->y_root;
+      ev->xcrossing.state = rec->state;
+      ev->xcrossing.mode = rec->detail & 0xff;
+      ev->xcrossing.detail = rec->detail >> 8;
+      ev->xcrossing.time = rec->time;
+      ev->xcrossing.same_screen = True;
+      break;
+    case FocusIn:
+    case FocusOut:
+      ev->xfocus.mode = rec->detail & 0xff;
+      ev->xfocus.detail = rec->detail >> 8;
+      break;
+    default:
+      dkReplayerNext(rp, FALSE);
+      continue;
+    }
+    dkReplayerNext(rp, TRUE);
+    return 1;
+  }
+
+  /* End of recording */
+  dkReplayerSettle(rp, dkThreadSteadyTime(), TRUE);
+  dkReplayerReport(rp, stderr);
+  if (rp->quit) dkAppExit(app, 0);
+  dkReplayerDel(rp);
+  app->replayer = NULL;
+  return 0;
+}
+
+/*
+  Notes:
+  - Each damaged window has one repaint record holding its exact damage
+    region; records are found by window through a hash table, and kept
+    in the order the windows were first damaged.
+  - Adding, removing and scrolling damage are region operations which are
+    linear in the number of boxes of that window's damage only; there is
+    no scanning of other windows' damage, and no over-painting of areas
+    between damaged rectangles.
+*/
+
+/* Find repaint record of window, creating one if it has none */
+static struct dkRepaint *dkAppFindRepaint(struct dkApp *app, DKID win, DKbool create)
+{
+  struct dkRepaint *r;
+
+  r = (struct dkRepaint *)DtkHashFind(app->repaintindex, (void *)(DKuval)win);
+  if (r || !create) return r;
+
+  /* Get record, recycled if possible */
+  if (app->repaintrecs) {
+    r = app->repaintrecs;
+    app->repaintrecs = r->next;
+  } else {
+    if ((r = malloc(sizeof(struct dkRepaint))) == NULL) return NULL;
+    dkRegionInit(&r->region);
+  }
   r->window = win;
-  r->rect.x = x;
-  r->rect.y = y;
-  r->rect.w = w;
-  r->rect.h = h;
-  r->hint = hint;
-  r->synth = synth;
+  r->synth = FALSE;
+  r->input = 0;
   r->next = NULL;
-  *pr = r;
+  r->prev = app->repainttail;
+  if (app->repainttail) app->repainttail->next = r; else app->repaints = r;
+  app->repainttail = r;
+  DtkHashInsert(app->repaintindex, (void *)(DKuval)win, r);
+  return r;
+}
+
+/* Take repaint record off the list and recycle it */
+static void dkAppRepaintUnlink(struct dkApp *app, struct dkRepaint *r)
+{
+  DtkHashRemove(app->repaintindex, (void *)(DKuval)r->window);
+  if (r->prev) r->prev->next = r->next; else app->repaints = r->next;
+  if (r->next) r->next->prev = r->prev; else app->repainttail = r->prev;
+  dkRegionReset(&r->region);
+  r->next = app->repaintrecs;
+  app->repaintrecs = r;
+}
+
+/* Paint damage region of window in one go; the paint rectangle is the
+ * bounding box of the region, and the region itself is passed along so
+ * drawing can be clipped to it */
+static void dkAppPaintRegion(struct dkApp *app, DKID win, struct dkRegion *rgn, DKbool synth)
+{
+  struct dkWindow *window;
+  DKlong start = 0;
+
+  if (dkRegionEmpty(rgn) || (window = DtkFindWindowWithId(win)) == NULL) return;
+  if (app->stats) start = dkThreadSteadyTime();
+  app->event.type = SEL_PAINT;
+  app->event.rect.x = rgn->extents.x1;
+  app->event.rect.y = rgn->extents.y1;
+  app->event.rect.w = rgn->extents.x2 - rgn->extents.x1;
+  app->event.rect.h = rgn->extents.y2 - rgn->extents.y1;
+  app->event.region = rgn;
+  app->event.synthetic = synth;
+  ((struct dkObject *)window)->handle(window, (struct dkObject *)app, SEL_PAINT, 0, &app->event);
+  app->event.region = NULL;
+  if (start) dkStatsAdd(app->stats, STAT_PAINT, -1, (struct dkObject *)window, dkThreadSteadyTime() - start);
+}
+
+/* Paint one frame:- each window damaged so far gets a single paint
+ * covering all of its damage, and the requests are flushed once at the
+ * end; damage caused while painting waits for the next frame.  Returns
+ * FALSE if user input cut the frame short. */
+static DKbool dkAppPaintFrame(struct dkApp *app)
+{
+  const struct dkMetaClass *traced[DK_MAXTRACED];
+  DKuint times[DK_MAXTRACED];
+  struct dkWindow *window;
+  struct dkRegion rgn;
+  struct dkRepaint *r;
+  DKbool synth, done = TRUE;
+  DKuint input, time;
+  DKlong now;
+  DKID win;
+  int n, i, ntraced = 0;
+
+  for (n = 0, r = app->repaints; r; r = r->next) n++;
+  while (n-- > 0 && (r = app->repaints) != NULL) {
+    win = r->window;
+    synth = r->synth;
+    input = r->input;
+    time = r->inputtime;
+    rgn = r->region;
+    dkRegionInit(&r->region);
+    dkAppRepaintUnlink(app, r);
+    dkAppPaintRegion(app, win, &rgn, synth);
+    dkRegionDestroy(&rgn);
+
+    /* Damage from user input is traced until the flush */
+    if (input && app->stats && ntraced < DK_MAXTRACED && (window = DtkFindWindowWithId(win)) != NULL) {
+      traced[ntraced] = ((struct dkObject *)window)->meta;
+      times[ntraced++] = time;
+    }
+    if (n > 0 && app->inputfirst && dtkDrvInputPending(app)) {
+      done = FALSE;
+      break;
+    }
+  }
+  if (app->display_opened) XFlush((Display*)app->display);
+  if (ntraced) {
+    now = dkThreadSteadyTime();
+    for (i = 0; i < ntraced; i++) dkStatsLatency(app->stats, traced[i], times[i], now);
+  }
+  return done;
+}
+
+/* Add rectangle to the damage region of window */
+void dkAppAddRepaint(struct dkApp *app, DKID win, int x, int y, int w, int h, DKbool synth)
+{
+  struct dkRepaint *r;
+
+  if (w <= 0 || h <= 0) return;
+  if ((r = dkAppFindRepaint(app, win, TRUE)) == NULL) return;
+  dkRegionUnionRect(&r->region, x, y, w, h);
+  r->synth |= synth;        /* Synthethic is preserved! */
+  if (dkRegionEmpty(&r->region)) {
+    dkAppRepaintUnlink(app, r);
+  } else if (app->event.serial && !r->input) {
+    r->input = app->event.serial;       /* Damage caused by user input */
+    r->inputtime = app->event.time;
+  }
+}
+
+/*
+  Notes:
+  - Scrolling copies the window contents with XCopyArea, and the server
+    reports the parts it could not copy with GraphicsExpose, or that it
+    could copy everything with NoExpose.  Rather than waiting for the
+    server with XSync, the copies are remembered by request number until
+    their GraphicsExpose or NoExpose comes in.
+  - An exposure from before a copy, as told by its serial, is about the
+    contents before scrolling; it is scrolled along just like the damage
+    known at the time of the copy.
+*/
+
+/* Remember scroll copy; call right before making the copy */
+void dkAppTrackCopy(struct dkApp *app, DKID win, int dx, int dy)
+{
+  struct dkCopy *c;
+
+  if (app->ncopies == app->maxcopies) {
+    int n = app->maxcopies ? app->maxcopies * 2 : 8;
+    if ((c = realloc(app->copies, sizeof(struct dkCopy) * n)) == NULL) return;
+    app->copies = c;
+    app->maxcopies = n;
+  }
+  c = &((struct dkCopy*)app->copies)[app->ncopies++];
+  c->window = win;
+  c->serial = NextRequest((Display*)app->display);
+  c->dx = dx;
+  c->dy = dy;
+}
+
+/* Add exposure event to the damage, scrolling it along with the copies
+ * made after it, and forget the copies the server has finished */
+static void dtkDrvExpose(App *app, XEvent *ev)
+{
+  struct dkCopy *copies = (struct dkCopy*)app->copies;
+  unsigned long serial = ev->xany.serial;
+  struct dkRegion rgn, moved;
+  int i, j;
+
+  if (ev->xany.type != NoExpose) {
+    for (i = 0; i < app->ncopies; i++) {
+      if (copies[i].window == ev->xany.window && (long)(copies[i].serial - serial) > 0) break;
+    }
+    if (i == app->ncopies) {
+      dkAppAddRepaint(app, ev->xexpose.window, ev->xexpose.x, ev->xexpose.y,
+          ev->xexpose.width, ev->xexpose.height, ev->xexpose.send_event);
+    } else {
+      dkRegionInit(&rgn);
+      dkRegionInit(&moved);
+      dkRegionUnionRect(&rgn, ev->xexpose.x, ev->xexpose.y, ev->xexpose.width, ev->xexpose.height);
+      for (; i < app->ncopies; i++) {
+        if (copies[i].window != ev->xany.window || (long)(copies[i].serial - serial) <= 0) continue;
+        if (dkRegionCopy(&moved, &rgn)) {
+          dkRegionOffset(&moved, copies[i].dx, copies[i].dy);
+          dkRegionUnion(&rgn, &rgn, &moved);
+        }
+      }
+      for (i = 0; i < rgn.numRects; i++) {
+        dkAppAddRepaint(app, ev->xexpose.window, rgn.rects[i].x1, rgn.rects[i].y1,
+            rgn.rects[i].x2 - rgn.rects[i].x1, rgn.rects[i].y2 - rgn.rects[i].y1, ev->xexpose.send_event);
+      }
+      dkRegionDestroy(&moved);
+      dkRegionDestroy(&rgn);
+    }
+  }
+
+  /* A copy is done once its last GraphicsExpose or NoExpose is in; any
+   * copy before that which never got one has failed */
+  for (i = j = 0; i < app->ncopies; i++) {
+    if ((long)(copies[i].serial - serial) < 0) continue;
+    if (copies[i].serial == serial && ev->xany.type != Expose &&
+        (ev->xany.type == NoExpose || ev->xgraphicsexpose.count == 0)) continue;
+    copies[j++] = copies[i];
+  }
+  app->ncopies = j;
 }
 
 /* Remove repaints by dispatching them */
 void dkAppRemoveRepaints(struct dkApp *app, DKID win, int x, int y, int w, int h)
 {
-  struct dkRepaint *r, **rr;
+  struct dkRegion rgn;
+  struct dkRepaint *r;
+  DKbool synth;
   XEvent ev;
 
-  w += x;
-  h += y;
-
-  /* Flush the buffer and wait till the X server catches up;
-   * resulting events, if any, are buffered in the client. */
-  XSync((Display*)app->display, FALSE);
-
-  /* Fish out the expose events and compound them */
-  while (XCheckMaskEvent((Display*)app->display, ExposureMask, &ev)) {
-    if (ev.xany.type == NoExpose) continue;
-    dkAppAddRepaint(app, ev.xexpose.window, ev.xexpose.x, ev.xexpose.y, ev.xexpose.width, ev.xexpose.height, 0);
-  }
-
-  /* Then process events pertaining to window win and overlapping
-   * with the given rectangle; other events are left in the queue. */
-  rr = &app->repaints;
-  while((r = *rr) != NULL) {
-    if (!win || (win == r->window && x < r->rect.w && y < r->rect.h && r->rect.x < w && r->rect.y < h)) {
-      *rr = r->next;
-      ev.xany.type = Expose;
-      ev.xexpose.window = r->window;
-      ev.xexpose.x = r->rect.x;
-      ev.xexpose.y = r->rect.y;
-      ev.xexpose.width = r->rect.w - r->rect.x;
-      ev.xexpose.height = r->rect.h-r->rect.y;
-      r->next = app->repaintrecs;
-      app->repaintrecs = r;
-      dtkDrvDispatchEvent(app, &ev);
-      continue;
+  /* Fish out the expose events that have come in so far and compound
+   * them; we don't wait for the server, so any still on the way are
+   * painted when they arrive */
+  while (app->display_opened && XCheckMaskEvent((Display*)app->display, ExposureMask, &ev)) {
+    dtkDrvExpose(app, &ev);
+  }
+
+  /* Then process the damage of window win inside the given rectangle,
+   * or all damage if win is 0; the region is taken off the record first
+   * since painting may add new damage. */
+  dkRegionInit(&rgn);
+  if (!win) {
+    while ((r = app->repaints) != NULL) {
+      win = r->window;
+      synth = r->synth;
+      rgn = r->region;
+      dkRegionInit(&r->region);
+      dkAppRepaintUnlink(app, r);
+      dkAppPaintRegion(app, win, &rgn, synth);
+      dkRegionDestroy(&rgn);
+    }
+  } else if ((r = dkAppFindRepaint(app, win, FALSE)) != NULL) {
+    synth = r->synth;
+    if (dkRegionCopy(&rgn, &r->region) && dkRegionIntersectRect(&rgn, x, y, w, h)) {
+      dkRegionSubtractRect(&r->region, x, y, w, h);
+      if (dkRegionEmpty(&r->region)) dkAppRepaintUnlink(app, r);
+      dkAppPaintRegion(app, win, &rgn, synth);
     }
-    rr = &r->next;
+    dkRegionDestroy(&rgn);
   }
 
   /* Flush the buffer again */
-  XFlush((Display*)app->display);
+  if (app->display_opened) XFlush((Display*)app->display);
 }
 
-/* Scroll repaint rectangles; some slight trickyness here:- the
- * rectangles don't just move, they stretch in the scroll direction
+/* Scroll damage region; some slight trickyness here:- the damage
+ * doesn't just move, it is added again at the scrolled position.
  * This means the original dirty area will remain part of the area to
  * be painted. */
 void dkAppScrollRepaints(struct dkApp *app, DKID win, int dx, int dy)
 {
+  struct dkRegion moved;
   struct dkRepaint *r;
-  for (r = app->repaints; r; r = r->next) {
-    if (r->window == win) {
-      if (dx > 0) r->rect.w += dx; else r->rect.x += dx;
-      if (dy > 0) r->rect.h += dy; else r->rect.y += dy;
+
+  if ((r = dkAppFindRepaint(app, win, FALSE)) == NULL) return;
+  dkRegionInit(&moved);
+  if (dkRegionCopy(&moved, &r->region)) {
+    dkRegionOffset(&moved, dx, dy);
+    dkRegionUnion(&r->region, &r->region, &moved);
+  }
+  dkRegionDestroy(&moved);
+}
+
+/*
+  Notes:
+  - With -xinput2, enabled windows take their pointer buttons and motion
+    through XInput2 2.1, which are turned back into core events as they
+    are read, so compressing, recording and dispatch see no difference.
+  - Smooth scrolling comes as valuator changes in XInput2 motion; these
+    become wheel presses carrying the amount in 1/DK_WHEELNOTCH notches,
+    and the wheel presses the server makes up for core clients are
+    dropped.  Only the vertical valuators are used.
+  - Windows wanting motion on demand only stay with the core events, as
+    XInput2 has nothing like PointerMotionHintMask.
+*/
+
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+
+/* Find the vertical scrolling valuators of the pointer devices */
+static void dtkDrvQueryScrollers(App *app)
+{
+  XIDeviceInfo *info;
+  XIScrollClassInfo *sc;
+  XIValuatorClassInfo *vc;
+  struct dkScroller *s;
+  int ndevices, i, j, k;
+
+  app->nscrollers = 0;
+  if ((info = XIQueryDevice((Display*)app->display, XIAllDevices, &ndevices)) == NULL) return;
+  for (i = 0; i < ndevices; i++) {
+    if (info[i].use != XISlavePointer && info[i].use != XIFloatingSlave) continue;
+    for (j = 0; j < info[i].num_classes; j++) {
+      sc = (XIScrollClassInfo *)info[i].classes[j];
+      if (sc->type != XIScrollClass || sc->scroll_type != XIScrollTypeVertical || sc->increment == 0.0) continue;
+      if ((s = realloc(app->scrollers, sizeof(struct dkScroller) * (app->nscrollers + 1))) == NULL) break;
+      app->scrollers = s;
+      s += app->nscrollers++;
+      s->device = info[i].deviceid;
+      s->number = sc->number;
+      s->increment = sc->increment;
+      s->last = s->rest = 0.0;
+      s->havelast = FALSE;
+
+      /* Scrolling goes on from where the valuator is now */
+      for (k = 0; k < info[i].num_classes; k++) {
+        vc = (XIValuatorClassInfo *)info[i].classes[k];
+        if (vc->type == XIValuatorClass && vc->number == sc->number) {
+          s->last = vc->value;
+          s->havelast = TRUE;
+        }
+      }
     }
   }
+  XIFreeDeviceInfo(info);
+}
+
+/* Find scrolling valuator; with number -1, any of the device */
+static struct dkScroller *dtkDrvFindScroller(App *app, int device, int number)
+{
+  struct dkScroller *s = (struct dkScroller *)app->scrollers;
+  int i;
+
+  for (i = 0; i < app->nscrollers; i++) {
+    if (s[i].device == device && (number < 0 || s[i].number == number)) return &s[i];
+  }
+  return NULL;
+}
+
+/* Start using XInput2, if the server has 2.1 or later */
+static void dtkDrvOpenXInput(App *app)
+{
+  unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+  XIEventMask mask;
+  int opcode, event, error, major = 2, minor = 1;
+
+  if (!XQueryExtension((Display*)app->display, "XInputExtension", &opcode, &event, &error)) return;
+  if (XIQueryVersion((Display*)app->display, &major, &minor) != Success || major < 2 || (major == 2 && minor < 1)) return;
+  app->xiopcode = opcode;
+
+  /* Devices coming and going change the valuators */
+  memset(bits, 0, sizeof(bits));
+  XISetMask(bits, XI_HierarchyChanged);
+  mask.deviceid = XIAllDevices;
+  mask.mask_len = sizeof(bits);
+  mask.mask = bits;
+  XISelectEvents((Display*)app->display, XDefaultRootWindow((Display*)app->display), &mask, 1);
+  dtkDrvQueryScrollers(app);
+  DKTRACE((100, "XInput2 available\n"));
+}
+
+/* Turn XInput2 event into the core event it stands for, or drop it by
+ * giving it type 0; motion that scrolls as well becomes a wheel press
+ * and puts the motion back to be read next.  The pointer entering a
+ * window forgets where the valuators were, as they may have moved
+ * elsewhere since */
+static void dtkDrvTranslateXInput(App *app, XEvent *ev)
+{
+  XIDeviceEvent *d;
+  struct dkScroller *sc;
+  XEvent core, motion;
+  DKbool scrolled = FALSE, moved = FALSE;
+  DKuint state;
+  double value;
+  int i, v, amount = 0;
+
+  if (ev->xany.type == EnterNotify) {
+    for (i = 0; i < app->nscrollers; i++) ((struct dkScroller *)app->scrollers)[i].havelast = FALSE;
+    return;
+  }
+  if (ev->xany.type != GenericEvent || ev->xcookie.extension != app->xiopcode) return;
+  if (!XGetEventData((Display*)app->display, &ev->xcookie)) {
+    ev->xany.type = 0;
+    return;
+  }
+  memset(&core, 0, sizeof(core));
+  switch (ev->xcookie.evtype) {
+  case XI_HierarchyChanged:
+    dtkDrvQueryScrollers(app);
+    break;
+  case XI_Motion:
+  case XI_ButtonPress:
+  case XI_ButtonRelease:
+    d = (XIDeviceEvent *)ev->xcookie.data;
+
+    /* Modifiers and buttons down, as the core events have them */
+    state = (DKuint)d->mods.effective & 0xff;
+    for (i = 1; i <= 5 && i < d->buttons.mask_len * 8; i++) {
+      if (XIMaskIsSet(d->buttons.mask, i)) state |= Button1Mask << (i - 1);
+    }
+
+    /* Changes of the scrolling valuators add up to a wheel amount */
+    if (ev->xcookie.evtype == XI_Motion) {
+      moved = d->valuators.mask_len > 0 && (XIMaskIsSet(d->valuators.mask, 0) || XIMaskIsSet(d->valuators.mask, 1));
+      for (i = v = 0; i < d->valuators.mask_len * 8; i++) {
+        if (!XIMaskIsSet(d->valuators.mask, i)) continue;
+        value = d->valuators.values[v++];
+        if ((sc = dtkDrvFindScroller(app, d->sourceid, i)) == NULL) continue;
+        if (sc->havelast) {
+          sc->rest += (value - sc->last) / sc->increment * DK_WHEELNOTCH;
+          amount += (int)sc->rest;
+          sc->rest -= (int)sc->rest;
+        }
+        sc->last = value;
+        sc->havelast = TRUE;
+        scrolled = TRUE;
+      }
+    }
+
+    /* Made up wheel presses of a device that scrolls smoothly */
+    else if ((d->detail == Button4 || d->detail == Button5) && (d->flags & XIPointerEmulated) &&
+        dtkDrvFindScroller(app, d->sourceid, -1)) {
+      break;
+    }
+
+    /* Wheel press with the amount stuck in subwindow; scrolling down
+     * makes the valuator go up */
+    if (scrolled && amount == 0 && !moved) break;
+    if (scrolled && amount != 0) {
+      core.xbutton.type = ButtonPress;
+      core.xbutton.button = amount < 0 ? Button4 : Button5;
+      core.xbutton.subwindow = (Window)FXABS(amount);
+    } else if (ev->xcookie.evtype == XI_Motion) {
+      core.xmotion.type = MotionNotify;
+      core.xmotion.is_hint = NotifyNormal;
+    } else {
+      core.xbutton.type = (ev->xcookie.evtype == XI_ButtonPress) ? ButtonPress : ButtonRelease;
+      core.xbutton.button = d->detail;
+      if (core.xbutton.type == ButtonPress && (d->detail == Button4 || d->detail == Button5))
+        core.xbutton.subwindow = DK_WHEELNOTCH;
+    }
+    core.xbutton.serial = d->serial;
+    core.xbutton.send_event = d->send_event;
+    core.xbutton.display = d->display;
+    core.xbutton.window = d->event;
+    core.xbutton.root = d->root;
+    core.xbutton.time = d->time;
+    core.xbutton.x = (int)floor(d->event_x);
+    core.xbutton.y = (int)floor(d->event_y);
+    core.xbutton.x_root = (int)floor(d->root_x);
+    core.xbutton.y_root = (int)floor(d->root_y);
+    core.xbutton.state = state;
+    core.xbutton.same_screen = True;
+
+    /* The pointer moved while scrolling */
+    if (core.xany.type == ButtonPress && ev->xcookie.evtype == XI_Motion && moved) {
+      motion = core;
+      motion.xmotion.type = MotionNotify;
+      motion.xmotion.is_hint = NotifyNormal;
+      motion.xmotion.subwindow = None;
+      XPutBackEvent((Display*)app->display, &motion);
+    }
+    break;
+  }
+  XFreeEventData((Display*)app->display, &ev->xcookie);
+  *ev = core;
+}
+
+#endif
+
+/* Select the pointer events of window through XInput2, if in use */
+void dtkDrvSelectPointer(struct dkWindow *w)
+{
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+  unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+  XIEventMask mask;
+
+  if (!w->app->xiopcode || !w->app->display_opened) return;
+  memset(bits, 0, sizeof(bits));
+  if ((w->flags & FLAG_ENABLED) && !(w->flags & FLAG_MOTIONHINT)) {
+    XISetMask(bits, XI_ButtonPress);
+    XISetMask(bits, XI_ButtonRelease);
+    XISetMask(bits, XI_Motion);
+  }
+  mask.deviceid = XIAllMasterDevices;
+  mask.mask_len = sizeof(bits);
+  mask.mask = bits;
+  XISelectEvents((Display*)w->app->display, (Window)w->xid, &mask, 1);
+#endif
 }
 
 static int
@@ -1647,6 +3574,22 @@ dtkDrvOpenDisplay(App *app, char *dpyname)
 	if(app->display == NULL)
 		return 0;
 
+#ifdef HAVE_X11_XLIB_XCB_H
+	/* Requests whose answer is not needed right away go through XCB */
+	app->xcb = XGetXCBConnection((Display*)app->display);
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* The reactor always watches the display connection */
+	if (app->reactor >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = ConnectionNumber((Display*)app->display);
+		epoll_ctl(app->reactor, EPOLL_CTL_ADD, ev.data.fd, &ev);
+	}
+#endif
+
 	/* Check for X Rotation and Reflection support */
 #ifdef HAVE_XRANDR_H
 	if (XRRQueryExtension((Display*)app->display, &app->xrreventbase, &errorbase)) {
@@ -1655,6 +3598,11 @@ dtkDrvOpenDisplay(App *app, char *dpyname)
 	}
 #endif
 
+	/* Smooth scrolling and unthrottled motion through XInput2 */
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+	if (app->xinput) dtkDrvOpenXInput(app);
+#endif
+
 	app->wmState = XInternAtom((Display*)app->display, "WM_STATE", 0);
 
 	/* Extended Window Manager support */
@@ -1698,13 +3646,28 @@ static DKuint keysym(XEvent *event)
 {
   KeySym sym = KEY_VoidSymbol;
   char buffer[40];
+  if (!event->xkey.display) return dtkNullKeysym(event->xkey.keycode, event->xkey.state);
   XLookupString(&event->xkey, buffer, sizeof(buffer), &sym, NULL);
   return sym;
 }
 
+/* Send key event to window; if the receiver did not take all the
+ * presses folded into a key press, it gets the others one by one */
+static long dtkDrvSendKey(App *app, struct dkWindow *w)
+{
+  long handled;
+  int left;
+
+  handled = ((struct dkObject *)w)->handle(w, (struct dkObject *)app, app->event.type, 0, &app->event);
+  for (left = app->event.repeat - 1, app->event.repeat = 1; left > 0; left--) {
+    if (((struct dkObject *)w)->handle(w, (struct dkObject *)app, app->event.type, 0, &app->event)) handled = 1;
+  }
+  return handled;
+}
+
 static int dtkDrvDispatchEvent(App *app, XEvent *ev)
 {
-  int        tmp_x, tmp_y;
+  int        tmp_x, tmp_y, i;
   Window     tmp;
   struct dkWindow *window, *ancestor;
 
@@ -1722,6 +3685,7 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
       app->event.rect.y = ev->xexpose.y;
       app->event.rect.w = ev->xexpose.width;
       app->event.rect.h = ev->xexpose.height;
+      app->event.region = NULL;
       app->event.synthetic = ev->xexpose.send_event;
       ((struct dkObject *)window)->handle(window, (struct dkObject *)app, SEL_PAINT, 0, &app->event);
     case NoExpose:
@@ -1740,6 +3704,7 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
       app->event.win_y = ev->xkey.y;
       app->event.root_x = ev->xkey.x_root;
       app->event.root_y = ev->xkey.y_root;
+      app->event.repeat = (ev->xkey.type == KeyPress && (int)ev->xkey.subwindow > 1) ? (int)ev->xkey.subwindow : 1;
 
       /* Translate to keysym; must interpret modifiers! */
       app->event.code = keysym(ev);
@@ -1796,7 +3761,7 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
 
       /* Keyboard grabbed by specific window */
       if (app->keyboardGrabWindow) {
-        if (((struct dkObject *)app->keyboardGrabWindow)->handle(app->keyboardGrabWindow, (struct dkObject *)app, app->event.type, 0, &app->event)) {
+        if (dtkDrvSendKey(app, app->keyboardGrabWindow)) {
           fxAppRefresh(app);
         }
         return 1;
@@ -1813,7 +3778,7 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
         if (!app->invocation || app->invocation->modality == MODAL_FOR_NONE ||
           (app->invocation->window && dkWindowIsOwnerOf(app->invocation->window, app->keyWindow)) ||
           (DtkWindowGetShell(app->keyWindow)->doesSaveUnder())) {
-          if (((struct dkObject *)app->keyWindow)->handle(app->keyWindow, (struct dkObject *)app, app->event.type, 0, &app->event))
+          if (dtkDrvSendKey(app, app->keyWindow))
             fxAppRefresh(app);
           return 0;
         }
@@ -1840,9 +3805,14 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
       if ((FXABS(app->event.root_x - app->event.rootclick_x) >= app->dragDelta) ||
           (FXABS(app->event.root_y - app->event.rootclick_y) >= app->dragDelta)) app->event.moved = 1;
 
-      /* Dispatch to grab window */
+      /* Dispatch to grab window; the samples move along */
       if (app->mouseGrabWindow) {
         dkWindowTranslateCoordinatesTo(window, &app->event.win_x, &app->event.win_y, app->mouseGrabWindow, app->event.win_x, app->event.win_y);
+        for (i = 0; i < app->event.nsamples; i++) {
+          struct dkMotionSample *s = (struct dkMotionSample *)app->event.samples + i;
+          s->win_x += app->event.win_x - ev->xmotion.x;
+          s->win_y += app->event.win_y - ev->xmotion.y;
+        }
         if (((struct dkObject *)app->mouseGrabWindow)->handle(app->mouseGrabWindow, (struct dkObject *)app, SEL_MOTION, 0, &app->event))
           fxAppRefresh(app);
       }
@@ -1875,10 +3845,33 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
       /* Mouse buttons and modifiers but no wheel buttons */
       app->event.state = (ev->xmotion.state &~(Button4Mask|Button5Mask)) | app->stickyMods;
 
-      /* Mouse Wheel */
+      /* Mouse wheel; the amount is in subwindow, and a replayed press is one notch */
       if (ev->xbutton.button == Button4 || ev->xbutton.button == Button5) {
-        /* TODO: XXX Finish mouse wheel */
-        printf("MOUSEWHEEL!!\n");
+        if (ev->xbutton.type != ButtonPress) return 1;
+        app->event.type = SEL_MOUSEWHEEL;
+        app->event.code = (ev->xbutton.subwindow ? (int)ev->xbutton.subwindow : DK_WHEELNOTCH) * (ev->xbutton.button == Button4 ? 1 : -1);
+
+        /* Dispatch to grab window */
+        if (app->mouseGrabWindow) {
+          dkWindowTranslateCoordinatesTo(window, &app->event.win_x, &app->event.win_y, app->mouseGrabWindow, app->event.win_x, app->event.win_y);
+          if (((struct dkObject *)app->mouseGrabWindow)->handle(app->mouseGrabWindow, (struct dkObject *)app, SEL_MOUSEWHEEL, 0, &app->event))
+            fxAppRefresh(app);
+        }
+
+        /* FIXME doesSaveUnder test should go away */
+        /* Dispatch to the window under the pointer, or the nearest of its ancestors taking it, inside modal window */
+        else if (!app->invocation || app->invocation->modality == MODAL_FOR_NONE ||
+          (app->invocation->window && dkWindowIsOwnerOf(app->invocation->window, window)) ||
+          (DtkWindowGetShell(window)->doesSaveUnder())) {
+          for (ancestor = window; ancestor; ancestor = (ancestor->flags & FLAG_SHELL) ? NULL : ancestor->parent) {
+            if (((struct dkObject *)ancestor)->handle(ancestor, (struct dkObject *)app, SEL_MOUSEWHEEL, 0, &app->event)) {
+              fxAppRefresh(app);
+              break;
+            }
+            app->event.win_x += ancestor->xpos;
+            app->event.win_y += ancestor->ypos;
+          }
+        }
         return 1;
       }
 
@@ -2055,135 +4048,513 @@ static int dtkDrvDispatchEvent(App *app, XEvent *ev)
   return 0;
 }
 
+/* Wait for activity on the display connection or the inputs; interval
+ * is in nanoseconds, 0 polls and a negative interval waits forever.
+ * Returns the number of ready descriptors, 0 on timeout, -1 on error. */
+static int dtkDrvWaitInputs(App *app, DKlong interval)
+{
+  struct timeval delta;
+  fd_set *ready;
+  int display, maxfds;
+  DKlong start;
+
+  display = app->display_opened ? ConnectionNumber((Display*)app->display) : -1;
+  start = (app->stats && interval) ? dkThreadSteadyTime() : 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (app->reactor >= 0) {
+    int ms = (interval < 0) ? -1 : (int)((interval + 999999) / 1000000);
+    app->nready = epoll_wait(app->reactor, (struct epoll_event*)app->ready, DK_MAXREADY, ms);
+    if (start) dkStatsAdd(app->stats, STAT_WAIT, -1, NULL, dkThreadSteadyTime() - start);
+    return app->nready;
+  }
+#endif
+
+  /* Prepare fd's to check */
+  ready = (fd_set*)app->ready;
+  maxfds = app->maxinput;
+  ready[0] = *((fd_set*)app->r_fds);
+  ready[1] = *((fd_set*)app->w_fds);
+  ready[2] = *((fd_set*)app->e_fds);
+
+  /* Add connection to display if its open */
+  if (display >= 0) {
+    FD_SET(display, &ready[0]);
+    if (display > maxfds) maxfds = display;
+  }
+
+  /* Compute how long to wait */
+  if (interval >= 0) {
+    delta.tv_usec = (interval / 1000) % 1000000;
+    delta.tv_sec = interval / 1000000000;
+  }
+  app->nready = select(maxfds + 1, &ready[0], &ready[1], &ready[2], (interval < 0) ? NULL : &delta);
+  if (start) dkStatsAdd(app->stats, STAT_WAIT, -1, NULL, dkThreadSteadyTime() - start);
+  return app->nready;
+}
+
+/* Arm the timer descriptor to expire when the earliest timer is due, so
+ * the wait need not compute a timeout; returns FALSE if there is no
+ * timer descriptor and the wait must time out by itself. */
+static DKbool dtkDrvArmTimer(App *app, DKlong due)
+{
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+  struct itimerspec its;
+
+  if (app->timerfd < 0) return FALSE;
+  if (app->timerdue == due) return TRUE;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = due / 1000000000;
+  its.it_value.tv_nsec = due % 1000000000;
+  if (timerfd_settime(app->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) return FALSE;
+  app->timerdue = due;
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Dispatch I/O messages for the inputs found ready by the last wait;
+ * returns TRUE if the display connection became readable. */
+static DKbool dtkDrvDispatchInputs(App *app)
+{
+  DKbool gotdisplay = FALSE;
+  fd_set *ready;
+  int display, fd;
+
+  display = app->display_opened ? ConnectionNumber((Display*)app->display) : -1;
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (app->reactor >= 0) {
+    struct epoll_event *ev = (struct epoll_event*)app->ready;
+    int i;
+
+    /* Only descriptors which are actually ready are visited */
+    for (i = 0; i < app->nready; i++) {
+      fd = ev[i].data.fd;
+      if (fd == display) { gotdisplay = TRUE; continue; }
+      if (fd == app->timerfd) {
+        DKulong expirations;
+        if (read(fd, &expirations, sizeof(expirations)) < 0) { /* Already cleared */ }
+        app->timerdue = 0;
+        continue;
+      }
+      if (fd > app->maxinput) continue;
+      if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        dkAppDispatchInput(app, &app->inputs[fd].read, SEL_IO_READ);
+      if (fd > app->maxinput) continue;
+      if (ev[i].events & (EPOLLOUT | EPOLLERR))
+        dkAppDispatchInput(app, &app->inputs[fd].write, SEL_IO_WRITE);
+      if (fd > app->maxinput) continue;
+      if (ev[i].events & EPOLLPRI)
+        dkAppDispatchInput(app, &app->inputs[fd].excpt, SEL_IO_EXCEPT);
+    }
+    app->nready = 0;
+    return gotdisplay;
+  }
+#endif
+
+  ready = (fd_set*)app->ready;
+  if (display >= 0 && FD_ISSET(display, &ready[0])) gotdisplay = TRUE;
+  for (fd = 0; fd <= app->maxinput; fd++) {
+    if (fd == display) continue;
+    if (FD_ISSET(fd, &ready[0])) dkAppDispatchInput(app, &app->inputs[fd].read, SEL_IO_READ);
+    if (fd > app->maxinput) break;
+    if (FD_ISSET(fd, &ready[1])) dkAppDispatchInput(app, &app->inputs[fd].write, SEL_IO_WRITE);
+    if (fd > app->maxinput) break;
+    if (FD_ISSET(fd, &ready[2])) dkAppDispatchInput(app, &app->inputs[fd].excpt, SEL_IO_EXCEPT);
+  }
+  app->nready = 0;
+  return gotdisplay;
+}
+
+/* Find window among the first n of a small table, or add it */
+static int dtkDrvBatchSlot(Window *windows, int *n, Window w)
+{
+  int i;
+
+  for (i = 0; i < *n; i++) {
+    if (windows[i] == w) return i;
+  }
+  if (*n == DK_BATCHWINDOWS) return -1;
+  windows[*n] = w;
+  return (*n)++;
+}
+
+/* Read all the events the display has queued into the batch, and
+ * compress them as a whole; when appending, the events not handled yet
+ * are kept in front of them as they are.  Returns the number of events
+ * left */
+static int dtkDrvFillBatch(App *app, DKbool append)
+{
+  Window windows[DK_BATCHWINDOWS];
+  int states[DK_BATCHWINDOWS];
+  int survivor[DK_BATCHWINDOWS];
+  struct dkMotionSample *samples;
+  struct dkFold *folds;
+  XEvent *batch, *e, *f, next;
+  int n, i, j, k, nwindows, nsamples, base, end;
+
+  /* Keep the samples of all the motion still in the batch, as the event
+   * being handled may point at them; move the rest of the batch down */
+  base = nsamples = 0;
+  if (append) {
+    batch = (XEvent*)app->batch;
+    folds = (struct dkFold *)app->folds;
+    for (i = 0; i < app->nbatch; i++) {
+      if (batch[i].xany.type == MotionNotify) nsamples = FXMAX(nsamples, folds[i].first + folds[i].count);
+    }
+    base = app->nbatch - app->batchhead;
+    if (app->batchhead) {
+      memmove(batch, batch + app->batchhead, sizeof(XEvent) * base);
+      memmove(folds, folds + app->batchhead, sizeof(struct dkFold) * base);
+    }
+  }
+  app->batchhead = 0;
+  app->nbatch = base;
+
+  /* Read everything at once */
+  n = XEventsQueued((Display*)app->display, QueuedAfterReading);
+  k = FXMAX(base, nsamples);
+  if (n > DK_MAXBATCH - k) n = DK_MAXBATCH - k;
+  if (k + n > app->maxbatch) {
+    if ((batch = realloc(app->batch, sizeof(XEvent) * (k + n))) != NULL) app->batch = batch;
+    if ((folds = realloc(app->folds, sizeof(struct dkFold) * (k + n))) != NULL) app->folds = folds;
+    i = app->event.nsamples ? (int)(app->event.samples - (struct dkMotionSample *)app->samples) : 0;
+    if ((samples = realloc(app->samples, sizeof(struct dkMotionSample) * (k + n))) != NULL) app->samples = samples;
+    if (app->event.nsamples) app->event.samples = (struct dkMotionSample *)app->samples + i;
+    if (batch && folds && samples) app->maxbatch = k + n;
+    else n = app->maxbatch - k;
+  }
+  if (n <= 0) return base;
+  end = base + n;
+  batch = (XEvent*)app->batch;
+  folds = (struct dkFold *)app->folds;
+  samples = (struct dkMotionSample *)app->samples;
+  for (i = base; i < end; i++) {
+    e = &batch[i];
+    XNextEvent((Display*)app->display, e);
+
+    /* Wheel presses carry their amount in subwindow from here on; those
+     * from XInput2 get it when they are translated */
+    if (e->xany.type == ButtonPress && (e->xbutton.button == Button4 || e->xbutton.button == Button5))
+      e->xbutton.subwindow = DK_WHEELNOTCH;
+#ifdef HAVE_X11_EXTENSIONS_XINPUT2_H
+    if (app->xiopcode) dtkDrvTranslateXInput(app, e);
+#endif
+  }
+
+  /* Forward pass; dropped events get type 0 */
+  for (i = base; i < end; i++) {
+    e = &batch[i];
+    switch (e->xany.type) {
+
+    /* Fold exposures into the damage */
+    case Expose:
+    case GraphicsExpose:
+    case NoExpose:
+      dtkDrvExpose(app, e);
+      e->xany.type = 0;
+      break;
+
+    /* Add up the wheel amounts of a run of wheel presses and releases */
+    case ButtonPress:
+      if (e->xbutton.button == Button4 || e->xbutton.button == Button5) {
+        for (j = i + 1; j < end; j++) {
+          f = &batch[j];
+          if ((f->xany.type != ButtonPress && f->xany.type != ButtonRelease) ||
+              (f->xany.window != e->xany.window) || (f->xbutton.button != e->xbutton.button)) break;
+          if (f->xany.type == ButtonPress) e->xbutton.subwindow += f->xbutton.subwindow;
+          f->xany.type = 0;
+        }
+        i = j - 1;
+      }
+      break;
+
+    /* Fold the auto-repeats of a key press into it and count them */
+    case KeyPress:
+      k = 1;
+      for (j = i + 1; j < end; j++) {
+        f = &batch[j];
+
+        /* Repeats come as a release and press with the same time, or as presses alone */
+        if (f->xany.type == KeyRelease && j + 1 < end && f->xkey.window == e->xkey.window &&
+            f->xkey.keycode == e->xkey.keycode && batch[j + 1].xkey.time == f->xkey.time) f = &batch[j + 1];
+        if (f->xany.type != KeyPress || f->xkey.window != e->xkey.window ||
+            f->xkey.keycode != e->xkey.keycode || f->xkey.state != e->xkey.state) break;
+        if (f != &batch[j]) batch[j++].xany.type = 0;
+        f->xany.type = 0;
+        k++;
+      }
+      e->xkey.subwindow = (Window)k;      // Stick it here for later
+      i = j - 1;
+      break;
+
+    /* Auto-repeat sends a release and press with the same time; drop the
+     * release.  The press may not be in the batch yet, so look past its
+     * end without flushing */
+    case KeyRelease:
+      if (i + 1 < end) {
+        f = &batch[i + 1];
+      } else if (XEventsQueued((Display*)app->display, QueuedAfterReading)) {
+        XPeekEvent((Display*)app->display, &next);
+        f = &next;
+      } else {
+        break;
+      }
+      if (f->xany.type == KeyPress && f->xkey.window == e->xkey.window &&
+          f->xkey.keycode == e->xkey.keycode && f->xkey.time == e->xkey.time) e->xany.type = 0;
+      break;
+    }
+  }
+
+  /* Backward pass: motion is superseded by later motion in the same
+   * window and state, as long as no other input comes in between, and
+   * is chained to it oldest first; a configure is superseded by any
+   * later configure of the same window */
+  nwindows = 0;
+  for (i = end - 1; i >= base; i--) {
+    e = &batch[i];
+    switch (e->xany.type) {
+    case MotionNotify:
+      for (k = 0; k < nwindows; k++) {
+        if (windows[k] == e->xmotion.window && states[k] == (int)e->xmotion.state) break;
+      }
+      folds[i].first = -1;
+      if (k < nwindows) {
+        folds[i].first = folds[survivor[k]].first;
+        folds[survivor[k]].first = i;
+        e->xany.type = 0;
+      } else if (nwindows < DK_BATCHWINDOWS) {
+        windows[nwindows] = e->xmotion.window;
+        states[nwindows] = e->xmotion.state;
+        survivor[nwindows++] = i;
+      }
+      break;
+    case KeyPress:
+    case KeyRelease:
+    case ButtonPress:
+    case ButtonRelease:
+    case EnterNotify:
+    case LeaveNotify:
+    case FocusIn:
+    case FocusOut:
+      nwindows = 0;
+      break;
+    }
+  }
+  nwindows = 0;
+  for (i = end - 1; i >= base; i--) {
+    e = &batch[i];
+    if (e->xany.type != ConfigureNotify) continue;
+    j = nwindows;
+    if ((k = dtkDrvBatchSlot(windows, &nwindows, e->xconfigure.window)) < 0) continue;
+    if (k == j) {
+      survivor[k] = i;
+      continue;
+    }
+
+    /* The latest synthetic configure has the position relative to the root */
+    f = &batch[survivor[k]];
+    if (e->xconfigure.send_event && !f->xconfigure.send_event) {
+      f->xconfigure.x = e->xconfigure.x;
+      f->xconfigure.y = e->xconfigure.y;
+      f->xconfigure.send_event = True;
+    }
+    e->xany.type = 0;
+  }
+
+  /* Keep the samples of the motion that was superseded */
+  for (i = base; i < end; i++) {
+    if (batch[i].xany.type != MotionNotify) continue;
+    j = nsamples;
+    for (k = folds[i].first; k >= 0; k = folds[k].first) {
+      samples[nsamples].win_x = batch[k].xmotion.x;
+      samples[nsamples].win_y = batch[k].xmotion.y;
+      samples[nsamples].root_x = batch[k].xmotion.x_root;
+      samples[nsamples].root_y = batch[k].xmotion.y_root;
+      samples[nsamples++].time = (DKuint)batch[k].xmotion.time;
+    }
+    folds[i].first = j;
+    folds[i].count = nsamples - j;
+  }
+
+  /* Squeeze out what was dropped */
+  for (i = j = base; i < end; i++) {
+    if (batch[i].xany.type == 0) continue;
+    if (i != j) {
+      batch[j] = batch[i];
+      folds[j] = folds[i];
+    }
+    j++;
+  }
+  app->nbatch = j;
+  return j;
+}
+
+/* Motion on demand only says the pointer moved; ask where it is now,
+ * which also asks for the next */
+static void dtkDrvQueryMotion(App *app, XEvent *ev)
+{
+  Window root, child;
+  int root_x, root_y, win_x, win_y;
+  unsigned int state;
+
+  if (XQueryPointer((Display*)app->display, ev->xmotion.window, &root, &child, &root_x, &root_y, &win_x, &win_y, &state)) {
+    ev->xmotion.x = win_x;
+    ev->xmotion.y = win_y;
+    ev->xmotion.x_root = root_x;
+    ev->xmotion.y_root = root_y;
+    ev->xmotion.state = state;
+  }
+  ev->xmotion.is_hint = NotifyNormal;
+}
+
+/* Check if event is a key or button press or release */
+static DKbool dtkDrvIsUserInput(const XEvent *ev)
+{
+  switch (ev->xany.type) {
+  case KeyPress:
+  case KeyRelease:
+  case ButtonPress:
+  case ButtonRelease:
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* Check if the user pressed or released a key or button; adds what
+ * the server sent so far to the batch, but never blocks or flushes */
+static DKbool dtkDrvInputPending(App *app)
+{
+  int i;
+
+  if (app->display_opened && XEventsQueued((Display *)app->display, QueuedAfterReading))
+    dtkDrvFillBatch(app, TRUE);
+  for (i = app->batchhead; i < app->nbatch; i++) {
+    if (dtkDrvIsUserInput(&((XEvent*)app->batch)[i])) return TRUE;
+  }
+  return FALSE;
+}
+
 int dtkDrvGetNextEvent(App *app, XEvent *ev, int blocking)
 {
-  XEvent e;
+  DKlong replaydue = 0;
+  int nfds;
 
   /* Set to no-op just in case */
   ev->xany.type=0;
+  app->event.nsamples = 0;
+
+  /* Sample queue depths */
+  if (app->stats)
+    dkAppStatsQueues(app);
 
   /* Handle all past due timers */
-  if (app->timers)
+  if (app->ntimers)
     fxAppHandleTimeouts(app);
 
-  /* Check non-immediate signals that may have fired */
-  /* TODO: Finish */
+  /* Signals that fired arrive on the signal descriptor, which is an
+   * ordinary input, so they are dispatched with the other inputs */
 
 	/* Are there no events already queued up? */
-	if (!app->display_opened || !XEventsQueued(app->display, QueuedAfterFlush)) {
-		struct timeval delta;
-		fd_set readfds;
-		fd_set writefds;
-		fd_set exceptfds;
-		int    maxfds;
-		int    nfds;
-
-		/* Prepare fd's to check */
-		maxfds = app->maxinput;
-		readfds = *((fd_set*)app->r_fds);
-		writefds = *((fd_set*)app->w_fds);
-		exceptfds = *((fd_set*)app->e_fds);
-
-		/* Add connection to display if its open */
-		if (app->display_opened) {
-			FD_SET(ConnectionNumber((Display*)app->display), &readfds);
-			if (ConnectionNumber((Display*)app->display) > maxfds)
-				maxfds = ConnectionNumber((Display*)app->display);
-		}
-
-		delta.tv_usec = 0;
-		delta.tv_sec = 0;
+	if (app->batchhead == app->nbatch && (!app->display_opened || !XEventsQueued(app->display, QueuedAfterFlush))) {
 
 		/* Do a quick poll for any ready events or inputs */
-		nfds = select(maxfds + 1, &readfds, &writefds, &exceptfds, &delta);
+		nfds = dtkDrvWaitInputs(app, 0);
 
     /* Nothing to do, so perform idle processing */
     if (nfds == 0) {
 
+      /* Run the chores input handling and painting wait for first */
+      if (app->repaints) dkAppRunChores(app, CHORE_PAINT);
+
+      /* Paint a frame when it is due */
+      if (app->repaints && app->frameinterval) {
+        DKlong now = dkThreadSteadyTime();
+        if (app->framedue <= now) {
+          if (dkAppPaintFrame(app)) app->framedue = now + app->frameinterval;
+          return 0;
+        }
+      }
+
       /* Release the expose events */
-      if (app->repaints) {
+      else if (app->repaints) {
         struct dkRepaint *r = app->repaints;
+        struct dkBox b = r->region.rects[0];
         ev->xany.type = Expose;
         ev->xexpose.window = r->window;
         ev->xexpose.send_event = r->synth;
-        ev->xexpose.x = r->rect.x;
-        ev->xexpose.y = r->rect.y;
-        ev->xexpose.width = r->rect.w - r->rect.x;
-        ev->xexpose.height = r->rect.h - r->rect.y;
-        app->repaints = r->next;
-        r->next = app->repaintrecs;
-        app->repaintrecs = r;
+        ev->xexpose.x = b.x1;
+        ev->xexpose.y = b.y1;
+        ev->xexpose.width = b.x2 - b.x1;
+        ev->xexpose.height = b.y2 - b.y1;
+        ev->xexpose.count = r->region.numRects - 1;
+        dkRegionSubtractRect(&r->region, b.x1, b.y1, b.x2 - b.x1, b.y2 - b.y1);
+        if (dkRegionEmpty(&r->region)) {
+          app->paintinput = r->input;         /* Traced once the last box is painted */
+          app->painttime = r->inputtime;
+          dkAppRepaintUnlink(app, r);
+        }
         return 1;
       }
 
-			/* Do our chores :-) */
-			if (app->chores) {
-				struct dkChore *c = app->chores;
-				app->chores = c->next;
-				if (c->target && c->target->handle(c->target, (struct dkObject *)app, SEL_CHORE, c->message, c->data))
-					fxAppRefresh(app);
-				c->next = app->chorerecs;
-				app->chorerecs = c;
-			}
+      /* Do our chores :-) */
+      dkAppRunChores(app, CHORE_BACKGROUND);
 
-			/* GUI updating:- walk the whole widget tree. */
-			if (app->refresher) {
-				((struct dkObject *)app->refresher)->handle(app->refresher, (struct dkObject *)app, SEL_UPDATE, 0, NULL);
-				if (app->refresher->first) {
-					app->refresher = app->refresher->first;
-				} else {
-					while (app->refresher->parent) {
-						if (app->refresher->next) {
-							app->refresher = app->refresher->next;
-							break;
-						}
-						app->refresher = app->refresher->parent;
-					}
-				}
-
-				if (app->refresher != app->refresherstop) return 0;
-				app->refresher = app->refresherstop = NULL;
+      /* GUI updating:- walk the whole widget tree. */
+      if (app->refresher) {
+        if (dkAppUpdateTree(app)) return 0;
+      }
 
-			}
+      /* GUI updating:- only the dirty windows. */
+      else if (app->ndirty) {
+        if (dkAppUpdateDirty(app)) return 0;
+      }
+
+      /* There are more chores to do; chores that keep coming back must
+       * not hold up replaying as fast as possible for good */
+      if (app->choreindex->used) {
+        if (app->replayer && app->replayer->speed == 0.0 &&
+            dkReplayerSettle(app->replayer, dkThreadSteadyTime(), FALSE) && dtkDrvReplayEvent(app, ev)) return 1;
+        return 0;
+      }
 
-      /* There are more chores to do */
-      if (app->chores) return 0;
+      /* Replay recorded events; the previous one has settled once
+       * everything it caused has been handled and painted */
+      if (app->replayer) {
+        dkReplayerSettle(app->replayer, dkThreadSteadyTime(), !app->repaints);
+        if (dtkDrvReplayEvent(app, ev)) return 1;
+        if (!app->replayer) return 0;
+        if (app->replayer->speed != 0.0) replaydue = dkReplayerDue(app->replayer);
+      }
 
       /* We're not blocking */
       if (!blocking) return 0;
 
-			/* Now, block till timeout, i/o, or event */
-			maxfds = app->maxinput;
-			readfds = *((fd_set*)app->r_fds);
-			writefds = *((fd_set*)app->w_fds);
-			exceptfds = *((fd_set*)app->e_fds);
-
-			/* Add connection to display if its open */
-			if (app->display_opened) {
-				FD_SET(ConnectionNumber((Display*)app->display), &readfds);
-				if (ConnectionNumber((Display*)app->display) > maxfds)
-					maxfds = ConnectionNumber((Display*)app->display);
-			}
+      /* If there are timers, a frame to paint or events to replay, we block only for a little while. */
+      if (app->ntimers || app->repaints || replaydue) {
+        DKlong due, interval;
 
-      /* If there are timers, we block only for a little while. */
-      if (app->timers) {
-        DKlong interval;
+        /* Earliest of the first timer, the next frame and the next replayed event */
+        due = app->ntimers ? app->timers[0]->due : app->repaints ? app->framedue : replaydue;
+        if (app->repaints && app->framedue < due) due = app->framedue;
+        if (replaydue && replaydue < due) due = replaydue;
 
         /* All that testing above may have taken some time... */
-        interval = app->timers->due - dkThreadTime();
+        interval = due - dkThreadSteadyTime();
 
         /* Some timers are already due; do them right away! */
         if (interval <= 0) return 0;
 
-        /* Compute how long to wait */
-        delta.tv_usec = (interval / 1000) % 1000000;
-        delta.tv_sec = interval / 1000000000;
+        /* Let the timer descriptor wake us if we have one */
+        if (dtkDrvArmTimer(app, due)) interval = -1;
 
         /* Exit critical section */
         dkMutexUnlock(&app->appMutex);
 
         /* Block till timer or event or interrupt */
-        nfds = select(maxfds + 1, &readfds, &writefds, &exceptfds, &delta);
+        nfds = dtkDrvWaitInputs(app, interval);
 
         /* Enter critical section */
         dkMutexLock(&app->appMutex);
@@ -2194,7 +4565,7 @@ int dtkDrvGetNextEvent(App *app, XEvent *ev, int blocking)
         dkMutexUnlock(&app->appMutex);
 
         /* Block until something happens */
-        nfds = select(maxfds + 1, &readfds, &writefds, &exceptfds, NULL);
+        nfds = dtkDrvWaitInputs(app, -1);
 
         /* Enter critical section */
         dkMutexLock(&app->appMutex);
@@ -2209,57 +4580,31 @@ int dtkDrvGetNextEvent(App *app, XEvent *ev, int blocking)
 			return 0;
 		}
 
-		/* Any other file descriptors set? */
-		if (app->maxinput >= 0) {
-			/* We need to handle this */
-			printf("We need to handle this\n");
-		}
-
-		/* If there is no event, we're done */
-		if (!app->display_opened || !FD_ISSET(ConnectionNumber((Display*)app->display), &readfds) ||
-		    !XEventsQueued((Display*)app->display, QueuedAfterReading))
+		/* Dispatch other file descriptors; if there is no event, we're done */
+		if (!dtkDrvDispatchInputs(app) || !XEventsQueued((Display*)app->display, QueuedAfterReading))
 			return 0;
 
 	}
 
-	/* Get an event */
-	XNextEvent(app->display, ev);
+	/* Get an event, reading and compressing a new batch if needed;
+	 * everything may have been folded into the damage */
+	if (app->batchhead == app->nbatch && !dtkDrvFillBatch(app, FALSE))
+		return 0;
+	*ev = ((XEvent*)app->batch)[app->batchhead];
 
-	/* Compress some common events */
-	/* Compress motion events */
+	/* Motion comes with the samples folded into it, or may have to be
+	 * asked for */
 	if (ev->xany.type == MotionNotify) {
-		while (XPending((Display*)app->display)) {
-			XPeekEvent((Display*)app->display, &e);
-			if ((e.xany.type != MotionNotify) || (ev->xmotion.window != e.xmotion.window) ||
-			    (ev->xmotion.state != e.xmotion.state)) break;
-			XNextEvent((Display*)app->display, ev);
-		}
-	}
-
-	/* Compress wheel events */
-	else if ((ev->xany.type == ButtonPress) && (ev->xbutton.button == Button4 || ev->xbutton.button == Button5)) {
-		int ticks = 1;
-		while (XPending((Display*)app->display)) {
-			XPeekEvent((Display*)app->display, &e);
-			if ((e.xany.type != ButtonPress && e.xany.type != ButtonRelease) ||
-			    (ev->xany.window != e.xany.window) || (ev->xbutton.button != e.xbutton.button)) break;
-			ticks += (e.xany.type == ButtonPress);
-			XNextEvent((Display*)app->display, ev);
-		}
-		ev->xbutton.subwindow = (Window)ticks;   // Stick it here for later
+		struct dkFold *fold = &((struct dkFold *)app->folds)[app->batchhead];
+		app->event.samples = (struct dkMotionSample *)app->samples + fold->first;
+		app->event.nsamples = fold->count;
+		if (ev->xmotion.is_hint == NotifyHint) dtkDrvQueryMotion(app, ev);
 	}
+	app->batchhead++;
 
-	/* Compress configure events */
-	else if (ev->xany.type == ConfigureNotify) {
-		while (XCheckTypedWindowEvent((Display*)app->display, ev->xconfigure.window, ConfigureNotify, &e)) {
-			ev->xconfigure.width = e.xconfigure.width;
-			ev->xconfigure.height = e.xconfigure.height;
-			if (e.xconfigure.send_event) {
-				ev->xconfigure.x = e.xconfigure.x;
-				ev->xconfigure.y = e.xconfigure.y;
-			}
-		}
-	}
+	/* Record it */
+	if (app->recorder)
+		dtkDrvRecordEvent(app, ev);
 
 	/* Regular event */
 	return 1;
@@ -2268,10 +4613,37 @@ int dtkDrvGetNextEvent(App *app, XEvent *ev, int blocking)
 int
 dtkDrvRunOneEvent(App *app, int blocking)
 {
+	struct dkObject *window = NULL;
 	XEvent event;
+	DKlong start;
 
 	if (dtkDrvGetNextEvent(app, &event, blocking)) {
-		dtkDrvDispatchEvent(app, &event);
+
+		/* Number user input, so the damage it causes can be traced to the
+		 * flush of its paint */
+		app->event.serial = (dtkDrvIsUserInput(&event) || event.xany.type == MotionNotify) ? ++app->inputserial : 0;
+		if (app->stats) {
+			window = (struct dkObject *)DtkFindWindowWithId(event.xany.window);
+			start = dkThreadSteadyTime();
+			if (event.xany.type == KeyPress || event.xany.type == KeyRelease)
+				dkStatsInputDelay(app->stats, (DKuint)event.xkey.time, start);
+			else if (event.xany.type == ButtonPress || event.xany.type == ButtonRelease)
+				dkStatsInputDelay(app->stats, (DKuint)event.xbutton.time, start);
+			dtkDrvDispatchEvent(app, &event);
+			dkStatsAdd(app->stats, STAT_EVENT, event.xany.type, window, dkThreadSteadyTime() - start);
+		} else {
+			dtkDrvDispatchEvent(app, &event);
+		}
+
+		/* Painted the last of the damage from some user input; flushed
+		 * whether or not it is measured, so measuring does not change
+		 * the requests sent */
+		if (app->paintinput) {
+			if (app->display_opened) XFlush((Display*)app->display);
+			if (app->stats) dkStatsLatency(app->stats, window ? window->meta : NULL, app->painttime, dkThreadSteadyTime());
+		}
+		app->event.serial = 0;
+		app->paintinput = 0;
 		return 1;
 	}
 	return 0;
@@ -49,6 +49,10 @@
 #include "fxstring.h"
 #include "fxpoint.h"
 
+/* Most boxes of a damage region used for clipping; beyond that, a paint
+ * is clipped to the bounding box of the damage only */
+#define DK_MAXCLIPRECTS 64
+
 static void dkDCInit(struct dtkDC *dc, struct dkApp *app)
 {
   /* DC constructor */
@@ -461,6 +465,12 @@ dtkDrvDCBegin(struct dtkDC *dc, struct dkWindow *w)
 	dc->devbg = 0;
 	dc->ctx = dc->visual->gc;
 	dc->flags = 0;
+
+	/* With no display the DC keeps its state but draws nothing */
+	if (!dc->app->display_opened) {
+		dc->ctx = NULL;
+		return;
+	}
 #ifdef HAVE_XFT_H
 	dc->xftDraw = (void*)XftDrawCreate(dc->app->display, (Drawable)dc->surface->xid, (Visual*)dc->visual->visual,(Colormap)dc->visual->colormap);
 #endif
@@ -489,10 +499,29 @@ dtkDrvDCEventSetup(struct dtkDC *dc, struct dkWindow *w, struct dkEvent *event)
 	dc->rect.y = dc->clip.y = event->rect.y;
 	dc->rect.w = dc->clip.w = event->rect.w;
 	dc->rect.h = dc->clip.h = event->rect.h;
-	XSetClipRectangles(w->app->display, (GC)dc->ctx, 0, 0, (XRectangle*)&dc->clip, 1, Unsorted);
+	if (!dc->ctx) return;
+
+	/* Clip to the exact damage if there is a region; its boxes are
+	 * already in the order X calls YXBanded */
+	if (event->region && 1 < event->region->numRects && event->region->numRects <= DK_MAXCLIPRECTS) {
+		XRectangle rects[DK_MAXCLIPRECTS];
+		int i;
+		for (i = 0; i < event->region->numRects; i++) {
+			rects[i].x = event->region->rects[i].x1;
+			rects[i].y = event->region->rects[i].y1;
+			rects[i].width = event->region->rects[i].x2 - event->region->rects[i].x1;
+			rects[i].height = event->region->rects[i].y2 - event->region->rects[i].y1;
+		}
+		XSetClipRectangles(w->app->display, (GC)dc->ctx, 0, 0, rects, event->region->numRects, YXBanded);
 #ifdef HAVE_XFT_H
-	XftDrawSetClipRectangles((XftDraw*)dc->xftDraw, 0, 0, (XRectangle*)&dc->clip,1);
+		XftDrawSetClipRectangles((XftDraw*)dc->xftDraw, 0, 0, rects, event->region->numRects);
 #endif
+	} else {
+		XSetClipRectangles(w->app->display, (GC)dc->ctx, 0, 0, (XRectangle*)&dc->clip, 1, Unsorted);
+#ifdef HAVE_XFT_H
+		XftDrawSetClipRectangles((XftDraw*)dc->xftDraw, 0, 0, (XRectangle*)&dc->clip,1);
+#endif
+	}
 	dc->flags |= GCClipMask;
 }
 
@@ -503,7 +532,7 @@ dkDCEnd(struct dtkDC *dc)
 	Display *disp = dc->app->display;
 
 	flags = dc->flags;
-	if (dc->flags) {
+	if (dc->flags && dc->ctx) {
 		XGCValues gcv;
 		if (flags & GCFunction) gcv.function = BLT_SRC;
 		if (flags & GCForeground) gcv.foreground = BlackPixel(disp, DefaultScreen(disp));
@@ -541,9 +570,10 @@ dtkDrvDCSetForeground(struct dtkDC *dc, unsigned int clr)
 {
 	if(!dc->surface){ printf("FXDCWindow::setForeground: DC not connected to drawable.\n"); }
 	dc->devfg = dtkDrvVisualGetPixel(dc->visual, clr);
+	dc->fg = clr;
+	if (!dc->ctx) return;
 	XSetForeground(dc->app->display, (GC)dc->ctx, dc->devfg);
 	dc->flags |= GCForeground;
-	dc->fg = clr;
 }
 
 /* Set background color */
@@ -551,9 +581,10 @@ void dkDCSetBackground(struct dtkDC *dc, DKColor clr)
 {
   if (!dc->surface) { dkerror("FXDCWindow::setBackground: DC not connected to drawable.\n"); }
   dc->devbg = dtkDrvVisualGetPixel(dc->visual, clr);
+  dc->bg = clr;
+  if (!dc->ctx) return;
   XSetBackground(dc->app->display, (GC)dc->ctx, dc->devbg);
   dc->flags |= GCBackground;
-  dc->bg = clr;
 }
 
 void dkDCSetClipRectangle(struct dtkDC *dc, int x, int y, int w, int h)
@@ -567,6 +598,7 @@ void dkDCSetClipRectangle(struct dtkDC *dc, int x, int y, int w, int h)
   dc->clip.h = FXMIN(y + h, dc->rect.y + dc->rect.h) - dc->clip.y;
   if (dc->clip.w <= 0) dc->clip.w = 0;
   if (dc->clip.h <= 0) dc->clip.h = 0;
+  if (!dc->ctx) return;
 
   XSetClipRectangles(dc->app->display, (GC)dc->ctx, 0, 0, (XRectangle *)&dc->clip, 1, Unsorted);
 #ifdef HAVE_XFT_H
@@ -579,12 +611,14 @@ void
 dtkDrvDCFillRectangle(struct dtkDC *dc, int x, int y, int w, int h)
 {
 	if(!dc->surface){ printf("FXDCWindow::fillRectangle: DC not connected to drawable.\n"); }
+	if (!dc->ctx) return;
 	XFillRectangle(dc->app->display, dc->surface->xid, (GC)dc->ctx, x, y, w, h);
 }
 
 void dkDCDrawRectangle(struct dtkDC *dc, int x, int y, int w, int h)
 {
   if (!dc->surface) { dkerror("FXDCWindow::drawRectangle: DC not connected to drawable.\n"); }
+  if (!dc->ctx) return;
   XDrawRectangle(dc->app->display, dc->surface->xid, (GC)dc->ctx, x, y, w, h);
 }
 
@@ -597,11 +631,12 @@ void dkDCWindowSetFont(struct dtkDC *dc, struct dkFont *fnt)
 	if (!fnt || !fnt->xid) {
 		printf("%s: illegal or NULL font specified.\n", __func__);
 	}
+	dc->font = fnt;
 #ifndef HAVE_XFT_H
+	if (!dc->ctx) return;
 	XSetFont(dc->app->display, (GC)dc->ctx, fnt->xid);
 	dc->flags |= GCFont;
 #endif
-	dc->font = fnt;
 }
 
 /* Draw string with base line starting at x, y */
@@ -616,6 +651,7 @@ void dkDCDrawText(struct dtkDC *dc, int x, int y, char *string, DKuint length)
 	if (!dc->font) {
 		printf("%s: no font selected.\n", __func__);
 	}
+	if (!dc->ctx) return;
 #ifdef HAVE_XFT_H
 	color.pixel = dc->devfg;
 	color.color.red = FXREDVAL(dc->fg) * 257;
@@ -631,6 +667,7 @@ void dkDCDrawText(struct dtkDC *dc, int x, int y, char *string, DKuint length)
 void dkDCFillPolygon(struct dtkDC *dc, struct dkPoint *points, DKuint npoints)
 {
   if (!dc->surface) { dkerror("FXDCWindow::fillArcs: DC not connected to drawable.\n"); }
+  if (!dc->ctx) return;
   XFillPolygon(dc->app->display, dc->surface->xid, (GC)dc->ctx, (XPoint*)points, npoints, Convex, CoordModeOrigin);
 }
 
@@ -639,6 +676,7 @@ void dkDCDrawFocusRectangle(struct dtkDC *dc, int x, int y, int w, int h)
   XGCValues gcv;
 
   if (!dc->surface) { dkerror("dkDC::drawFocusRectangle: DC not connected to drawable.\n"); }
+  if (!dc->ctx) return;
   gcv.stipple = dc->app->stipples[STIPPLE_GRAY];
   gcv.fill_style = FILL_STIPPLED;
   gcv.background = 0;
@@ -668,26 +706,28 @@ void dkDC_setStipplePat(struct dtkDC *dc, enum DKStipplePattern pat, int dx, int
 
   if (!dc->surface) { dkerror("dkDC::setStipple: DC not connected to drawable.\n"); }
   if (pat > STIPPLE_CROSSDIAG) pat = STIPPLE_CROSSDIAG;
+  dc->stipple = NULL;
+  dc->pattern = pat;
+  dc->tx = dx;
+  dc->ty = dy;
+  if (!dc->ctx) return;
   gcv.stipple = dc->app->stipples[pat];
   gcv.ts_x_origin = dx;
   gcv.ts_y_origin = dy;
   XChangeGC(dc->app->display, (GC)dc->ctx, GCTileStipXOrigin | GCTileStipYOrigin | GCStipple, &gcv);
   if (dx) dc->flags |= GCTileStipXOrigin;
   if (dy) dc->flags |= GCTileStipYOrigin;
-  dc->stipple = NULL;
-  dc->pattern = pat;
   dc->flags |= GCStipple;
-  dc->tx = dx;
-  dc->ty = dy;
 }
 
 /* Set fill style */
 void dkDC_setFillStyle(struct dtkDC *dc, enum DKFillStyle fillstyle)
 {
   if (!dc->surface) { dkerror("dkDCWindow::setFillStyle: DC not connected to drawable.\n"); }
+  dc->fill = fillstyle;
+  if (!dc->ctx) return;
   XSetFillStyle(dc->app->display, (GC)dc->ctx, fillstyle);
   dc->flags |= GCFillStyle;
-  dc->fill = fillstyle;
 }
 
 #endif
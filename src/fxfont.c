@@ -56,6 +56,8 @@ dkFontNew(struct dkApp *app, char *name)
 
 	f->xid = 0;
 	f->app = app;
+	f->font = NULL;
+	f->actualName = NULL;
 
 	dkFont_setFont(f, name);
 
@@ -202,11 +204,29 @@ static void *dkFontMatch(struct dkFont *f, char *wantfamily, char *wantforge, DK
 
 #endif
 
+/* Fonts not backed by a real font, as when running headless, measure
+ * as fixed cells sized from the wanted size at 96 dpi */
+static int dkFontNullHeight(struct dkFont *f)
+{
+  return FXMAX((f->wantedSize ? f->wantedSize : 90) * 96 / 720, 1);
+}
+
+static int dkFontNullWidth(struct dkFont *f)
+{
+  return (dkFontNullHeight(f) + 1) / 2;
+}
+
 void dkFontCreate(struct dkFont *f)
 {
   if (f->xid)
     return;
 
+  /* Headless; the id only marks the font as created */
+  if (f->app->headless) {
+    f->xid = (DKID)1;
+    return;
+  }
+
 #if defined(WIN32)              ///// WIN32 /////
 	f->font = dkFontMatch(f, f->wantedName, NULL, f->wantedSize, f->wantedWeight, 100);
 #elif defined(HAVE_XFT_H)       ///// XFT /////
@@ -249,7 +269,7 @@ int dkFontGetFontWidth(struct dkFont *f)
     return ((XFontStruct*)f->font)->max_bounds.width;
 #endif
   }
-  return 1;
+  return dkFontNullWidth(f);
 }
 
 /* Get font height */
@@ -264,7 +284,7 @@ int dkFontGetFontHeight(struct dkFont *f)
     return ((XFontStruct *)f->font)->ascent + ((XFontStruct *)f->font)->descent;
 #endif
   }
-  return 1;
+  return dkFontNullHeight(f);
 }
 
 /* Calculate width of single wide character in this font */
@@ -290,12 +310,14 @@ int dkFontGetCharWidth(struct dkFont *f, DKwchar ch)
 #else                           ///// XLFD /////
 #endif
   }
-  return 1;
+  return dkFontNullWidth(f);
 }
 
 /* Text width */
 int dkFontGetTextWidth(struct dkFont *f, char *string, DKuint length)
 {
+	DKuint i, n;
+
 	if (!string && length) {
 		printf("%s: NULL string argument\n", __func__);
 	}
@@ -317,7 +339,10 @@ int dkFontGetTextWidth(struct dkFont *f, char *string, DKuint length)
 #else                           ///// XLFD /////
 #endif
 	}
-	return length;
+	for (i = n = 0; i < length; i++) {
+		if ((string[i] & 0xC0) != 0x80) n++;
+	}
+	return n * dkFontNullWidth(f);
 }
 
 /* Text height */
@@ -334,7 +359,7 @@ int dkFontGetTextHeight(struct dkFont *f, char *string, DKuint length)
 #else                           ///// XLFD /////
 #endif
 	}
-	return 1;
+	return dkFontNullHeight(f);
 }
 
 /* Get font ascent */
@@ -349,7 +374,7 @@ int dkFontGetFontAscent(struct dkFont *f)
     return ((XFontStruct*)f->font)->ascent;
 #endif
 	}
-	return 1;
+	return dkFontNullHeight(f) - dkFontNullHeight(f) / 4;
 }
 
 void dkFontSetDesc(struct dkFont *f, struct dkFontDesc *fontdesc)
@@ -46,7 +46,7 @@
 */
 
 #define HASH1(x,m) (((unsigned int)((Duval)(x)^(((Duval)(x))>>13)))&((m)-1))
-#define HASH2(x,m) (((unsigned int)((Duval)(x)^((((Duval)(x))>>17)|1)))&((m)-1))
+#define HASH2(x,m) ((((unsigned int)((Duval)(x)^(((Duval)(x))>>17)))&((m)-1))|1)
 
 
 struct dtkEntry {
@@ -229,3 +229,143 @@ DtkHashClear(struct dtkHash *h)
 	h->free = 2;
 }
 
+
+/*
+  Notes:
+  - The selector hash maps a (target, message) pair to a record, which is
+    what the timer and chore queues need to coalesce requests.
+  - Keys may be NULL here, so a slot is free when its value is NULL and
+    empty when its value is -1; values themselves must not be NULL.
+*/
+
+#define SELHASH(k,s) ((unsigned int)((Duval)(k)^(((Duval)(k))>>13))^((unsigned int)(s)*0x9E3779B1U))
+#define SELHASH1(h,m) ((h)&((m)-1))
+#define SELHASH2(h,m) ((((h)>>16)|1)&((m)-1))
+
+struct dtkSelEntry {
+	void *key;
+	DKSelector sel;
+	void *value;
+};
+
+/* Make empty table */
+struct dtkSelHash *
+DtkSelHashNew(void)
+{
+	struct dtkSelHash *h;
+
+	h = fx_alloc(sizeof(struct dtkSelHash));
+	h->table = calloc(sizeof(struct dtkSelEntry), 2);
+	h->total = 2;
+	h->used = 0;
+	h->free = 2;
+
+	return h;
+}
+
+/* Destroy table */
+void
+DtkSelHashFree(struct dtkSelHash *h)
+{
+	free(h->table);
+	free(h);
+}
+
+/* Resize hash table, and rehash old stuff into it */
+void
+DtkSelHashResize(struct dtkSelHash *h, unsigned int m)
+{
+	unsigned int q, x, i, k;
+	struct dtkSelEntry *newtable;
+	newtable = calloc(sizeof(struct dtkSelEntry), m);
+	for (i = 0; i < h->total; i++) {
+		if (h->table[i].value == NULL || h->table[i].value == (void*)-1L) continue;
+		k = SELHASH(h->table[i].key, h->table[i].sel);
+		q = SELHASH1(k, m);
+		x = SELHASH2(k, m);
+		while (newtable[q].value)
+			q = (q + x) & (m-1);
+		newtable[q] = h->table[i];
+	}
+	free(h->table);
+	h->table = newtable;
+	h->total = m;
+	h->free = m - h->used;
+}
+
+/* Replace key in the table */
+void *
+DtkSelHashReplace(struct dtkSelHash *h, void *key, DKSelector sel, void *value)
+{
+	unsigned int p, q, x, k;
+
+	if (value) {
+		if ((h->free << 1) <= h->total)
+			DtkSelHashResize(h, h->total << 1);
+		k = SELHASH(key, sel);
+		p = SELHASH1(k, h->total);
+		x = SELHASH2(k, h->total);
+		q = p;
+		while (h->table[q].value) {
+			if (h->table[q].key == key && h->table[q].sel == sel && h->table[q].value != (void*)-1L) goto y;
+			q = (q + x) & (h->total - 1);
+		}
+		q = p;
+		while (h->table[q].value) {
+			if (h->table[q].value == (void*)-1L) goto x;    // Put it in empty slot
+			q = (q + x) & (h->total - 1);
+		}
+		h->free--;
+x:
+		h->used++;
+		h->table[q].key = key;
+		h->table[q].sel = sel;
+y:
+		h->table[q].value = value;
+		return h->table[q].value;
+	}
+	return NULL;
+}
+
+/* Remove association from the table */
+void *
+DtkSelHashRemove(struct dtkSelHash *h, void *key, DKSelector sel)
+{
+	unsigned int q, x, k;
+	void *val;
+
+	k = SELHASH(key, sel);
+	q = SELHASH1(k, h->total);
+	x = SELHASH2(k, h->total);
+	for (;;) {
+		if (h->table[q].value == NULL)
+			return NULL;
+		if (h->table[q].value != (void*)-1L && h->table[q].key == key && h->table[q].sel == sel)
+			break;
+		q = (q + x) & (h->total - 1);
+	}
+	val = h->table[q].value;
+	h->table[q].key = NULL;
+	h->table[q].value = (void*)-1L;                // Empty but not free
+	h->used--;
+	if (h->used < (h->total >> 2))
+		DtkSelHashResize(h, h->total >> 1);
+	return val;
+}
+
+/* Return record associated with key and sel, if any */
+void *
+DtkSelHashFind(struct dtkSelHash *h, void *key, DKSelector sel)
+{
+	unsigned int q, x, k;
+
+	k = SELHASH(key, sel);
+	q = SELHASH1(k, h->total);
+	x = SELHASH2(k, h->total);
+	while (h->table[q].value) {
+		if (h->table[q].value != (void*)-1L && h->table[q].key == key && h->table[q].sel == sel)
+			return h->table[q].value;
+		q = (q + x) & (h->total - 1);
+	}
+	return NULL;
+}
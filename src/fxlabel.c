@@ -83,7 +83,7 @@ dkLabelNew(struct dkWindow *p, char *title)
 void dkLabelInit(struct dkLabel *pthis, struct dkWindow *p, char *title, DKuint opts)
 {
   DtkFrameInit((struct dkFrame *)pthis, p, opts, 0, 0, 0, 0, DEFAULT_PAD, DEFAULT_PAD, DEFAULT_PAD, DEFAULT_PAD);
-  ((struct dkWindow *)pthis)->flags |= FLAG_ENABLED;
+  ((struct dkWindow *)pthis)->flags |= FLAG_ENABLED | FLAG_MOTIONHINT;    /* Motion only matters for hovering */
   pthis->label = fx_stripHotKey(title);
   pthis->font = ((struct dkWindow *)pthis)->app->normalFont;
   pthis->textColor = ((struct dkWindow *)pthis)->app->foreColor;
@@ -0,0 +1,99 @@
+/******************************************************************************
+ *                                                                            *
+ *                   N u l l   D i s p l a y   D r i v e r                    *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fxapp.h"
+#include "fxdrv.h"
+#include "fxkeys.h"
+#include "fxwindow.h"
+
+/*
+  Notes:
+  - A headless application, started with -headless or with DK_HEADLESS
+    set in the environment, never opens a display; display_opened stays
+    0, so visuals, cursors and window manager hints are skipped as they
+    would be before the display is opened.
+  - Windows get ids of their own and go into the window table like real
+    ones, so layout, damage, painting and dispatch run unchanged.  What
+    the server would do is done here: showing or resizing a window
+    exposes it and its shown children.
+  - DCs have no context and drop what is drawn; fonts without a server
+    font measure as fixed cells derived from the wanted size, so results
+    are the same from run to run and from one machine to the next.
+  - Events come from replaying a recording.  Key events carry the keysym
+    the recording holds in place of a keycode.
+*/
+
+/* Size of the null root window */
+#define NULL_ROOT_WIDTH  1280
+#define NULL_ROOT_HEIGHT 1024
+
+/* Last window id handed out */
+static Duval nullids;
+
+
+/* Make root window */
+void dtkNullCreateRoot(struct dkWindow *w)
+{
+  w->xid = (DKID)++nullids;
+  w->width = NULL_ROOT_WIDTH;
+  w->height = NULL_ROOT_HEIGHT;
+}
+
+/* Make window */
+void dtkNullCreateWindow(struct dkWindow *w)
+{
+  if (!w->parent->xid) {
+    printf("Error: %s: trying to create window before creating parent window.\n", __func__);
+  }
+  w->xid = (DKID)++nullids;
+  DtkWindowHashInsert((void *)w->xid, w);
+  dtkNullExpose(w);
+}
+
+/* Damage window and its shown children if they can be seen */
+void dtkNullExpose(struct dkWindow *w)
+{
+  struct dkWindow *p, *c;
+
+  for (p = w; p; p = p->parent) {
+    if (!(p->flags & FLAG_SHOWN) || !p->xid) return;
+  }
+  if (w->width <= 0 || w->height <= 0) return;
+  dkAppAddRepaint(w->app, w->xid, 0, 0, w->width, w->height, 0);
+  for (c = w->first; c; c = c->next) {
+    dtkNullExpose(c);
+  }
+}
+
+/* Keysym for key event; the shift and caps lock modifiers are applied
+ * to letters, which is all a server would do for text editing */
+DKuint dtkNullKeysym(DKuint sym, DKuint state)
+{
+  DKbool upper = ((state & SHIFTMASK) != 0) != ((state & CAPSLOCKMASK) != 0);
+
+  if (upper) {
+    if (KEY_a <= sym && sym <= KEY_z) return sym - KEY_a + KEY_A;
+    if (KEY_agrave <= sym && sym <= KEY_thorn && sym != KEY_division) return sym - KEY_agrave + KEY_Agrave;
+  }
+  return sym;
+}
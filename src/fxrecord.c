@@ -0,0 +1,310 @@
+/******************************************************************************
+ *                                                                            *
+ *                E v e n t   R e c o r d   a n d   R e p l a y               *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fxrecord.h"
+#include "fxthread.h"
+#include "fxwindow.h"
+
+/*
+  Notes:
+  - A recording is a short header followed by records of variable length
+    integers, so a typical input event takes 10 to 20 bytes.  Times and
+    server times are stored relative to the previous record.
+  - Each record starts with its type and the time since the previous
+    record in microseconds; a timer firing then has its message, and an
+    event its window path, flags, positions, size, state, detail and
+    server time.
+  - The replayer measures latency from when an event was due to when the
+    event loop next runs out of work with no damage left to paint, so it
+    includes the updates and painting the event caused.
+*/
+
+static const char magic[8] = { 'D', 'K', 'R', 'E', 'C', 0, 0, 1 };
+
+
+/* Write unsigned variable length integer */
+static void dkRecPut(FILE *fp, DKulong v)
+{
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, fp);
+    v >>= 7;
+  }
+  putc((int)v, fp);
+}
+
+/* Write signed variable length integer */
+static void dkRecPutSigned(FILE *fp, DKlong v)
+{
+  dkRecPut(fp, v < 0 ? ((DKulong)~v << 1) | 1 : (DKulong)v << 1);
+}
+
+/* Read unsigned variable length integer; FALSE at end of file */
+static DKbool dkRecGet(FILE *fp, DKulong *v)
+{
+  int c, shift = 0;
+
+  *v = 0;
+  do {
+    if ((c = getc(fp)) == EOF || shift > 63) return FALSE;
+    *v |= (DKulong)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return TRUE;
+}
+
+/* Read signed variable length integer */
+static DKbool dkRecGetSigned(FILE *fp, DKlong *v)
+{
+  DKulong u;
+
+  if (!dkRecGet(fp, &u)) return FALSE;
+  *v = (u & 1) ? (DKlong)~(u >> 1) : (DKlong)(u >> 1);
+  return TRUE;
+}
+
+/* Find path of window keys from the root to window */
+int dkRecordWindowPath(struct dkWindow *window, DKuint *path)
+{
+  struct dkWindow *w;
+  int depth = 0, i;
+
+  for (w = window; w && w->parent; w = w->parent) depth++;
+  if (depth > DK_RECDEPTH) return -1;
+  for (w = window, i = depth; i > 0; w = w->parent) path[--i] = w->wk;
+  return depth;
+}
+
+/* Find window with path of window keys under root */
+struct dkWindow *dkRecordFindWindow(struct dkWindow *root, const DKuint *path, int depth)
+{
+  struct dkWindow *w = root;
+  int i;
+
+  for (i = 0; w && i < depth; i++) {
+    for (w = w->first; w && w->wk != path[i]; w = w->next) { }
+  }
+  return w;
+}
+
+/* Start recording to file */
+struct dkRecorder *dkRecorderNew(const char *filename)
+{
+  struct dkRecorder *rec;
+  FILE *fp;
+
+  if ((fp = fopen(filename, "wb")) == NULL) return NULL;
+  if ((rec = calloc(1, sizeof(struct dkRecorder))) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  fwrite(magic, 1, sizeof(magic), fp);
+  rec->fp = fp;
+  rec->started = rec->last = dkThreadSteadyTime();
+  return rec;
+}
+
+/* Stop recording */
+void dkRecorderDel(struct dkRecorder *rec)
+{
+  fclose(rec->fp);
+  free(rec);
+}
+
+/* Write type and time of record */
+static void dkRecorderStart(struct dkRecorder *rec, int type, DKlong now)
+{
+  dkRecPut(rec->fp, (DKulong)type);
+  dkRecPut(rec->fp, (DKulong)((now - rec->last) / 1000));
+  rec->last += ((now - rec->last) / 1000) * 1000;
+  rec->count++;
+}
+
+/* Write event */
+void dkRecorderWrite(struct dkRecorder *rec, struct dkRecEvent *ev)
+{
+  DKlong now = dkThreadSteadyTime();
+  int i;
+
+  ev->when = now - rec->started;
+  dkRecorderStart(rec, ev->type, now);
+  dkRecPut(rec->fp, (DKulong)ev->depth);
+  for (i = 0; i < ev->depth; i++) dkRecPut(rec->fp, ev->path[i]);
+  dkRecPut(rec->fp, (DKulong)(ev->synthetic != 0));
+  dkRecPutSigned(rec->fp, ev->x);
+  dkRecPutSigned(rec->fp, ev->y);
+  dkRecPutSigned(rec->fp, ev->x_root);
+  dkRecPutSigned(rec->fp, ev->y_root);
+  dkRecPut(rec->fp, (DKulong)FXMAX(ev->width, 0));
+  dkRecPut(rec->fp, (DKulong)FXMAX(ev->height, 0));
+  dkRecPut(rec->fp, ev->state);
+  dkRecPut(rec->fp, ev->detail);
+  dkRecPutSigned(rec->fp, (int)(ev->time - rec->lasttime));
+  rec->lasttime = ev->time;
+}
+
+/* Write timer firing */
+void dkRecorderTimer(struct dkRecorder *rec, DKuint message)
+{
+  dkRecorderStart(rec, REC_TIMER, dkThreadSteadyTime());
+  dkRecPut(rec->fp, message);
+}
+
+/* Open recording for replay */
+struct dkReplayer *dkReplayerNew(const char *filename, double speed, DKbool quit)
+{
+  struct dkReplayer *rp;
+  char buf[sizeof(magic)];
+  FILE *fp;
+
+  if ((fp = fopen(filename, "rb")) == NULL) return NULL;
+  if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) || memcmp(buf, magic, sizeof(magic)) != 0 ||
+      (rp = calloc(1, sizeof(struct dkReplayer))) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  rp->fp = fp;
+  rp->speed = speed > 0.0 ? speed : 0.0;
+  rp->quit = quit;
+  return rp;
+}
+
+/* Close recording */
+void dkReplayerDel(struct dkReplayer *rp)
+{
+  fclose(rp->fp);
+  free(rp);
+}
+
+/* Read one record; FALSE at end of recording or if it is damaged */
+static DKbool dkReplayerRead(struct dkReplayer *rp, struct dkRecEvent *ev)
+{
+  DKulong type, delta, depth, synthetic, width, height, state, detail, key;
+  DKlong x, y, x_root, y_root, time;
+  int i;
+
+  if (!dkRecGet(rp->fp, &type) || !dkRecGet(rp->fp, &delta)) return FALSE;
+  rp->last += (DKlong)delta * 1000;
+  ev->type = (int)type;
+  ev->when = rp->last;
+  if (type == REC_TIMER) {
+    if (!dkRecGet(rp->fp, &detail)) return FALSE;
+    ev->detail = (DKuint)detail;
+    return TRUE;
+  }
+  if (!dkRecGet(rp->fp, &depth) || depth > DK_RECDEPTH) return FALSE;
+  for (i = 0; i < (int)depth; i++) {
+    if (!dkRecGet(rp->fp, &key)) return FALSE;
+    ev->path[i] = (DKuint)key;
+  }
+  if (!dkRecGet(rp->fp, &synthetic) ||
+      !dkRecGetSigned(rp->fp, &x) || !dkRecGetSigned(rp->fp, &y) ||
+      !dkRecGetSigned(rp->fp, &x_root) || !dkRecGetSigned(rp->fp, &y_root) ||
+      !dkRecGet(rp->fp, &width) || !dkRecGet(rp->fp, &height) ||
+      !dkRecGet(rp->fp, &state) || !dkRecGet(rp->fp, &detail) ||
+      !dkRecGetSigned(rp->fp, &time)) return FALSE;
+  ev->depth = (int)depth;
+  ev->synthetic = (int)synthetic;
+  ev->x = (int)x;
+  ev->y = (int)y;
+  ev->x_root = (int)x_root;
+  ev->y_root = (int)y_root;
+  ev->width = (int)width;
+  ev->height = (int)height;
+  ev->state = (DKuint)state;
+  ev->detail = (DKuint)detail;
+  ev->time = rp->lasttime + (DKuint)time;
+  rp->lasttime = ev->time;
+  return TRUE;
+}
+
+/* Next event to replay */
+const struct dkRecEvent *dkReplayerPeek(struct dkReplayer *rp)
+{
+  while (!rp->havenext) {
+    if (!dkReplayerRead(rp, &rp->next)) return NULL;
+    if (rp->next.type == REC_TIMER) {
+      rp->timers++;
+      continue;
+    }
+    rp->havenext = TRUE;
+  }
+  return &rp->next;
+}
+
+/* When next event is due; the clock starts with the first event */
+DKlong dkReplayerDue(struct dkReplayer *rp)
+{
+  if (!rp->started) rp->started = dkThreadSteadyTime();
+  if (rp->speed == 0.0 || !dkReplayerPeek(rp)) return 0;
+  return rp->started + (DKlong)(rp->next.when / rp->speed);
+}
+
+/* Move on to the following event */
+void dkReplayerNext(struct dkReplayer *rp, DKbool injected)
+{
+  DKlong now, due;
+
+  if (injected) {
+    now = dkThreadSteadyTime();
+    due = dkReplayerDue(rp);
+    dkReplayerSettle(rp, now, TRUE);
+    rp->pending = (due && due < now) ? due : now;
+    rp->injected++;
+  } else {
+    rp->skipped++;
+  }
+  rp->havenext = FALSE;
+}
+
+/* Event being handled has settled; a widget that keeps damaging itself
+ * or adding chores would otherwise hold up the replay for good */
+DKbool dkReplayerSettle(struct dkReplayer *rp, DKlong now, DKbool idle)
+{
+  if (rp->pending && (idle || now - rp->pending >= DK_REPLAYSETTLE)) {
+    dkStatHistAdd(&rp->latency, now - rp->pending);
+    if (!idle) rp->unsettled++;
+    rp->pending = 0;
+  }
+  return !rp->pending;
+}
+
+/* Print throughput and latency */
+void dkReplayerReport(struct dkReplayer *rp, FILE *fp)
+{
+  const struct dkStatHist *h = &rp->latency;
+  double elapsed = rp->started ? (dkThreadSteadyTime() - rp->started) / 1e9 : 0.0;
+
+  fprintf(fp, "Replayed %lu events (%lu skipped) in %.3fs: %.1f events/s\n",
+      (unsigned long)rp->injected, (unsigned long)rp->skipped, elapsed,
+      elapsed > 0.0 ? rp->injected / elapsed : 0.0);
+  fprintf(fp, "Timer firings: %lu recorded, %lu replayed\n", (unsigned long)rp->timers, (unsigned long)rp->fired);
+  if (rp->unsettled)
+    fprintf(fp, "Did not settle within %.0f ms: %lu events\n", DK_REPLAYSETTLE / 1e6, (unsigned long)rp->unsettled);
+  if (h->count) {
+    fprintf(fp, "Latency (us): mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+        h->total / 1e3 / h->count, dkStatHistPercentile(h, 0.5) / 1e3,
+        dkStatHistPercentile(h, 0.9) / 1e3, dkStatHistPercentile(h, 0.99) / 1e3, h->max / 1e3);
+  }
+  fflush(fp);
+}
@@ -0,0 +1,455 @@
+/******************************************************************************
+ *                                                                            *
+ *                         R e g i o n    C l a s s                           *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "fxregion.h"
+
+/*
+  Notes:
+  - Set operations walk both operands band by band, the way the X server
+    does it: y ranges covered by only one operand are copied or dropped,
+    and y ranges covered by both are combined span by span.  Each output
+    band is merged with the previous one if their spans are the same, so
+    results are always in canonical form.
+  - All operations are linear in the number of boxes of the operands.
+  - Adding a rectangle below everything else just appends a band, which
+    is the common case when damage is accumulated top to bottom.
+*/
+
+/* Combines the boxes of two bands over y range y1,y2 into region */
+typedef DKbool (*dkBandOp)(struct dkRegion *r, const struct dkBox *r1, const struct dkBox *r1end,
+    const struct dkBox *r2, const struct dkBox *r2end, int y1, int y2);
+
+
+/* Initialize empty region */
+void dkRegionInit(struct dkRegion *r)
+{
+  r->extents.x1 = r->extents.y1 = r->extents.x2 = r->extents.y2 = 0;
+  r->rects = NULL;
+  r->numRects = 0;
+  r->size = 0;
+}
+
+/* Release storage */
+void dkRegionDestroy(struct dkRegion *r)
+{
+  free(r->rects);
+  dkRegionInit(r);
+}
+
+/* Make region empty */
+void dkRegionReset(struct dkRegion *r)
+{
+  r->extents.x1 = r->extents.y1 = r->extents.x2 = r->extents.y2 = 0;
+  r->numRects = 0;
+}
+
+/* Return true if empty */
+DKbool dkRegionEmpty(const struct dkRegion *r)
+{
+  return r->numRects == 0;
+}
+
+/* Make room for n more boxes */
+static DKbool dkRegionGrow(struct dkRegion *r, int n)
+{
+  struct dkBox *rects;
+  int size;
+
+  if (r->numRects + n <= r->size) return TRUE;
+  size = FXMAX(r->numRects + n, r->size * 2);
+  if (size < 8) size = 8;
+  if ((rects = realloc(r->rects, sizeof(struct dkBox) * size)) == NULL) return FALSE;
+  r->rects = rects;
+  r->size = size;
+  return TRUE;
+}
+
+/* Append box */
+static DKbool dkRegionAppend(struct dkRegion *r, int x1, int y1, int x2, int y2)
+{
+  struct dkBox *b;
+
+  if (r->numRects == r->size && !dkRegionGrow(r, 1)) return FALSE;
+  b = &r->rects[r->numRects++];
+  b->x1 = x1;
+  b->y1 = y1;
+  b->x2 = x2;
+  b->y2 = y2;
+  return TRUE;
+}
+
+/* Recompute bounding box */
+static void dkRegionSetExtents(struct dkRegion *r)
+{
+  int i;
+
+  if (r->numRects == 0) {
+    dkRegionReset(r);
+    return;
+  }
+  r->extents.x1 = r->rects[0].x1;
+  r->extents.y1 = r->rects[0].y1;
+  r->extents.x2 = r->rects[0].x2;
+  r->extents.y2 = r->rects[r->numRects - 1].y2;
+  for (i = 1; i < r->numRects; i++) {
+    if (r->rects[i].x1 < r->extents.x1) r->extents.x1 = r->rects[i].x1;
+    if (r->rects[i].x2 > r->extents.x2) r->extents.x2 = r->rects[i].x2;
+  }
+}
+
+/* Return end of band starting at b */
+static const struct dkBox *dkRegionBandEnd(const struct dkBox *b, const struct dkBox *end)
+{
+  int y1 = b->y1;
+  while (b != end && b->y1 == y1) b++;
+  return b;
+}
+
+/* Merge band starting at curband into the previous band at prevband if
+ * they touch and have the same spans; returns start of the last band */
+static int dkRegionCoalesce(struct dkRegion *r, int prevband, int curband)
+{
+  int n = r->numRects - curband;
+  int i;
+
+  if (n == 0) return prevband;
+  if (prevband < 0 || curband - prevband != n || r->rects[prevband].y2 != r->rects[curband].y1) return curband;
+  for (i = 0; i < n; i++) {
+    if (r->rects[prevband + i].x1 != r->rects[curband + i].x1) return curband;
+    if (r->rects[prevband + i].x2 != r->rects[curband + i].x2) return curband;
+  }
+  for (i = 0; i < n; i++) {
+    r->rects[prevband + i].y2 = r->rects[curband + i].y2;
+  }
+  r->numRects = curband;
+  return prevband;
+}
+
+/* Spans covered by either band */
+static DKbool dkRegionUnionBand(struct dkRegion *r, const struct dkBox *r1, const struct dkBox *r1end,
+    const struct dkBox *r2, const struct dkBox *r2end, int y1, int y2)
+{
+  const struct dkBox *b;
+  DKbool open = FALSE;
+  int x1 = 0, x2 = 0;
+
+  while (r1 != r1end || r2 != r2end) {
+    if (r2 == r2end || (r1 != r1end && r1->x1 < r2->x1)) b = r1++; else b = r2++;
+    if (open && b->x1 <= x2) {
+      if (b->x2 > x2) x2 = b->x2;
+      continue;
+    }
+    if (open && !dkRegionAppend(r, x1, y1, x2, y2)) return FALSE;
+    x1 = b->x1;
+    x2 = b->x2;
+    open = TRUE;
+  }
+  if (open && !dkRegionAppend(r, x1, y1, x2, y2)) return FALSE;
+  return TRUE;
+}
+
+/* Spans covered by the first band but not the second */
+static DKbool dkRegionSubtractBand(struct dkRegion *r, const struct dkBox *r1, const struct dkBox *r1end,
+    const struct dkBox *r2, const struct dkBox *r2end, int y1, int y2)
+{
+  int x1;
+
+  for (; r1 != r1end; r1++) {
+    x1 = r1->x1;
+    while (r2 != r2end && r2->x2 <= x1) r2++;
+    while (r2 != r2end && r2->x1 < r1->x2) {
+      if (r2->x1 > x1 && !dkRegionAppend(r, x1, y1, r2->x1, y2)) return FALSE;
+      x1 = r2->x2;
+      if (x1 >= r1->x2) break;
+      r2++;
+    }
+    if (x1 < r1->x2 && !dkRegionAppend(r, x1, y1, r1->x2, y2)) return FALSE;
+  }
+  return TRUE;
+}
+
+/* Spans covered by both bands */
+static DKbool dkRegionIntersectBand(struct dkRegion *r, const struct dkBox *r1, const struct dkBox *r1end,
+    const struct dkBox *r2, const struct dkBox *r2end, int y1, int y2)
+{
+  int x1, x2;
+
+  while (r1 != r1end && r2 != r2end) {
+    x1 = FXMAX(r1->x1, r2->x1);
+    x2 = FXMIN(r1->x2, r2->x2);
+    if (x1 < x2 && !dkRegionAppend(r, x1, y1, x2, y2)) return FALSE;
+    if (r1->x2 < r2->x2) {
+      r1++;
+    } else if (r2->x2 < r1->x2) {
+      r2++;
+    } else {
+      r1++;
+      r2++;
+    }
+  }
+  return TRUE;
+}
+
+/* Apply set operation to a and b, storing the result in dst; y ranges
+ * covered by only one operand are kept if keep1 or keep2 is set */
+static DKbool dkRegionOp(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b,
+    dkBandOp overlap, DKbool keep1, DKbool keep2)
+{
+  const struct dkBox *r1 = a->rects, *r1end = a->rects + a->numRects, *r1band;
+  const struct dkBox *r2 = b->rects, *r2end = b->rects + b->numRects, *r2band;
+  int ybot = INT_MIN, ytop, top, bot;
+  int prevband = -1, curband;
+  struct dkRegion res;
+
+  dkRegionInit(&res);
+  if (!dkRegionGrow(&res, a->numRects + b->numRects)) return FALSE;
+
+  if (r1 != r1end && r2 != r2end) ybot = FXMIN(r1->y1, r2->y1);
+  while (r1 != r1end && r2 != r2end) {
+    r1band = dkRegionBandEnd(r1, r1end);
+    r2band = dkRegionBandEnd(r2, r2end);
+
+    /* Part of a band above the other operand's band */
+    if (r1->y1 < r2->y1) {
+      top = FXMAX(r1->y1, ybot);
+      bot = FXMIN(r1->y2, r2->y1);
+      if (keep1 && top < bot) {
+        curband = res.numRects;
+        if (!dkRegionUnionBand(&res, r1, r1band, NULL, NULL, top, bot)) goto x;
+        prevband = dkRegionCoalesce(&res, prevband, curband);
+      }
+      ytop = r2->y1;
+    } else if (r2->y1 < r1->y1) {
+      top = FXMAX(r2->y1, ybot);
+      bot = FXMIN(r2->y2, r1->y1);
+      if (keep2 && top < bot) {
+        curband = res.numRects;
+        if (!dkRegionUnionBand(&res, r2, r2band, NULL, NULL, top, bot)) goto x;
+        prevband = dkRegionCoalesce(&res, prevband, curband);
+      }
+      ytop = r1->y1;
+    } else {
+      ytop = r1->y1;
+    }
+
+    /* Part where both bands overlap */
+    ybot = FXMIN(r1->y2, r2->y2);
+    if (ytop < ybot) {
+      curband = res.numRects;
+      if (!overlap(&res, r1, r1band, r2, r2band, ytop, ybot)) goto x;
+      prevband = dkRegionCoalesce(&res, prevband, curband);
+    }
+
+    /* Advance past bands which are done */
+    if (r1->y2 == ybot) r1 = r1band;
+    if (r2->y2 == ybot) r2 = r2band;
+  }
+
+  /* Remaining bands of either operand */
+  while (keep1 && r1 != r1end) {
+    r1band = dkRegionBandEnd(r1, r1end);
+    top = FXMAX(r1->y1, ybot);
+    curband = res.numRects;
+    if (!dkRegionUnionBand(&res, r1, r1band, NULL, NULL, top, r1->y2)) goto x;
+    prevband = dkRegionCoalesce(&res, prevband, curband);
+    r1 = r1band;
+  }
+  while (keep2 && r2 != r2end) {
+    r2band = dkRegionBandEnd(r2, r2end);
+    top = FXMAX(r2->y1, ybot);
+    curband = res.numRects;
+    if (!dkRegionUnionBand(&res, r2, r2band, NULL, NULL, top, r2->y2)) goto x;
+    prevband = dkRegionCoalesce(&res, prevband, curband);
+    r2 = r2band;
+  }
+
+  dkRegionSetExtents(&res);
+  free(dst->rects);
+  *dst = res;
+  return TRUE;
+x:
+  free(res.rects);
+  return FALSE;
+}
+
+/* Make region consisting of the single box x,y,w,h, without storage */
+static void dkRegionSetBox(struct dkRegion *r, struct dkBox *b, int x, int y, int w, int h)
+{
+  b->x1 = x;
+  b->y1 = y;
+  b->x2 = x + w;
+  b->y2 = y + h;
+  r->extents = *b;
+  r->rects = b;
+  r->numRects = 1;
+  r->size = 1;
+}
+
+/* Return true if extents of region r are inside rectangle x,y,w,h */
+static DKbool dkRegionInside(const struct dkRegion *r, int x, int y, int w, int h)
+{
+  return x <= r->extents.x1 && y <= r->extents.y1 && r->extents.x2 <= x + w && r->extents.y2 <= y + h;
+}
+
+/* Return true if extents of region r overlap rectangle x,y,w,h */
+static DKbool dkRegionTouches(const struct dkRegion *r, int x, int y, int w, int h)
+{
+  return x < r->extents.x2 && y < r->extents.y2 && r->extents.x1 < x + w && r->extents.y1 < y + h;
+}
+
+/* Return true if region overlaps rectangle */
+DKbool dkRegionOverlaps(const struct dkRegion *r, int x, int y, int w, int h)
+{
+  int i;
+
+  if (w <= 0 || h <= 0 || r->numRects == 0 || !dkRegionTouches(r, x, y, w, h)) return FALSE;
+  for (i = 0; i < r->numRects && r->rects[i].y1 < y + h; i++) {
+    if (y < r->rects[i].y2 && x < r->rects[i].x2 && r->rects[i].x1 < x + w) return TRUE;
+  }
+  return FALSE;
+}
+
+/* Move region */
+void dkRegionOffset(struct dkRegion *r, int dx, int dy)
+{
+  int i;
+
+  if (r->numRects == 0) return;
+  for (i = 0; i < r->numRects; i++) {
+    r->rects[i].x1 += dx;
+    r->rects[i].y1 += dy;
+    r->rects[i].x2 += dx;
+    r->rects[i].y2 += dy;
+  }
+  r->extents.x1 += dx;
+  r->extents.y1 += dy;
+  r->extents.x2 += dx;
+  r->extents.y2 += dy;
+}
+
+/* Copy region */
+DKbool dkRegionCopy(struct dkRegion *dst, const struct dkRegion *src)
+{
+  if (dst == src) return TRUE;
+  dst->numRects = 0;
+  if (!dkRegionGrow(dst, src->numRects)) return FALSE;
+  if (src->numRects) memcpy(dst->rects, src->rects, sizeof(struct dkBox) * src->numRects);
+  dst->numRects = src->numRects;
+  dst->extents = src->extents;
+  return TRUE;
+}
+
+/* Union of a and b */
+DKbool dkRegionUnion(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b)
+{
+  if (a->numRects == 0) return dkRegionCopy(dst, b);
+  if (b->numRects == 0) return dkRegionCopy(dst, a);
+  return dkRegionOp(dst, a, b, dkRegionUnionBand, TRUE, TRUE);
+}
+
+/* Part of a not in b */
+DKbool dkRegionSubtract(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b)
+{
+  if (a->numRects == 0 || b->numRects == 0 ||
+      !dkRegionTouches(a, b->extents.x1, b->extents.y1, b->extents.x2 - b->extents.x1, b->extents.y2 - b->extents.y1))
+    return dkRegionCopy(dst, a);
+  return dkRegionOp(dst, a, b, dkRegionSubtractBand, TRUE, FALSE);
+}
+
+/* Intersection of a and b */
+DKbool dkRegionIntersect(struct dkRegion *dst, const struct dkRegion *a, const struct dkRegion *b)
+{
+  if (a->numRects == 0 || b->numRects == 0 ||
+      !dkRegionTouches(a, b->extents.x1, b->extents.y1, b->extents.x2 - b->extents.x1, b->extents.y2 - b->extents.y1)) {
+    dkRegionReset(dst);
+    return TRUE;
+  }
+  return dkRegionOp(dst, a, b, dkRegionIntersectBand, FALSE, FALSE);
+}
+
+/* Add rectangle */
+DKbool dkRegionUnionRect(struct dkRegion *r, int x, int y, int w, int h)
+{
+  struct dkRegion rect;
+  struct dkBox box;
+  int prevband;
+
+  if (w <= 0 || h <= 0) return TRUE;
+
+  /* Rectangle replaces whole region */
+  if (r->numRects == 0 || dkRegionInside(r, x, y, w, h)) {
+    r->numRects = 0;
+    if (!dkRegionAppend(r, x, y, x + w, y + h)) return FALSE;
+    dkRegionSetExtents(r);
+    return TRUE;
+  }
+
+  /* Rectangle already covered */
+  if (r->numRects == 1 && x >= r->extents.x1 && y >= r->extents.y1 && x + w <= r->extents.x2 && y + h <= r->extents.y2)
+    return TRUE;
+
+  /* Rectangle below all bands; just append a band */
+  if (y >= r->extents.y2) {
+    for (prevband = r->numRects - 1; prevband > 0 && r->rects[prevband - 1].y1 == r->rects[prevband].y1; prevband--) {}
+    if (!dkRegionAppend(r, x, y, x + w, y + h)) return FALSE;
+    dkRegionCoalesce(r, prevband, r->numRects - 1);
+    r->extents.x1 = FXMIN(r->extents.x1, x);
+    r->extents.x2 = FXMAX(r->extents.x2, x + w);
+    r->extents.y2 = y + h;
+    return TRUE;
+  }
+
+  dkRegionSetBox(&rect, &box, x, y, w, h);
+  return dkRegionOp(r, r, &rect, dkRegionUnionBand, TRUE, TRUE);
+}
+
+/* Remove rectangle */
+DKbool dkRegionSubtractRect(struct dkRegion *r, int x, int y, int w, int h)
+{
+  struct dkRegion rect;
+  struct dkBox box;
+
+  if (w <= 0 || h <= 0 || r->numRects == 0 || !dkRegionTouches(r, x, y, w, h)) return TRUE;
+  if (dkRegionInside(r, x, y, w, h)) {
+    dkRegionReset(r);
+    return TRUE;
+  }
+  dkRegionSetBox(&rect, &box, x, y, w, h);
+  return dkRegionOp(r, r, &rect, dkRegionSubtractBand, TRUE, FALSE);
+}
+
+/* Clip to rectangle */
+DKbool dkRegionIntersectRect(struct dkRegion *r, int x, int y, int w, int h)
+{
+  struct dkRegion rect;
+  struct dkBox box;
+
+  if (w <= 0 || h <= 0 || r->numRects == 0 || !dkRegionTouches(r, x, y, w, h)) {
+    dkRegionReset(r);
+    return TRUE;
+  }
+  if (dkRegionInside(r, x, y, w, h)) return TRUE;
+  dkRegionSetBox(&rect, &box, x, y, w, h);
+  return dkRegionOp(r, r, &rect, dkRegionIntersectBand, FALSE, FALSE);
+}
@@ -105,11 +105,15 @@ DtkCreateRootWindow(void *pthis)
 
     d = w->app->display;
 
-    DtkCreateVisual(w->visual);
-
-    w->xid = RootWindow(d, DefaultScreen(d));
-    w->width = DisplayWidth(d, DefaultScreen(d));
-    w->height = DisplayHeight(d, DefaultScreen(d));
+    if (w->app->headless) {
+      dtkNullCreateRoot(w);
+    } else {
+      DtkCreateVisual(w->visual);
+
+      w->xid = RootWindow(d, DefaultScreen(d));
+      w->width = DisplayWidth(d, DefaultScreen(d));
+      w->height = DisplayHeight(d, DefaultScreen(d));
+    }
 #endif
     /* Normally create children */
     for (child = ((struct dkWindow *)w)->first; child; child = child->next)
@@ -67,7 +67,7 @@ void
 dkShellRecalc(struct dkWindow *pthis)
 {
 	dkAppRemoveChore(pthis->app, (struct dkObject *)pthis, ID_LAYOUT);
-	dkAppAddChore(pthis->app, (struct dkObject *)pthis, ID_LAYOUT, NULL);
+	dkAppAddChorePriority(pthis->app, (struct dkObject *)pthis, ID_LAYOUT, NULL, CHORE_PAINT);
 	pthis->flags |= FLAG_DIRTY;
 }
 
@@ -0,0 +1,244 @@
+/******************************************************************************
+ *                                                                            *
+ *                 E v e n t   L o o p   S t a t i s t i c s                  *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fxapp.h"
+#include "fxstats.h"
+#include "fxthread.h"
+
+/*
+  Notes:
+  - Statistics are only collected while the application has a dkStats
+    object; the event loop just tests a pointer otherwise.
+  - Durations go into histograms with power of two buckets, so adding a
+    sample is a handful of instructions and needs no allocation, except
+    the first time a new receiver class is seen.
+  - Event times come from the clock of the window system, which is not
+    ours; the least difference between the clocks seen so far stands
+    for an event delivered right away.  Differences are taken modulo
+    2^32, so the event clock may wrap around.
+*/
+
+static const char *const sourcenames[STAT_LAST] = {
+  "events", "timers", "chores", "updates", "inputs", "wait", "paints"
+};
+
+static const char *const queuenames[STATQ_LAST] = {
+  "timers", "chores", "repaints", "dirty", "events"
+};
+
+
+/* Make statistics collector */
+struct dkStats *dkStatsNew(void)
+{
+  struct dkStats *st;
+
+  st = calloc(1, sizeof(struct dkStats));
+  st->classindex = DtkHashNew();
+  st->started = dkThreadSteadyTime();
+  return st;
+}
+
+/* Clear all statistics */
+void dkStatsReset(struct dkStats *st)
+{
+  struct dkStatClass *c;
+
+  memset(st->sources, 0, sizeof(st->sources));
+  memset(st->types, 0, sizeof(st->types));
+  memset(st->queues, 0, sizeof(st->queues));
+  memset(&st->inputdelay, 0, sizeof(st->inputdelay));
+  st->haveinputlag = FALSE;
+  for (c = st->classes; c; c = c->next) {
+    memset(&c->hist, 0, sizeof(c->hist));
+    memset(&c->latency, 0, sizeof(c->latency));
+  }
+  st->started = dkThreadSteadyTime();
+}
+
+/* Delete statistics collector */
+void dkStatsDel(struct dkStats *st)
+{
+  struct dkStatClass *c;
+
+  while ((c = st->classes) != NULL) {
+    st->classes = c->next;
+    free(c);
+  }
+  DtkHashFree(st->classindex);
+  free(st);
+}
+
+/* Add sample to histogram */
+void dkStatHistAdd(struct dkStatHist *h, DKlong ns)
+{
+  DKulong us = (DKulong)(ns / 1000);
+  int b = 0;
+
+  while (us && b < DK_STATBUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  h->count++;
+  h->total += ns;
+  if (ns > h->max) h->max = ns;
+  h->buckets[b]++;
+}
+
+/* Find statistics of class, adding them the first time */
+static struct dkStatClass *dkStatsClass(struct dkStats *st, const struct dkMetaClass *meta)
+{
+  struct dkStatClass *c;
+
+  c = (struct dkStatClass *)DtkHashFind(st->classindex, (void *)meta);
+  if (!c) {
+    if ((c = calloc(1, sizeof(struct dkStatClass))) == NULL) return NULL;
+    c->meta = meta;
+    c->next = st->classes;
+    st->classes = c;
+    DtkHashInsert(st->classindex, (void *)meta, c);
+  }
+  return c;
+}
+
+/* Record duration */
+void dkStatsAdd(struct dkStats *st, int source, int type, const struct dkObject *obj, DKlong ns)
+{
+  struct dkStatClass *c;
+
+  dkStatHistAdd(&st->sources[source], ns);
+  if (source == STAT_EVENT && 0 <= type && type < DK_STATTYPES)
+    dkStatHistAdd(&st->types[type], ns);
+  if (obj && obj->meta && (c = dkStatsClass(st, obj->meta)) != NULL)
+    dkStatHistAdd(&c->hist, ns);
+}
+
+/* Delay (ns) from event time to now, beyond the least lag seen */
+static DKlong dkStatsLag(struct dkStats *st, DKuint time, DKlong now)
+{
+  DKuint lag = (DKuint)(now / 1000000) - time;
+
+  if (!st->haveinputlag || (int)(lag - st->inputlag) < 0) {
+    st->inputlag = lag;
+    st->haveinputlag = TRUE;
+  }
+  return (DKlong)(lag - st->inputlag) * 1000000;
+}
+
+/* Record delay of user input */
+void dkStatsInputDelay(struct dkStats *st, DKuint time, DKlong now)
+{
+  dkStatHistAdd(&st->inputdelay, dkStatsLag(st, time, now));
+}
+
+/* Record delay from user input to the flush of its paint */
+void dkStatsLatency(struct dkStats *st, const struct dkMetaClass *meta, DKuint time, DKlong now)
+{
+  struct dkStatClass *c;
+
+  if (meta && (c = dkStatsClass(st, meta)) != NULL)
+    dkStatHistAdd(&c->latency, dkStatsLag(st, time, now));
+}
+
+/* Record queue depth */
+void dkStatsQueue(struct dkStats *st, int q, int depth)
+{
+  struct dkStatDepth *d = &st->queues[q];
+
+  d->samples++;
+  d->total += depth;
+  d->last = depth;
+  if (depth > d->max) d->max = depth;
+}
+
+/* Upper bound of bucket b (ns) */
+static DKlong dkStatBucketLimit(int b)
+{
+  return ((DKlong)1 << b) * 1000;
+}
+
+/* Approximate percentile */
+DKlong dkStatHistPercentile(const struct dkStatHist *h, double fraction)
+{
+  DKulong want, seen = 0;
+  int b;
+
+  if (h->count == 0) return 0;
+  want = (DKulong)(fraction * h->count);
+  if (want >= h->count) return h->max;
+  for (b = 0; b < DK_STATBUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen > want) return FXMIN(dkStatBucketLimit(b), h->max);
+  }
+  return h->max;
+}
+
+/* Print one histogram line */
+static void dkStatHistDump(FILE *fp, const char *name, const struct dkStatHist *h)
+{
+  if (h->count == 0) return;
+  fprintf(fp, "  %-24s %10lu %12.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+      (unsigned long)h->count, h->total / 1e6, h->total / 1e3 / h->count,
+      dkStatHistPercentile(h, 0.5) / 1e3, dkStatHistPercentile(h, 0.99) / 1e3, h->max / 1e3);
+}
+
+/* Print report */
+void dkStatsDump(struct dkStats *st, FILE *fp, const char *(*typename)(int type))
+{
+  static const char header[] = "  %-24s %10s %12s %10s %10s %10s %10s\n";
+  const struct dkStatClass *c;
+  char buf[32];
+  int i;
+
+  fprintf(fp, "Event loop statistics over %.3fs\n", (dkThreadSteadyTime() - st->started) / 1e9);
+  fprintf(fp, header, "source", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+  for (i = 0; i < STAT_LAST; i++) {
+    dkStatHistDump(fp, sourcenames[i], &st->sources[i]);
+  }
+  dkStatHistDump(fp, "input delay", &st->inputdelay);
+  fprintf(fp, header, "event type", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+  for (i = 0; i < DK_STATTYPES; i++) {
+    if (typename && typename(i)) {
+      dkStatHistDump(fp, typename(i), &st->types[i]);
+    } else {
+      snprintf(buf, sizeof(buf), "type %d", i);
+      dkStatHistDump(fp, buf, &st->types[i]);
+    }
+  }
+  fprintf(fp, header, "receiver class", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+  for (c = st->classes; c; c = c->next) {
+    dkStatHistDump(fp, c->meta->className, &c->hist);
+  }
+  fprintf(fp, header, "input to paint", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+  for (c = st->classes; c; c = c->next) {
+    dkStatHistDump(fp, c->meta->className, &c->latency);
+  }
+  fprintf(fp, "  %-24s %10s %10s %10s %10s\n", "queue", "samples", "mean", "max", "last");
+  for (i = 0; i < STATQ_LAST; i++) {
+    const struct dkStatDepth *d = &st->queues[i];
+    if (d->samples == 0) continue;
+    fprintf(fp, "  %-24s %10lu %10.2f %10d %10d\n", queuenames[i],
+        (unsigned long)d->samples, (double)d->total / d->samples, d->max, d->last);
+  }
+  fflush(fp);
+}
@@ -22,6 +22,10 @@
  * $Id: FXText.cpp,v 1.348.2.3 2007/06/29 13:47:37 fox Exp $                  *
  *****************************************************************************/
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "fxascii.h"
 #include "fxdc.h"
 #include "fxtext.h"
@@ -39,18 +43,12 @@
     No break space  240  \xF0
   - Buffer layout:
 
-    Content  :  A  B  C  .  .  .  .  .  .  .  .  D  E  F  G
-    Position :  0  1  2 			 3  4  5  6    length=7
-    Addresss :  0  1  2  3  4  5  6  7  8  9 10 11 12 13 14    buffersize=7+11-3=15
-             		 ^			 ^
-	     		 |			 |
-	     	      gapstart=3	       gapend=11       gaplen=11-3=8
-
-    The gap is moved around the buffer so newly added text
-    can be entered into the gap; when the gap becomes too small,
-    the buffer is resized.  This gapped-buffer technique minimizes
-    the number of resizes of the buffer, and minimizes the number
-    of block moves.
+    The text is kept in a dkTextBuffer, a piece table (see fxtextbuffer.c),
+    rather than a gap buffer; edits take logarithmic time wherever they
+    are, instead of moving all text between the gap and the edit.  Text is
+    only contiguous within a piece, so it is read through getByte() and
+    getChar(), or run by run with dkTextBufferPeek().  The style of text
+    is kept with its piece.
 
     The tail end of the visrows array will look like:
 
@@ -61,6 +59,16 @@
 
     The last legal position is length = 11.
 
+  - Word wrapping keeps the rows of each line, as offsets from its start,
+    so edits elsewhere leave them valid; an edit only drops the rows of
+    the lines it touches.  A new wrap width bumps a generation number,
+    which drops all rows at once.  Rows are made again when shown, and
+    the rest in a background chore starting at the top visible line, so
+    the count of all rows settles after a while.  The rows of the lines
+    are added up in a Fenwick tree, so finding the row of a position
+    takes O(log n) however many lines come before it.  Lines longer than
+    WRAPLINE are not kept, but wrapped as shown, counting as one row.
+
   - While resizing window, keep track of a position which should remain visible,
     i.e. toppos=rowStart(position).  The position is changed same as toppos, except during
     resize.
@@ -116,8 +124,8 @@
 */
 
 
-#define MINSIZE   80                  // Minimum gap size
 #define NVISROWS  20                  // Initial visible rows
+#define WRAPLINE  65536               // Longest line whose rows are kept
 
 #define TEXT_MASK   (TEXT_FIXEDWRAP|TEXT_WORDWRAP|TEXT_OVERSTRIKE|TEXT_READONLY|TEXT_NO_TABS|TEXT_AUTOINDENT|TEXT_SHOWACTIVE|TEXT_AUTOSCROLL)
 
@@ -128,17 +136,26 @@ void dkText_create(void *pthis);
 int dkText_getDefaultHeight(struct dkWindow *win);
 int dkText_getDefaultWidth(struct dkWindow *win);
 void dkText_layout(struct dkWindow *win);
+void dkText_drawCursor(struct dkText *txt, DKuint state);
+void dkText_calcVisRows(struct dkText *txt, int startline, int endline);
 
 static int dkText_getByte(struct dkText *txt, int pos);
 static int dkText_nextLine(struct dkText *txt, int pos, int nl);
 static DKwchar dkText_getChar(struct dkText *txt, int pos);
+static void dkText_trim(struct dkText *txt);
+static void dkText_wrapReset(struct dkText *txt);
+static int dkText_rowOfPos(struct dkText *txt, int pos);
 
 /* Handlers */
 static long dkText_onPaint(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void* ptr);
+static long dkText_onCount(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void* ptr);
+static long dkText_onWrap(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void* ptr);
 
 /*******************************************************************************/
 static struct dkMapEntry dkTextMap[] = {
-  FXMAPFUNC(SEL_PAINT, 0, dkText_onPaint)
+  FXMAPFUNC(SEL_PAINT, 0, dkText_onPaint),
+  FXMAPFUNC(SEL_CHORE, TEXT_ID_COUNT, dkText_onCount),
+  FXMAPFUNC(SEL_CHORE, TEXT_ID_WRAP, dkText_onWrap)
 };
 
 #if 0
@@ -312,14 +329,11 @@ void dkTextInit(struct dkText *pthis, struct dkComposite *p, struct dkObject *tg
   ((struct dkWindow *)pthis)->flags |= FLAG_ENABLED | FLAG_DROPTARGET;
   ((struct dkWindow *)pthis)->target = tgt;
   ((struct dkWindow *)pthis)->message = sel;
-  pthis->buffer = calloc(sizeof(char), MINSIZE);
-  pthis->sbuffer = NULL;
+  dkTextBufferInit(&pthis->text);
   pthis->visrows = calloc(sizeof(int), NVISROWS + 1);
   pthis->length = 0;
   pthis->nrows = 1;
   pthis->nvisrows = NVISROWS;
-  pthis->gapstart = 0;
-  pthis->gapend = MINSIZE;
   pthis->toppos = 0;
   pthis->keeppos = 0;
   pthis->toprow = 0;
@@ -345,7 +359,10 @@ void dkTextInit(struct dkText *pthis, struct dkComposite *p, struct dkObject *tg
   pthis->tabcolumns = 8;
   pthis->barwidth = 0;
   pthis->barcolumns = 0;
+  pthis->maxlines = 0;
+  pthis->maxbytes = 0;
   pthis->font = ((struct dkWindow *)pthis)->app->normalFont;
+  memset(pthis->asciiwidths, 0, sizeof(pthis->asciiwidths));
   pthis->hilitestyles = NULL;
   ((struct dkWindow *)pthis)->defaultCursor = ((struct dkWindow *)pthis)->app->cursor[DEF_TEXT_CURSOR];
   ((struct dkWindow *)pthis)->dragCursor = ((struct dkWindow *)pthis)->app->cursor[DEF_TEXT_CURSOR];
@@ -366,9 +383,13 @@ void dkTextInit(struct dkText *pthis, struct dkComposite *p, struct dkObject *tg
   pthis->vcols = 0;
   pthis->matchtime = 0;
   pthis->modified = FALSE;
+  pthis->styled = FALSE;
   pthis->mode = MOUSE_NONE;
   pthis->grabx = 0;
   pthis->graby = 0;
+  memset(&pthis->wrap, 0, sizeof(pthis->wrap));
+  pthis->wrap.gen = 1;
+  dkText_wrapReset(pthis);
 }
 
 /* Create window */
@@ -498,17 +519,28 @@ FXint FXText::inc(FXint pos) const {
   }
 
 #endif
+extern signed char utfBytes[256];
+
 /* Get byte */
 static int dkText_getByte(struct dkText *txt, int pos)
 {
-  return (DKuchar)txt->buffer[pos < txt->gapstart ? pos : pos - txt->gapstart + txt->gapend];
+  return dkTextBufferGetByte(&txt->text, pos);
 }
 
-/* Get character, assuming that gap never inside utf8 encoding */
+/* Get character; one spanning pieces is decoded from a copy */
 static DKwchar dkText_getChar(struct dkText *txt, int pos)
 {
-  DKuchar* ptr = (pos < txt->gapstart) ? (DKuchar*)(txt->buffer + pos) : (DKuchar*)(txt->buffer + pos - txt->gapstart + txt->gapend);
-  DKwchar w = ptr[0];
+  DKuchar buf[6] = { 0, 0, 0, 0, 0, 0 };
+  const DKuchar *ptr;
+  DKwchar w;
+  int n;
+
+  if ((ptr = (const DKuchar *)dkTextBufferPeek(&txt->text, pos, &n)) == NULL) return 0;
+  if (n < utfBytes[ptr[0]]) {
+    dkTextBufferExtract(&txt->text, (char *)buf, pos, FXMIN(utfBytes[ptr[0]], txt->length - pos));
+    ptr = buf;
+  }
+  w = ptr[0];
   if (0xC0 <= w) { w = (w << 6) ^ ptr[1] ^ 0x3080;
   if (0x800 <= w) { w = (w << 6) ^ ptr[2] ^ 0x20080;
   if (0x10000 <= w) { w = (w << 6) ^ ptr[3] ^ 0x400080;
@@ -517,18 +549,17 @@ static DKwchar dkText_getChar(struct dkText *txt, int pos)
   return w;
 }
 
-extern signed char utfBytes[256];
 /* Get length of wide character at position pos */
 int dkText_getCharLen(struct dkText *txt, int pos)
 {
-  return utfBytes[(DKuchar)txt->buffer[pos < txt->gapstart ? pos : pos - txt->gapstart + txt->gapend]];
+  return utfBytes[dkTextBufferGetByte(&txt->text, pos)];
 }
 
 
 /* Get style */
 int dkText_getStyle(struct dkText *txt, int pos)
 {
-  return (DKuchar)txt->sbuffer[pos < txt->gapstart ? pos : pos - txt->gapstart + txt->gapend];
+  return dkTextBufferGetStyle(&txt->text, pos);
 }
 
 #if 0
@@ -608,6 +639,10 @@ int dkText_charWidth(struct dkText *txt, DKwchar ch, int indent)
     }
     return (txt->tabwidth - indent % txt->tabwidth);
   }
+  if (ch < 128) {
+    if (!txt->asciiwidths[ch]) txt->asciiwidths[ch] = dkFontGetCharWidth(txt->font, ch);
+    return txt->asciiwidths[ch];
+  }
   return dkFontGetCharWidth(txt->font, ch);
 }
 
@@ -624,7 +659,7 @@ int dkText_wrap(struct dkText *txt, int start)
     if (lw + cw > txt->wrapwidth) {
       /* Technically, a tab-before-wrap should be as wide as space! */
       if (s > start) return s;     // We remembered the last space we encountered; break there!
-      if (p == start) p++;         // Always at least one character on each line!
+      if (p == start) p += dkText_getCharLen(txt, p);   // Always at least one character on each line!
       return p;
     }
     lw += cw;
@@ -907,15 +942,454 @@ FXint FXText::lineEnd(FXint pos) const {
   }
 
 #endif
-/* Return start of next line */
+/* Return start of next line; short lines end in the piece they start
+ * in, so look there before going to the line index */
 static int dkText_nextLine(struct dkText *txt, int pos, int nl)
 {
+  const char *p, *q;
+  int n;
+
   if (nl <= 0) return pos;
-  while (pos < txt->length) {
-    if (dkText_getByte(txt, pos) == '\n' && --nl == 0) return pos + 1;
-    pos++;
+  if ((p = dkTextBufferPeek(&txt->text, pos, &n)) != NULL) {
+    while ((q = memchr(p, '\n', n)) != NULL) {
+      pos += q - p + 1;
+      n -= q - p + 1;
+      p = q + 1;
+      if (--nl == 0) return pos;
+    }
+    pos += n;
   }
-  return txt->length;
+  return dkTextBufferLineStart(&txt->text, dkTextBufferLinesBefore(&txt->text, pos) + nl);
+}
+
+/* Count number of newlines from start up to end */
+static int dkText_countLines(struct dkText *txt, int start, int end)
+{
+  if (end <= start) return 0;
+  return dkTextBufferLinesBefore(&txt->text, end) - dkTextBufferLinesBefore(&txt->text, start);
+}
+
+/* Return position of begin of line containing position pos */
+static int dkText_lineStart(struct dkText *txt, int pos)
+{
+  return dkTextBufferLineStart(&txt->text, dkTextBufferLinesBefore(&txt->text, pos));
+}
+
+/* Count number of newlines */
+int dkTextCountLines(struct dkText *txt, int start, int end)
+{
+  return dkText_countLines(txt, start, end);
+}
+
+/* Return position of begin of line containing position pos */
+int dkTextLineStart(struct dkText *txt, int pos)
+{
+  return dkText_lineStart(txt, pos);
+}
+
+/* Return position of end of line containing position pos */
+int dkTextLineEnd(struct dkText *txt, int pos)
+{
+  int start = dkText_lineStart(txt, pos);
+  int end = dkText_nextLine(txt, start, 1);
+
+  if (start < end && dkText_getByte(txt, end - 1) == '\n') end--;
+  return end;
+}
+
+/* Return start of next line */
+int dkTextNextLine(struct dkText *txt, int pos, int nl)
+{
+  return dkText_nextLine(txt, pos, nl);
+}
+
+/* Return start of previous line */
+int dkTextPrevLine(struct dkText *txt, int pos, int nl)
+{
+  int line = dkTextBufferLinesBefore(&txt->text, pos);
+
+  return dkTextBufferLineStart(&txt->text, FXMAX(line - FXMAX(nl, 0), 0));
+}
+
+/* Return number of line containing position pos */
+int dkTextLineOfPos(struct dkText *txt, int pos)
+{
+  return dkTextBufferLinesBefore(&txt->text, FXMAX(0, FXMIN(pos, txt->length)));
+}
+
+/* Return start of line */
+int dkTextPosOfLine(struct dkText *txt, int line)
+{
+  return dkTextBufferLineStart(&txt->text, line);
+}
+
+/* Slot of line in ring */
+static int dkText_wrapSlot(const struct dkTextWrap *w, int line)
+{
+  return (w->head + (line < w->gap ? line : line + w->size - w->nlines)) % w->size;
+}
+
+/* Rows of line in ring */
+static struct dkTextRows *dkText_wrapLine(struct dkTextWrap *w, int line)
+{
+  return &w->lines[dkText_wrapSlot(w, line)];
+}
+
+/* Rows line adds to the total */
+static int dkText_wrapCount(const struct dkTextWrap *w, const struct dkTextRows *r)
+{
+  return r->gen == w->gen ? r->nrows : 1;
+}
+
+/* Add n rows to slot in the tree of sums */
+static void dkText_wrapAdd(struct dkTextWrap *w, int slot, int n)
+{
+  for (slot++; slot <= w->size; slot += slot & -slot) w->sums[slot] += n;
+}
+
+/* Return rows of the slots before slot */
+static int dkText_wrapSum(const struct dkTextWrap *w, int slot)
+{
+  int n = 0;
+
+  for (; slot > 0; slot -= slot & -slot) n += w->sums[slot];
+  return n;
+}
+
+/* Return rows of the lines before line, which are the slots from head
+ * up to it, going round the end of the ring if they do */
+static int dkText_wrapBefore(const struct dkTextWrap *w, int line)
+{
+  int end = w->head + (line <= w->gap ? line : line + w->size - w->nlines);
+
+  if (end <= w->size) return dkText_wrapSum(w, end) - dkText_wrapSum(w, w->head);
+  return dkText_wrapSum(w, w->size) - dkText_wrapSum(w, w->head) + dkText_wrapSum(w, end - w->size);
+}
+
+/* Add up rows of all lines in the tree of sums again, in O(n) */
+static void dkText_wrapBuild(struct dkTextWrap *w)
+{
+  int i, j;
+
+  memset(w->sums, 0, sizeof(int) * (w->size + 1));
+  for (i = 0; i < w->nlines; i++) w->sums[dkText_wrapSlot(w, i) + 1] = dkText_wrapCount(w, dkText_wrapLine(w, i));
+  for (i = 1; i <= w->size; i++) {
+    j = i + (i & -i);
+    if (j <= w->size) w->sums[j] += w->sums[i];
+  }
+}
+
+/* Move line across the gap, src and dst slots after head */
+static void dkText_wrapMove(struct dkTextWrap *w, int src, int dst)
+{
+  int n;
+
+  src = (w->head + src) % w->size;
+  dst = (w->head + dst) % w->size;
+  n = dkText_wrapCount(w, &w->lines[src]);
+
+  w->lines[dst] = w->lines[src];
+  dkText_wrapAdd(w, src, -n);
+  dkText_wrapAdd(w, dst, n);
+}
+
+/* Wrap n lines in the background, starting at line */
+static void dkText_wrapStart(struct dkText *txt, int line, int n)
+{
+  txt->wrap.scan = line;
+  txt->wrap.left = n;
+  dkAppAddChorePriority(((struct dkWindow *)txt)->app, (struct dkObject *)txt, TEXT_ID_WRAP, NULL, CHORE_BACKGROUND);
+}
+
+/* Forget rows of all lines */
+static void dkText_wrapClear(struct dkTextWrap *w)
+{
+  int i;
+
+  for (i = 0; i < w->nlines; i++) free(dkText_wrapLine(w, i)->breaks);
+  free(w->lines);
+  free(w->sums);
+  w->lines = NULL;
+  w->sums = NULL;
+  w->nlines = 0;
+  w->size = 0;
+  w->head = 0;
+  w->gap = 0;
+  w->rows = 0;
+  w->left = 0;
+}
+
+/* Start over with no line wrapped yet; nothing is kept unless word
+ * wrapping */
+static void dkText_wrapReset(struct dkText *txt)
+{
+  struct dkTextWrap *w = &txt->wrap;
+  int n, i;
+
+  dkText_wrapClear(w);
+  if (!(((struct dkWindow *)txt)->options & TEXT_WORDWRAP)) return;
+  n = dkTextBufferGetLines(&txt->text) + 1;
+  if ((w->lines = malloc(sizeof(struct dkTextRows) * n)) == NULL || (w->sums = malloc(sizeof(int) * (n + 1))) == NULL) {
+    printf("Error: %s: out of memory.\n", __func__);
+    dkText_wrapClear(w);
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    w->lines[i].gen = 0;
+    w->lines[i].nrows = 1;
+    w->lines[i].breaks = NULL;
+  }
+  w->nlines = w->size = w->gap = w->rows = n;
+  dkText_wrapBuild(w);
+  dkText_wrapStart(txt, 0, n);
+}
+
+/* Replace rows of nold lines from first by nnew lines not wrapped yet */
+static void dkText_wrapChange(struct dkText *txt, int first, int nold, int nnew)
+{
+  struct dkTextWrap *w = &txt->wrap;
+  struct dkTextRows *lines, *r;
+  int gapsize, size, slot, i, n, *sums;
+  DKbool grown = FALSE;
+
+  if (!w->lines) return;
+
+  /* Move gap to first, one line at a time to keep the sums; a gap at the
+   * end is also one at the start, so go round whichever way is shorter */
+  gapsize = w->size - w->nlines;
+  if (gapsize > 0) {
+    if (first - w->gap > w->nlines - first + w->gap) {
+      while (w->gap > 0) {
+        w->gap--;
+        dkText_wrapMove(w, w->gap, w->gap + gapsize);
+      }
+      w->gap = w->nlines;
+      w->head = (w->head + gapsize) % w->size;
+    } else if (w->gap - first > w->nlines - w->gap + first) {
+      while (w->gap < w->nlines) {
+        dkText_wrapMove(w, w->gap + gapsize, w->gap);
+        w->gap++;
+      }
+      w->gap = 0;
+      w->head = (w->head + w->size - gapsize) % w->size;
+    }
+    while (w->gap > first) {
+      w->gap--;
+      dkText_wrapMove(w, w->gap, w->gap + gapsize);
+    }
+    while (w->gap < first) {
+      dkText_wrapMove(w, w->gap + gapsize, w->gap);
+      w->gap++;
+    }
+  }
+  w->gap = first;
+
+  /* Drop old lines following gap */
+  for (i = 0; i < nold; i++) {
+    slot = (w->head + first + gapsize + i) % w->size;
+    r = &w->lines[slot];
+    n = dkText_wrapCount(w, r);
+    dkText_wrapAdd(w, slot, -n);
+    w->rows -= n;
+    free(r->breaks);
+  }
+  w->nlines -= nold;
+  gapsize += nold;
+
+  /* Grow gap to fit new lines, laying the ring out from slot 0 */
+  if (gapsize < nnew) {
+    size = FXMAX(w->size * 2, w->nlines + nnew);
+    lines = malloc(sizeof(struct dkTextRows) * size);
+    sums = malloc(sizeof(int) * (size + 1));
+    if (!lines || !sums) {
+      printf("Error: %s: out of memory.\n", __func__);
+      free(lines);
+      free(sums);
+      dkText_wrapClear(w);
+      return;
+    }
+    for (i = 0; i < w->nlines; i++) lines[i < first ? i : i + size - w->nlines] = *dkText_wrapLine(w, i);
+    free(w->lines);
+    free(w->sums);
+    w->lines = lines;
+    w->sums = sums;
+    w->size = size;
+    w->head = 0;
+    grown = TRUE;
+  }
+  for (i = 0; i < nnew; i++) {
+    slot = (w->head + first + i) % w->size;
+    r = &w->lines[slot];
+    r->gen = 0;
+    r->nrows = 1;
+    r->breaks = NULL;
+    if (!grown) dkText_wrapAdd(w, slot, 1);
+  }
+  w->gap += nnew;
+  w->nlines += nnew;
+  w->rows += nnew;
+  if (grown) dkText_wrapBuild(w);
+
+  /* Only the new lines are left to wrap, unless the background was
+   * still going */
+  dkText_wrapStart(txt, first, w->left > 0 ? w->nlines : nnew);
+}
+
+/* Catch up with lines of a mapped file counted since; they split what
+ * was the last line */
+static void dkText_wrapSync(struct dkText *txt)
+{
+  int n = dkTextBufferGetLines(&txt->text) + 1;
+  int ls;
+
+  if (txt->wrap.lines && n > txt->wrap.nlines) {
+    ls = dkTextBufferLineStart(&txt->text, txt->wrap.nlines - 1);
+    dkText_wrapChange(txt, txt->wrap.nlines - 1, 1, n - txt->wrap.nlines + 1);
+    if (ls < txt->toppos) txt->toprow = dkText_rowOfPos(txt, txt->toppos);
+    if (ls < txt->cursorstart) txt->cursorrow = dkText_rowOfPos(txt, txt->cursorstart);
+  }
+}
+
+/* Return rows of line starting at ls, wrapping it if not done at this
+ * width yet; NULL if rows of the line are not kept */
+static struct dkTextRows *dkText_wrapRows(struct dkText *txt, int line, int ls)
+{
+  struct dkTextWrap *w = &txt->wrap;
+  struct dkTextRows *r;
+  int *breaks = NULL, *more;
+  int end, p, n = 0, size = 0;
+
+  if (!w->lines) return NULL;
+  dkText_wrapSync(txt);
+  if (!w->lines || line >= w->nlines) return NULL;
+  r = dkText_wrapLine(w, line);
+  if (r->gen == w->gen) return r;
+  end = dkText_nextLine(txt, ls, 1);
+  if (end - ls > WRAPLINE) return NULL;
+  for (p = ls; (p = dkText_wrap(txt, p)) < end; ) {
+    if (n == size) {
+      size = size ? size * 2 : 4;
+      if ((more = realloc(breaks, sizeof(int) * size)) == NULL) {
+        printf("Error: %s: out of memory.\n", __func__);
+        free(breaks);
+        return NULL;
+      }
+      breaks = more;
+    }
+    breaks[n++] = p - ls;
+  }
+  free(r->breaks);
+  w->rows += n;
+  dkText_wrapAdd(w, dkText_wrapSlot(w, line), n);
+  r->gen = w->gen;
+  r->nrows = n + 1;
+  r->breaks = breaks;
+
+  /* Rows added above the top row and the cursor move them down */
+  if (end <= txt->toppos) txt->toprow += n;
+  if (end <= txt->cursorstart) txt->cursorrow += n;
+  return r;
+}
+
+/* Return number of rows: wrapped rows when word wrapping, else lines */
+static int dkText_numRows(struct dkText *txt)
+{
+  if (txt->wrap.lines) return txt->wrap.rows;
+  return dkTextBufferGetLines(&txt->text) + 1;
+}
+
+/* Count breaks of rows at or before offset */
+static int dkText_rowsBefore(const struct dkTextRows *r, int offset)
+{
+  int lo = 0, hi = r->nrows - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (r->breaks[mid] <= offset) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+/* Return start of row after the one containing pos */
+static int dkText_nextRow(struct dkText *txt, int pos)
+{
+  struct dkTextRows *r;
+  int line, ls, k;
+
+  line = dkTextBufferLinesBefore(&txt->text, pos);
+  ls = dkTextBufferLineStart(&txt->text, line);
+  if ((r = dkText_wrapRows(txt, line, ls)) == NULL) return dkText_wrap(txt, pos);
+  k = dkText_rowsBefore(r, pos - ls);
+  if (k < r->nrows - 1) return ls + r->breaks[k];
+  return dkText_nextLine(txt, pos, 1);
+}
+
+/* Return start of row containing pos */
+static int dkText_rowStart(struct dkText *txt, int pos)
+{
+  struct dkTextRows *r;
+  int line, ls, p, q, k;
+
+  line = dkTextBufferLinesBefore(&txt->text, pos);
+  ls = dkTextBufferLineStart(&txt->text, line);
+  if ((r = dkText_wrapRows(txt, line, ls)) == NULL) {
+    for (p = ls; p < pos && (q = dkText_wrap(txt, p)) <= pos; p = q) { }
+    return p;
+  }
+  k = dkText_rowsBefore(r, pos - ls);
+  return k ? ls + r->breaks[k - 1] : ls;
+}
+
+/* Return row containing pos: the rows kept for the lines before it and
+ * the breaks before it in its own line when word wrapping, else lines */
+static int dkText_rowOfPos(struct dkText *txt, int pos)
+{
+  struct dkTextWrap *w = &txt->wrap;
+  struct dkTextRows *r;
+  int line, ls, row;
+
+  line = dkTextBufferLinesBefore(&txt->text, pos);
+  if (!w->lines) return line;
+  ls = dkTextBufferLineStart(&txt->text, line);
+  r = dkText_wrapRows(txt, line, ls);
+  if (!w->lines) return line;
+  row = dkText_wrapBefore(w, FXMIN(line, w->nlines));
+  if (r) row += dkText_rowsBefore(r, pos - ls);
+  return row;
+}
+
+/* Put cursor start, end and row around the cursor position */
+static void dkText_cursorRow(struct dkText *txt)
+{
+  if (((struct dkWindow *)txt)->options & TEXT_WORDWRAP) {
+    txt->cursorstart = dkText_rowStart(txt, txt->cursorpos);
+    txt->cursorend = dkText_nextRow(txt, txt->cursorstart);
+  } else {
+    txt->cursorstart = dkText_lineStart(txt, txt->cursorpos);
+    txt->cursorend = dkText_nextLine(txt, txt->cursorstart, 1);
+  }
+  txt->cursorrow = dkText_rowOfPos(txt, txt->cursorstart);
+}
+
+/* Wrap width changed: rows are made again, the visible ones at once and
+ * the rest in the background, keeping keeppos on the top row */
+static void dkText_reflow(struct dkText *txt)
+{
+  struct dkTextWrap *w = &txt->wrap;
+
+  if (!w->lines) {
+    dkText_wrapReset(txt);
+  } else {
+    w->gen++;
+    w->rows = w->nlines;
+    dkText_wrapBuild(w);
+    dkText_wrapStart(txt, dkTextBufferLinesBefore(&txt->text, txt->keeppos), w->nlines);
+  }
+  txt->toppos = dkText_rowStart(txt, txt->keeppos);
+  txt->toprow = dkText_rowOfPos(txt, txt->toppos);
+  dkText_cursorRow(txt);
+  dkText_calcVisRows(txt, 0, txt->nvisrows);
+  txt->nrows = dkText_numRows(txt);
 }
 #if 0
 
@@ -1473,7 +1947,7 @@ void dkText_calcVisRows(struct dkText *txt, int startline, int endline)
     line = startline;
     if (((struct dkWindow *)txt)->options & TEXT_WORDWRAP) {
       while (line <= endline && pos < txt->length) {
-        pos = dkText_wrap(txt, pos);
+        pos = dkText_nextRow(txt, pos);
         txt->visrows[line++] = pos;
       }
     } else {
@@ -1487,6 +1961,317 @@ void dkText_calcVisRows(struct dkText *txt, int startline, int endline)
     }
   }
 }
+
+/* There has been a mutation of m bytes at pos into n bytes, changing
+ * the number of rows by nrdelta; above tells if it ends on a line
+ * before the first visible line */
+static void dkText_mutation(struct dkText *txt, int pos, int m, int n, int nrdelta, DKbool above)
+{
+  /* All of the change is below the last visible line */
+  if (txt->visrows[txt->nvisrows] < pos) return;
+
+  /* All change above first visible line */
+  if (above) {
+    txt->toprow += nrdelta;
+    txt->toppos += n - m;
+    txt->keeppos = txt->toppos;
+  }
+
+  /* Change overlaps first visible line; when word wrapping, a change
+   * further on in its line may move its row breaks as well */
+  else if (((struct dkWindow *)txt)->options & TEXT_WORDWRAP) {
+    if (pos < txt->toppos || dkText_lineStart(txt, pos) <= txt->toppos) {
+      txt->toppos = dkText_rowStart(txt, FXMIN(pos, txt->toppos));
+      txt->toprow = dkText_rowOfPos(txt, txt->toppos);
+      txt->keeppos = txt->toppos;
+    }
+  } else if (pos < txt->toppos) {
+    txt->toppos = dkText_lineStart(txt, pos);
+    txt->toprow = dkText_rowOfPos(txt, txt->toppos);
+    txt->keeppos = txt->toppos;
+  }
+  dkText_calcVisRows(txt, 0, txt->nvisrows);
+  dkWindowUpdate((struct dkWindow *)txt);
+}
+
+/* Replace m bytes at pos by n bytes of text */
+static void dkText_replace(struct dkText *txt, int pos, int m, const char *text, int n, int style)
+{
+  int del, nrdelta, lines, rows, first, last;
+  DKbool topabove, cursorabove, cursorline, recursor = FALSE;
+
+  pos = FXMAX(0, FXMIN(pos, txt->length));
+  m = FXMAX(0, FXMIN(m, txt->length - pos));
+  del = n - m;
+  dkText_drawCursor(txt, 0);
+  dkText_wrapSync(txt);
+
+  /* Lines whose rows change; the top row and the cursor row only move
+   * along if the change ends on a line before theirs */
+  first = dkTextBufferLinesBefore(&txt->text, pos);
+  last = dkTextBufferLinesBefore(&txt->text, pos + m);
+  topabove = pos + m < txt->toppos && last < dkTextBufferLinesBefore(&txt->text, txt->toppos);
+  cursorabove = pos + m < txt->cursorstart && last < dkTextBufferLinesBefore(&txt->text, txt->cursorstart);
+  cursorline = first <= dkTextBufferLinesBefore(&txt->text, txt->cursorstart);
+
+  /* Modify the buffer; the line index of the buffer counts the lines */
+  lines = dkTextBufferGetLines(&txt->text);
+  rows = dkText_numRows(txt);
+  if (!dkTextBufferReplace(&txt->text, pos, m, text, n, style)) {
+    printf("Error: %s: out of memory.\n", __func__);
+    return;
+  }
+  txt->length += del;
+  dkText_wrapChange(txt, first, last - first + 1, last - first + 1 + dkTextBufferGetLines(&txt->text) - lines);
+  txt->nrows = dkText_numRows(txt);
+  nrdelta = txt->nrows - rows;
+
+  /* Fix selection range */
+  if (pos + m <= txt->selstartpos) {
+    txt->selstartpos += del;
+    txt->selendpos += del;
+  } else if (pos < txt->selendpos) {
+    if (txt->selendpos <= pos + m) txt->selendpos = pos + n; else txt->selendpos += del;
+    if (pos <= txt->selstartpos) txt->selstartpos = pos + n;
+  }
+
+  /* Fix highlight range */
+  if (pos + m <= txt->hilitestartpos) {
+    txt->hilitestartpos += del;
+    txt->hiliteendpos += del;
+  } else if (pos < txt->hiliteendpos) {
+    if (txt->hiliteendpos <= pos + m) txt->hiliteendpos = pos + n; else txt->hiliteendpos += del;
+    if (pos <= txt->hilitestartpos) txt->hilitestartpos = pos + n;
+  }
+
+  /* Fix anchor position */
+  if (pos + m <= txt->anchorpos) txt->anchorpos += del;
+  else if (pos <= txt->anchorpos) txt->anchorpos = pos + n;
+
+  /* Cursor line is beyond changed area, so simple update */
+  if (cursorabove) {
+    txt->cursorpos += del;
+    txt->cursorstart += del;
+    txt->cursorend += del;
+    txt->cursorrow += nrdelta;
+  }
+
+  /* Cursor line changed, recompute cursor data once the top row is;
+   * when word wrapping, its row breaks may move with any change to its
+   * line */
+  else if (pos <= txt->cursorend || (cursorline && txt->wrap.lines)) {
+    if (pos + m <= txt->cursorpos) txt->cursorpos += del;
+    else if (pos <= txt->cursorpos) txt->cursorpos = pos + n;
+    recursor = TRUE;
+  }
+
+  /* Update stuff */
+  dkText_mutation(txt, pos, m, n, nrdelta, topabove);
+  if (recursor) dkText_cursorRow(txt);
+  dkText_trim(txt);
+}
+
+/* Drop lines from the front until the text is within the scrollback */
+static void dkText_trim(struct dkText *txt)
+{
+  int lines, cut = 0;
+
+  if (txt->maxlines > 0) {
+    lines = dkTextBufferGetLines(&txt->text);
+    if (lines > txt->maxlines) cut = dkTextBufferLineStart(&txt->text, lines - txt->maxlines);
+  }
+  if (txt->maxbytes > 0 && txt->length - cut > txt->maxbytes) {
+    cut = txt->length - txt->maxbytes;
+    if (dkText_lineStart(txt, cut) != cut) {
+      if (dkTextBufferLinesBefore(&txt->text, txt->length) > dkTextBufferLinesBefore(&txt->text, cut)) {
+        cut = dkText_nextLine(txt, cut, 1);
+      } else {
+        /* Last line alone is too long, so cut it at a character */
+        while (cut < txt->length && (dkText_getByte(txt, cut) & 0xC0) == 0x80) cut++;
+      }
+    }
+  }
+  if (cut > 0) dkText_replace(txt, 0, cut, NULL, 0, 0);
+}
+
+/* Replace m bytes at pos by n bytes of text */
+void dkTextReplaceText(struct dkText *txt, int pos, int m, const char *text, int n)
+{
+  dkText_replace(txt, pos, m, text, n, 0);
+}
+
+/* Replace m bytes at pos by n bytes of text in given style */
+void dkTextReplaceStyledText(struct dkText *txt, int pos, int m, const char *text, int n, int style)
+{
+  dkText_replace(txt, pos, m, text, n, style);
+}
+
+/* Append n bytes of text at the end of the buffer */
+void dkTextAppendText(struct dkText *txt, const char *text, int n)
+{
+  dkText_replace(txt, txt->length, 0, text, n, 0);
+}
+
+/* Append n bytes of text at the end of the buffer in given style */
+void dkTextAppendStyledText(struct dkText *txt, const char *text, int n, int style)
+{
+  dkText_replace(txt, txt->length, 0, text, n, style);
+}
+
+/* Insert n bytes of text at position pos into the buffer */
+void dkTextInsertText(struct dkText *txt, int pos, const char *text, int n)
+{
+  dkText_replace(txt, pos, 0, text, n, 0);
+}
+
+/* Remove n bytes of text at position pos from the buffer */
+void dkTextRemoveText(struct dkText *txt, int pos, int n)
+{
+  dkText_replace(txt, pos, n, NULL, 0, 0);
+}
+
+/* Change the text in the buffer to new text */
+void dkTextSetText(struct dkText *txt, const char *text, int n)
+{
+  dkTextSetStyledText(txt, text, n, 0);
+}
+
+/* Start over with the text in buffer b */
+static void dkText_reset(struct dkText *txt, struct dkTextBuffer *b)
+{
+  dkTextBufferDestroy(&txt->text);
+  txt->text = *b;
+  txt->length = b->length;
+  dkText_wrapReset(txt);
+  txt->nrows = dkText_numRows(txt);
+  txt->toppos = 0;
+  txt->keeppos = 0;
+  txt->toprow = 0;
+  txt->selstartpos = 0;
+  txt->selendpos = 0;
+  txt->hilitestartpos = 0;
+  txt->hiliteendpos = 0;
+  txt->anchorpos = 0;
+  txt->cursorpos = 0;
+  txt->cursorstart = 0;
+  dkText_cursorRow(txt);
+  txt->cursorcol = 0;
+  txt->prefcol = -1;
+  dkText_calcVisRows(txt, 0, txt->nvisrows);
+  dkText_recalc((struct dkWindow *)txt);
+  dkWindowUpdate((struct dkWindow *)txt);
+}
+
+/* Change the text in the buffer to new text in given style; the old
+ * pieces and their storage are dropped all at once */
+void dkTextSetStyledText(struct dkText *txt, const char *text, int n, int style)
+{
+  struct dkTextBuffer b;
+
+  dkTextBufferInit(&b);
+  if (!dkTextBufferReplace(&b, 0, 0, text, n, style)) {
+    printf("Error: %s: out of memory.\n", __func__);
+    return;
+  }
+  dkText_reset(txt, &b);
+  dkText_trim(txt);
+}
+
+/* Show contents of file, mapped rather than copied; lines are counted
+ * in the background */
+DKbool dkTextMapFile(struct dkText *txt, const char *filename)
+{
+  struct dkTextBuffer b;
+
+  dkTextBufferInit(&b);
+  if (!dkTextBufferMap(&b, filename)) return FALSE;
+  dkText_reset(txt, &b);
+  dkAppAddChorePriority(((struct dkWindow *)txt)->app, (struct dkObject *)txt, TEXT_ID_COUNT, NULL, CHORE_BACKGROUND);
+  return TRUE;
+}
+
+/* Count lines of mapped file until the chore budget runs out */
+static long dkText_onCount(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void* ptr)
+{
+  struct dkText *txt = (struct dkText *)pthis;
+  struct dkApp *app = ((struct dkWindow *)txt)->app;
+  DKbool done;
+
+  do {
+    done = dkTextBufferCount(&txt->text, txt->text.counted);
+  } while (!done && dkAppChoreTimeLeft(app) > 0);
+  dkText_wrapSync(txt);
+  txt->nrows = dkText_numRows(txt);
+  if (!done) dkAppAddChorePriority(app, (struct dkObject *)txt, TEXT_ID_COUNT, NULL, CHORE_BACKGROUND);
+  return 1;
+}
+
+/* Wrap lines until the chore budget runs out */
+static long dkText_onWrap(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void* ptr)
+{
+  struct dkText *txt = (struct dkText *)pthis;
+  struct dkApp *app = ((struct dkWindow *)txt)->app;
+  struct dkTextWrap *w = &txt->wrap;
+  int line;
+
+  while (w->lines && w->left > 0) {
+    if (w->scan >= w->nlines) w->scan = 0;
+    line = w->scan++;
+    w->left--;
+    if (dkText_wrapLine(w, line)->gen != w->gen) {
+      dkText_wrapRows(txt, line, dkTextBufferLineStart(&txt->text, line));
+      if (dkAppChoreTimeLeft(app) <= 0) break;
+    }
+  }
+  txt->nrows = dkText_numRows(txt);
+  if (w->lines && w->left > 0) dkAppAddChorePriority(app, (struct dkObject *)txt, TEXT_ID_WRAP, NULL, CHORE_BACKGROUND);
+  return 1;
+}
+
+/* Change style of text range */
+void dkTextChangeStyle(struct dkText *txt, int pos, int n, int style)
+{
+  if (!dkTextBufferChangeStyle(&txt->text, pos, n, style)) {
+    printf("Error: %s: out of memory.\n", __func__);
+    return;
+  }
+  if (txt->styled) dkWindowUpdate((struct dkWindow *)txt);
+}
+
+/* Set styled text mode */
+void dkTextSetStyled(struct dkText *txt, DKbool styled)
+{
+  if (txt->styled != styled) {
+    txt->styled = styled;
+    dkWindowUpdate((struct dkWindow *)txt);
+  }
+}
+
+/* Set bounds of scrollback */
+void dkTextSetScrollback(struct dkText *txt, int maxlines, int maxbytes)
+{
+  txt->maxlines = FXMAX(0, maxlines);
+  txt->maxbytes = FXMAX(0, maxbytes);
+  dkText_trim(txt);
+}
+
+/* Extract n bytes of text from position pos */
+void dkTextExtractText(struct dkText *txt, char *text, int pos, int n)
+{
+  dkTextBufferExtract(&txt->text, text, pos, n);
+}
+
+/* Return length of buffer */
+int dkTextGetLength(struct dkText *txt)
+{
+  return txt->length;
+}
+
+/* Return number of rows in buffer */
+int dkTextGetNumRows(struct dkText *txt)
+{
+  return txt->nrows;
+}
 #if 0
 
 // FIXME
@@ -2164,8 +2949,10 @@ void dkText_layout(struct dkWindow *win)
   /* Wrap width changed, so reflow; when using fixed pitch font,
    * we only reflow if the number of columns has changed. */
   if ((win->options & TEXT_WORDWRAP) && (txt->wrapwidth != oww)) {
-    if (!dkFontIsFontMono(txt->font) || (txt->wrapwidth / fw != oww / fw))
+    if (!dkFontIsFontMono(txt->font) || (txt->wrapwidth / fw != oww / fw)) {
       win->flags |= FLAG_RECALC;
+      dkText_reflow(txt);
+    }
   }
 
   /* Scrollbars adjusted */
@@ -4349,7 +5136,8 @@ void dkText_drawBufferText(struct dkText *txt, struct dtkDC *dc, int x, int y, i
   DKuint index = (style & STYLE_MASK);
   DKuint usedstyle = style;                                              /* Style flags from style buffer */
   DKColor color;
-  char str[2];
+  char str[2], buf[6], *p;
+  int k, s;
   color = 0;
   if (txt->hilitestyles && index) {                                             /* Get colors from style table */
     usedstyle = txt->hilitestyles[index-1].style;                                      /* Style flags now from style table */
@@ -4366,16 +5154,8 @@ void dkText_drawBufferText(struct dkText *txt, struct dtkDC *dc, int x, int y, i
   if (style & STYLE_CONTROL) {
     y += dkFontGetFontAscent(txt->font);
     str[0] = '^';
-    while (pos < txt->gapstart && 0 < n) {
-      str[1] = txt->buffer[pos] | 0x40;
-      dkDCDrawText(dc, x, y, str, 2);
-      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, str, 2);
-      x += dkFontGetTextWidth(txt->font, str,2);
-      pos++;
-      n--;
-    }
     while (0 < n) {
-      str[1] = txt->buffer[pos - txt->gapstart + txt->gapend] | 0x40;
+      str[1] = dkText_getByte(txt, pos) | 0x40;
       dkDCDrawText(dc, x, y, str, 2);
       if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, str, 2);
       x += dkFontGetTextWidth(txt->font, str, 2);
@@ -4384,18 +5164,25 @@ void dkText_drawBufferText(struct dkText *txt, struct dtkDC *dc, int x, int y, i
     }
   } else {
     y += dkFontGetFontAscent(txt->font);
-    if (pos + n <= txt->gapstart) {
-      dkDCDrawText(dc, x, y, &txt->buffer[pos], n);
-      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, &txt->buffer[pos], n);
-    } else if (pos >= txt->gapstart) {
-      dkDCDrawText(dc, x, y, &txt->buffer[pos - txt->gapstart + txt->gapend], n);
-      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, &txt->buffer[pos - txt->gapstart + txt->gapend], n);
-    } else {
-      dkDCDrawText(dc, x, y, &txt->buffer[pos], txt->gapstart - pos);
-      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, &txt->buffer[pos], txt->gapstart - pos);
-      x += dkFontGetTextWidth(txt->font, &txt->buffer[pos], txt->gapstart - pos);
-      dkDCDrawText(dc, x, y, &txt->buffer[txt->gapend], pos + n - txt->gapstart);
-      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, &txt->buffer[txt->gapend], pos + n - txt->gapstart);
+
+    /* Draw piece by piece; a character spanning pieces is drawn from a copy */
+    while (0 < n && (p = (char *)dkTextBufferPeek(&txt->text, pos, &k)) != NULL) {
+      if (k >= n) {
+        k = n;
+      } else {
+        for (s = k - 1; 0 < s && (p[s] & 0xC0) == 0x80; s--) { }
+        if (s + utfBytes[(DKuchar)p[s]] > k) k = s;
+        if (k == 0) {
+          k = FXMIN(utfBytes[(DKuchar)p[0]], n);
+          dkTextBufferExtract(&txt->text, buf, pos, k);
+          p = buf;
+        }
+      }
+      dkDCDrawText(dc, x, y, p, k);
+      if (usedstyle & STYLE_BOLD) dkDCDrawText(dc, x + 1, y, p, k);
+      if (k < n) x += dkFontGetTextWidth(txt->font, p, k);
+      pos += k;
+      n -= k;
     }
   }
 }
@@ -4476,7 +5263,7 @@ DKuint dkText_style(struct dkText *txt, int row, int begin, int end, int pos)
   ch = dkText_getByte(txt, pos);
 
   /* Get value from style buffer */
-  if (txt->sbuffer) s |= dkText_getStyle(txt, pos);
+  if (txt->styled) s |= dkText_getStyle(txt, pos);
 
   /* Tabs are just fill */
   if (ch == '\t') return s;
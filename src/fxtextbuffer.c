@@ -0,0 +1,670 @@
+/******************************************************************************
+ *                                                                            *
+ *                        T e x t   B u f f e r                               *
+ *                                                                            *
+ ******************************************************************************
+ * This library is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU Lesser General Public                 *
+ * License as published by the Free Software Foundation; either               *
+ * version 2.1 of the License, or (at your option) any later version.         *
+ *                                                                            *
+ * This library is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU          *
+ * Lesser General Public License for more details.                            *
+ *                                                                            *
+ * You should have received a copy of the GNU Lesser General Public           *
+ * License along with this library; if not, write to the Free Software        *
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA. *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "fxtextbuffer.h"
+
+/*
+  Notes:
+  - Pieces are kept in a treap: ordered by position like a binary search
+    tree, and by a random priority like a heap, which keeps the expected
+    depth logarithmic.  Each piece knows the size of its subtree, so a
+    position is found by walking down from the root.
+  - An edit splits the tree at both ends of the replaced range, drops the
+    pieces in between and joins the rest around a piece for the new text;
+    each split cuts at most one piece in two.  The pieces an edit might
+    need are allocated up front, so running out of memory leaves the
+    buffer as it was.
+  - New text is copied to the end of the newest chunk.  When it lands
+    right after the bytes of the piece before it, as it does when typing
+    or appending, that piece just grows.
+  - Chunks count the pieces pointing into them, and an older chunk is
+    freed as soon as none does.  Text appended at the end and removed at
+    the front, as in a log with bounded scrollback, goes through the
+    chunks in order, so memory stays bounded by what is left.
+  - The piece last looked up is remembered, so reading the text from
+    front to back only walks the tree once per piece.  Any edit forgets
+    it.
+  - A character is never split by an edit, but two edits may each add
+    part of one; readers must not assume a character fits in a piece.
+  - Pieces count their newlines, and subtrees add them up, so the tree
+    doubles as a line index: a line is found by walking down on newline
+    counts as a position is on sizes.  Only the piece at the end of the
+    walk is scanned, and splitting a piece scans one half of it, so added
+    text is cut into pieces of at most PIECESIZE bytes to bound both.
+  - A mapped file becomes pieces of MAPSIZE bytes pointing into the map,
+    with their newlines not yet counted; they count as none until they
+    are.  Pieces are counted front to back, and counted is how far that
+    got, so line numbers are right up to there.  Lookups by line or
+    position count as far as they need; the rest is up to the owner,
+    which can count a little at a time.
+  - A piece of the map is cut into pieces of PIECESIZE bytes only when a
+    lookup by line or position, or an edit, lands in it, so scanning it
+    costs no more than scanning added text.  Only those pieces and the
+    edits take memory, so a file of any size opens in a moment.
+  - Positions are int, so files of 2GB and up can not be mapped.  A
+    mapped file must not be truncated while it is in use.
+*/
+
+/* Minimum size of chunk for added text */
+#define CHUNKSIZE 65536
+
+/* Longest piece of added text */
+#define PIECESIZE 4096
+
+/* Size of pieces of mapped file */
+#define MAPSIZE   (1 << 20)
+
+
+/* Size of subtree */
+static int dkTextSize(const struct dkTextPiece *p)
+{
+  return p ? p->size : 0;
+}
+
+/* Newlines in subtree */
+static int dkTextLines(const struct dkTextPiece *p)
+{
+  return p ? p->sublines : 0;
+}
+
+/* Recompute size of subtree from its parts */
+static void dkTextFix(struct dkTextPiece *p)
+{
+  p->size = dkTextSize(p->left) + p->length + dkTextSize(p->right);
+  p->sublines = dkTextLines(p->left) + p->lines + dkTextLines(p->right);
+}
+
+/* Count newlines in n bytes of text */
+static int dkTextCount(const char *text, int n)
+{
+  const char *q;
+  int nl = 0;
+
+  while ((q = memchr(text, '\n', n)) != NULL) {
+    n -= q - text + 1;
+    text = q + 1;
+    nl++;
+  }
+  return nl;
+}
+
+/* Count newlines in the first n bytes of piece, scanning the shorter side */
+static int dkTextCountHead(const struct dkTextPiece *p, int n)
+{
+  if (n <= p->length / 2) return dkTextCount(p->text, n);
+  return p->lines - dkTextCount(p->text + n, p->length - n);
+}
+
+/* Make piece with random priority */
+static struct dkTextPiece *dkTextPieceNew(struct dkTextBuffer *b)
+{
+  struct dkTextPiece *p;
+
+  if ((p = calloc(1, sizeof(struct dkTextPiece))) == NULL) return NULL;
+  b->seed ^= b->seed << 13;
+  b->seed ^= b->seed >> 17;
+  b->seed ^= b->seed << 5;
+  p->priority = b->seed;
+  return p;
+}
+
+/* Make piece point into chunk */
+static void dkTextHold(struct dkTextPiece *p, struct dkTextChunk *c)
+{
+  p->chunk = c;
+  if (c) c->refs++;
+}
+
+/* Free chunk unless it is still pointed into or written to */
+static void dkTextChunkRelease(struct dkTextBuffer *b, struct dkTextChunk *c)
+{
+  if (c->refs > 0 || c == b->chunks) return;
+  c->prev->next = c->next;
+  if (c->next) c->next->prev = c->prev;
+  free(c);
+}
+
+/* Free tree of pieces, and the chunks only they pointed into */
+static void dkTextFree(struct dkTextBuffer *b, struct dkTextPiece *p)
+{
+  if (p) {
+    dkTextFree(b, p->left);
+    dkTextFree(b, p->right);
+    if (p->chunk && --p->chunk->refs == 0) dkTextChunkRelease(b, p->chunk);
+    free(p);
+  }
+}
+
+/* Join trees a and c, all of a coming before all of c */
+static struct dkTextPiece *dkTextJoin(struct dkTextPiece *a, struct dkTextPiece *c)
+{
+  if (!a) return c;
+  if (!c) return a;
+  if (a->priority > c->priority) {
+    a->right = dkTextJoin(a->right, c);
+    dkTextFix(a);
+    return a;
+  }
+  c->left = dkTextJoin(a, c->left);
+  dkTextFix(c);
+  return c;
+}
+
+/* Split tree t into the first pos bytes l and the rest r; if pos falls
+ * inside a piece, spare becomes its tail and is cleared */
+static void dkTextSplit(struct dkTextPiece *t, int pos, struct dkTextPiece **l, struct dkTextPiece **r, struct dkTextPiece **spare)
+{
+  struct dkTextPiece *tail;
+  int ls, nl;
+
+  if (!t) {
+    *l = *r = NULL;
+    return;
+  }
+  ls = dkTextSize(t->left);
+  if (pos <= ls) {
+    dkTextSplit(t->left, pos, l, &t->left, spare);
+    dkTextFix(t);
+    *r = t;
+  } else if (pos >= ls + t->length) {
+    dkTextSplit(t->right, pos - ls - t->length, &t->right, r, spare);
+    dkTextFix(t);
+    *l = t;
+  } else {
+    tail = *spare;
+    *spare = NULL;
+    nl = t->counted ? dkTextCountHead(t, pos - ls) : 0;
+    tail->text = t->text + (pos - ls);
+    tail->length = t->length - (pos - ls);
+    tail->lines = t->lines - nl;
+    tail->style = t->style;
+    tail->counted = t->counted;
+    dkTextHold(tail, t->chunk);
+    dkTextFix(tail);
+    *r = dkTextJoin(tail, t->right);
+    t->length = pos - ls;
+    t->lines = nl;
+    t->right = NULL;
+    dkTextFix(t);
+    *l = t;
+  }
+}
+
+/* Grow last piece of tree t by the n bytes following it, if they are in
+ * the same style and the piece does not get too long */
+static DKbool dkTextExtend(struct dkTextPiece *t, const char *text, int n, int style)
+{
+  struct dkTextPiece *p;
+  int nl;
+
+  if (!t) return FALSE;
+  for (p = t; p->right; p = p->right) { }
+  if (p->text + p->length != text || p->style != (DKuchar)style || p->length + n > PIECESIZE) return FALSE;
+  nl = dkTextCount(text, n);
+  for (p = t; p; p = p->right) {
+    p->size += n;
+    p->sublines += nl;
+  }
+  for (p = t; p->right; p = p->right) { }
+  p->length += n;
+  p->lines += nl;
+  return TRUE;
+}
+
+/* Make tree of pieces of at most size bytes for n bytes of text in
+ * chunk c, and count their newlines if asked to; NULL if out of memory */
+static struct dkTextPiece *dkTextMake(struct dkTextBuffer *b, struct dkTextChunk *c, const char *text, int n, int style, int size, DKbool count)
+{
+  struct dkTextPiece *t = NULL, *p;
+  int k;
+
+  while (0 < n) {
+    if ((p = dkTextPieceNew(b)) == NULL) {
+      dkTextFree(b, t);
+      return NULL;
+    }
+    k = FXMIN(n, size);
+    dkTextHold(p, c);
+    p->text = text;
+    p->length = k;
+    p->lines = count ? dkTextCount(text, k) : 0;
+    p->counted = count;
+    p->style = (DKuchar)style;
+    dkTextFix(p);
+    t = dkTextJoin(t, p);
+    text += k;
+    n -= k;
+  }
+  return t;
+}
+
+/* Set style of all pieces of tree */
+static void dkTextRestyle(struct dkTextPiece *p, int style)
+{
+  for (; p; p = p->right) {
+    dkTextRestyle(p->left, style);
+    p->style = (DKuchar)style;
+  }
+}
+
+/* Copy text to storage */
+static const char *dkTextStore(struct dkTextBuffer *b, const char *text, int n)
+{
+  struct dkTextChunk *c = b->chunks;
+  char *p;
+
+  if (!c || c->size - c->used < n) {
+    if ((c = malloc(offsetof(struct dkTextChunk, data) + FXMAX(n, CHUNKSIZE))) == NULL) return NULL;
+    c->next = b->chunks;
+    c->prev = NULL;
+    c->refs = 0;
+    c->used = 0;
+    c->size = FXMAX(n, CHUNKSIZE);
+    b->chunks = c;
+    if (c->next) {
+      c->next->prev = c;
+      dkTextChunkRelease(b, c->next);
+    }
+  }
+  p = c->data + c->used;
+  memcpy(p, text, n);
+  c->used += n;
+  return p;
+}
+
+/* Count newlines of piece containing pos, and add them to the subtrees
+ * holding it; returns the number added */
+static int dkTextCountPiece(struct dkTextPiece *t, int pos)
+{
+  int ls, nl = 0;
+
+  if (!t) return 0;
+  ls = dkTextSize(t->left);
+  if (pos < ls) {
+    nl = dkTextCountPiece(t->left, pos);
+  } else if (pos >= ls + t->length) {
+    nl = dkTextCountPiece(t->right, pos - ls - t->length);
+  } else if (!t->counted) {
+    nl = t->lines = dkTextCount(t->text, t->length);
+    t->counted = TRUE;
+  }
+  t->sublines += nl;
+  return nl;
+}
+
+/* Find piece containing pos, and its position */
+static struct dkTextPiece *dkTextFind(struct dkTextBuffer *b, int pos, int *start)
+{
+  struct dkTextPiece *t = b->root;
+  int base = 0, ls;
+
+  if (b->last && b->lastpos <= pos && pos < b->lastpos + b->last->length) {
+    *start = b->lastpos;
+    return b->last;
+  }
+  while (t) {
+    ls = dkTextSize(t->left);
+    if (pos < base + ls) {
+      t = t->left;
+    } else if (pos < base + ls + t->length) {
+      b->last = t;
+      b->lastpos = *start = base + ls;
+      return t;
+    } else {
+      base += ls + t->length;
+      t = t->right;
+    }
+  }
+  return NULL;
+}
+
+/* Cut piece p at start into pieces of PIECESIZE bytes; returns FALSE,
+ * leaving it whole, if out of memory */
+static DKbool dkTextRefine(struct dkTextBuffer *b, struct dkTextPiece *p, int start)
+{
+  struct dkTextPiece *l, *mid, *r, *t, *none = NULL;
+
+  if ((t = dkTextMake(b, p->chunk, p->text, p->length, p->style, PIECESIZE, p->counted)) == NULL) return FALSE;
+  b->last = NULL;
+  dkTextSplit(b->root, start, &l, &r, &none);
+  dkTextSplit(r, p->length, &mid, &r, &none);
+  dkTextFree(b, mid);
+  b->root = dkTextJoin(dkTextJoin(l, t), r);
+  return TRUE;
+}
+
+/* Cut piece containing pos if it is a long piece of the map */
+static void dkTextRefineAt(struct dkTextBuffer *b, int pos)
+{
+  struct dkTextPiece *p;
+  int start;
+
+  if ((p = dkTextFind(b, pos, &start)) != NULL && p->length > PIECESIZE) dkTextRefine(b, p, start);
+}
+
+/* Initialize empty buffer */
+void dkTextBufferInit(struct dkTextBuffer *b)
+{
+  b->root = NULL;
+  b->chunks = NULL;
+  b->length = 0;
+  b->seed = 0x2545F491;
+  b->last = NULL;
+  b->lastpos = 0;
+  b->counted = 0;
+  b->map = NULL;
+  b->maplength = 0;
+}
+
+/* Release storage */
+void dkTextBufferDestroy(struct dkTextBuffer *b)
+{
+  struct dkTextChunk *c;
+
+  dkTextFree(b, b->root);
+  while ((c = b->chunks) != NULL) {
+    b->chunks = c->next;
+    free(c);
+  }
+  if (b->map) {
+#ifdef WIN32
+    UnmapViewOfFile(b->map);
+#else
+    munmap((void *)b->map, b->maplength);
+#endif
+  }
+  dkTextBufferInit(b);
+}
+
+/* Map file into empty buffer */
+DKbool dkTextBufferMap(struct dkTextBuffer *b, const char *filename)
+{
+  const char *map = NULL;
+  long length;
+#ifdef WIN32
+  HANDLE file, mapping;
+  LARGE_INTEGER size;
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return FALSE;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > INT_MAX) {
+    CloseHandle(file);
+    return FALSE;
+  }
+  length = (long)size.QuadPart;
+  if (length > 0) {
+    if ((mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL) {
+      map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+    if (!map) {
+      CloseHandle(file);
+      return FALSE;
+    }
+  }
+  CloseHandle(file);
+#else
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0) return FALSE;
+  if (fstat(fd, &st) < 0 || st.st_size > INT_MAX) {
+    close(fd);
+    return FALSE;
+  }
+  length = (long)st.st_size;
+  if (length > 0) {
+    if ((map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+      close(fd);
+      return FALSE;
+    }
+  }
+  close(fd);
+#endif
+  if (length > 0 && (b->root = dkTextMake(b, NULL, map, (int)length, 0, MAPSIZE, FALSE)) == NULL) {
+#ifdef WIN32
+    UnmapViewOfFile(map);
+#else
+    munmap((void *)map, length);
+#endif
+    return FALSE;
+  }
+  b->map = map;
+  b->maplength = length;
+  b->length = (int)length;
+  return TRUE;
+}
+
+/* Count newlines up to at least pos */
+DKbool dkTextBufferCount(struct dkTextBuffer *b, int pos)
+{
+  struct dkTextPiece *p;
+  int start;
+
+  while (b->counted < b->length && b->counted <= pos) {
+    p = dkTextFind(b, b->counted, &start);
+    if (!p->counted) dkTextCountPiece(b->root, start);
+    b->counted = start + p->length;
+  }
+  return b->counted >= b->length;
+}
+
+/* Replace m bytes at pos by n bytes of text */
+DKbool dkTextBufferReplace(struct dkTextBuffer *b, int pos, int m, const char *text, int n, int style)
+{
+  struct dkTextPiece *spare[2] = { NULL, NULL };
+  struct dkTextPiece *l, *mid, *r, *ins = NULL;
+  const char *bytes = NULL;
+  DKbool ok = FALSE;
+  int i;
+
+  pos = FXMAX(0, FXMIN(pos, b->length));
+  m = FXMAX(0, FXMIN(m, b->length - pos));
+  if (n < 0) n = 0;
+  for (i = 0; i < 2; i++) {
+    if ((spare[i] = dkTextPieceNew(b)) == NULL) goto done;
+  }
+  if (n > 0) {
+    if ((bytes = dkTextStore(b, text, n)) == NULL) goto done;
+    if ((ins = dkTextMake(b, b->chunks, bytes, n, style, PIECESIZE, TRUE)) == NULL) goto done;
+  }
+  dkTextRefineAt(b, pos);
+  dkTextRefineAt(b, pos + m);
+  b->last = NULL;
+  dkTextSplit(b->root, pos, &l, &r, &spare[0]);
+  dkTextSplit(r, m, &mid, &r, &spare[1]);
+  dkTextFree(b, mid);
+  if (ins && dkTextExtend(l, bytes, n, style)) {
+    dkTextFree(b, ins);
+    ins = NULL;
+  }
+  b->root = dkTextJoin(dkTextJoin(l, ins), r);
+  if (b->counted >= b->length) b->counted = b->length + n - m;
+  else if (pos + m <= b->counted) b->counted += n - m;
+  else if (pos < b->counted) b->counted = pos;
+  b->length += n - m;
+  ok = TRUE;
+done:
+  for (i = 0; i < 2; i++) free(spare[i]);
+  return ok;
+}
+
+/* Change style of n bytes at pos */
+DKbool dkTextBufferChangeStyle(struct dkTextBuffer *b, int pos, int n, int style)
+{
+  struct dkTextPiece *spare[2] = { NULL, NULL };
+  struct dkTextPiece *l, *mid, *r;
+  DKbool ok = FALSE;
+  int i;
+
+  pos = FXMAX(0, FXMIN(pos, b->length));
+  n = FXMAX(0, FXMIN(n, b->length - pos));
+  for (i = 0; i < 2; i++) {
+    if ((spare[i] = dkTextPieceNew(b)) == NULL) goto done;
+  }
+  dkTextRefineAt(b, pos);
+  dkTextRefineAt(b, pos + n);
+  b->last = NULL;
+  dkTextSplit(b->root, pos, &l, &r, &spare[0]);
+  dkTextSplit(r, n, &mid, &r, &spare[1]);
+  dkTextRestyle(mid, style);
+  b->root = dkTextJoin(l, dkTextJoin(mid, r));
+  ok = TRUE;
+done:
+  for (i = 0; i < 2; i++) free(spare[i]);
+  return ok;
+}
+
+/* Return contiguous bytes at pos */
+const char *dkTextBufferPeek(struct dkTextBuffer *b, int pos, int *n)
+{
+  struct dkTextPiece *p;
+  int start;
+
+  if ((p = dkTextFind(b, pos, &start)) == NULL) {
+    *n = 0;
+    return NULL;
+  }
+  *n = start + p->length - pos;
+  return p->text + (pos - start);
+}
+
+/* Return byte at pos */
+int dkTextBufferGetByte(struct dkTextBuffer *b, int pos)
+{
+  struct dkTextPiece *p;
+  int start;
+
+  if ((p = dkTextFind(b, pos, &start)) == NULL) return 0;
+  return (DKuchar)p->text[pos - start];
+}
+
+/* Return style at pos */
+int dkTextBufferGetStyle(struct dkTextBuffer *b, int pos)
+{
+  struct dkTextPiece *p;
+  int start;
+
+  if ((p = dkTextFind(b, pos, &start)) == NULL) return 0;
+  return p->style;
+}
+
+/* Copy n bytes at pos to text */
+void dkTextBufferExtract(struct dkTextBuffer *b, char *text, int pos, int n)
+{
+  const char *p;
+  int k;
+
+  while (0 < n && (p = dkTextBufferPeek(b, pos, &k)) != NULL) {
+    if (k > n) k = n;
+    memcpy(text, p, k);
+    text += k;
+    pos += k;
+    n -= k;
+  }
+}
+
+/* Return number of newlines in buffer counted so far */
+int dkTextBufferGetLines(const struct dkTextBuffer *b)
+{
+  return dkTextLines(b->root);
+}
+
+/* Return number of newlines before pos */
+int dkTextBufferLinesBefore(struct dkTextBuffer *b, int pos)
+{
+  struct dkTextPiece *t;
+  int nl = 0, base = 0, ls;
+
+  dkTextBufferCount(b, pos - 1);
+  t = b->root;
+  while (t) {
+    ls = dkTextSize(t->left);
+    if (pos <= base + ls) {
+      t = t->left;
+      continue;
+    }
+    nl += dkTextLines(t->left);
+    base += ls;
+    if (pos <= base + t->length) {
+      if (t->length > PIECESIZE && dkTextRefine(b, t, base)) return dkTextBufferLinesBefore(b, pos);
+      return nl + dkTextCountHead(t, pos - base);
+    }
+    nl += t->lines;
+    base += t->length;
+    t = t->right;
+  }
+  return nl;
+}
+
+/* Return start of line, as far as newlines are counted */
+static int dkTextFindLine(struct dkTextBuffer *b, int line)
+{
+  struct dkTextPiece *t = b->root;
+  const char *p;
+  int base = 0, rest = line, ll;
+
+  if (line <= 0) return 0;
+  while (t) {
+    ll = dkTextLines(t->left);
+    if (rest <= ll) {
+      t = t->left;
+      continue;
+    }
+    rest -= ll;
+    base += dkTextSize(t->left);
+    if (rest <= t->lines) {
+      if (t->length > PIECESIZE && dkTextRefine(b, t, base)) return dkTextFindLine(b, line);
+      for (p = t->text; ; p++) {
+        p = memchr(p, '\n', t->text + t->length - p);
+        if (--rest == 0) return base + (int)(p - t->text) + 1;
+      }
+    }
+    rest -= t->lines;
+    base += t->length;
+    t = t->right;
+  }
+  return b->length;
+}
+
+/* Return start of line, counting newlines until it is found */
+int dkTextBufferLineStart(struct dkTextBuffer *b, int line)
+{
+  int pos;
+
+  for (;;) {
+    pos = dkTextFindLine(b, line);
+    if (pos <= b->counted || b->counted >= b->length) return pos;
+    dkTextBufferCount(b, b->counted);
+  }
+}
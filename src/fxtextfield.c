@@ -794,7 +794,8 @@ static long dkTextField_onKeyPress(void *pthis, struct dkObject *obj, DKSelector
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_CURSOR_WORD_RIGHT, NULL);
         }
         else {
-          dkTextField_handle(pthis, pthis, SEL_COMMAND, TF_ID_CURSOR_RIGHT, NULL);
+          dkTextField_handle(pthis, pthis, SEL_COMMAND, TF_ID_CURSOR_RIGHT, (void *)(DKuval)event->repeat);
+          event->repeat = 1;
         }
         if (event->state & SHIFTMASK) {
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_EXTEND, NULL);
@@ -812,7 +813,8 @@ static long dkTextField_onKeyPress(void *pthis, struct dkObject *obj, DKSelector
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_CURSOR_WORD_LEFT, NULL);
         }
         else {
-          dkTextField_handle(pthis, pthis, SEL_COMMAND, TF_ID_CURSOR_LEFT, NULL);
+          dkTextField_handle(pthis, pthis, SEL_COMMAND, TF_ID_CURSOR_LEFT, (void *)(DKuval)event->repeat);
+          event->repeat = 1;
         }
         if (event->state & SHIFTMASK) {
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_EXTEND, NULL);
@@ -872,7 +874,8 @@ static long dkTextField_onKeyPress(void *pthis, struct dkObject *obj, DKSelector
           }
         }
         else {
-          dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_DELETE, NULL);
+          dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_DELETE, (void *)(DKuval)event->repeat);
+          event->repeat = 1;
         }
         return 1;
       case KEY_BackSpace:
@@ -880,7 +883,8 @@ static long dkTextField_onKeyPress(void *pthis, struct dkObject *obj, DKSelector
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_DELETE_SEL, NULL);
         }
         else {
-          dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_BACKSPACE, NULL);
+          dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_BACKSPACE, (void *)(DKuval)event->repeat);
+          event->repeat = 1;
         }
         return 1;
       case KEY_Return:
@@ -916,7 +920,19 @@ static long dkTextField_onKeyPress(void *pthis, struct dkObject *obj, DKSelector
         return 1;
       default:
 ins:    if ((event->state & (CONTROLMASK | ALTMASK)) || ((DKuchar)event->text.str[0] < 32)) return 0;
-        if (dkTextField_isOverstrike((struct dkTextField *)tf)) {
+        if (event->repeat > 1) {
+          /* Insert all auto-repeats of the key in one edit */
+          struct dstr text;
+          int len = strlen(event->text.str);
+          dstr_init(&text);
+          for (; event->repeat > 0; event->repeat--) {
+            dstr_replace(&text, dstr_getlength(&text), 0, event->text.str, len);
+          }
+          event->repeat = 1;
+          dkTextField_handle(pthis, pthis, SEL_COMMAND, dkTextField_isOverstrike((struct dkTextField *)tf) ? ID_OVERST_STRING : ID_INSERT_STRING, (void *)text.str);
+          dstr_destroy(&text);
+        }
+        else if (dkTextField_isOverstrike((struct dkTextField *)tf)) {
           dkTextField_handle(pthis, pthis, SEL_COMMAND, ID_OVERST_STRING, (void *)event->text.str);
         }
         else {
@@ -1013,15 +1029,18 @@ static long dkTextField_onCmdInsertString(void *pthis, struct dkObject *obj, DKS
 
 }
 
-/* Backspace character */
+/* Backspace characters; ptr is the number of characters, NULL for one */
 static long dkTextField_onCmdBackspace(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *ptr)
 {
   struct dkTextField *tf = (struct dkTextField *)pthis;
+  int n = ptr ? (int)(DKuval)ptr : 1;
+  int pos, end = tf->cursor;
 
   if (dkTextField_isEditable(tf) && tf->cursor > 0) {
-    dkTextField_setCursorPos(tf, dstr_dec(tf->contents, tf->cursor));
+    for (pos = end; n > 0 && pos > 0; n--) pos = dstr_dec(tf->contents, pos);
+    dkTextField_setCursorPos(tf, pos);
     dkTextField_setAnchorPos(tf, tf->cursor);
-    dstr_erase(tf->contents, tf->cursor, ds_extent(tf->contents, tf->cursor));
+    dstr_erase(tf->contents, pos, end - pos);
     dkTextField_layout((struct dkWindow *)tf);
     dkTextField_makePositionVisible(tf, tf->cursor);
     dkWindowUpdateRect((struct dkWindow *)tf, ((struct dkFrame *)tf)->border, ((struct dkFrame *)tf)->border, ((struct dkWindow *)tf)->width - (((struct dkFrame *)tf)->border << 1), ((struct dkWindow *)tf)->height - (((struct dkFrame *)tf)->border << 1));
@@ -1051,30 +1070,44 @@ static long dkTextField_onCmdCursorEnd(void *pthis, struct dkObject *obj, DKSele
   return 1;
 }
 
-/* Move cursor left */
+/* Move cursor left; ptr is the number of characters, NULL for one */
 static long dkTextField_onCmdCursorLeft(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *ptr)
 {
   struct dkTextField *tf = (struct dkTextField *)pthis;
-  dkTextField_setCursorPos(tf, dstr_dec(tf->contents, tf->cursor));
+  int n = ptr ? (int)(DKuval)ptr : 1;
+  int pos;
+
+  for (pos = tf->cursor; n > 0 && pos > 0; n--) pos = dstr_dec(tf->contents, pos);
+  dkTextField_setCursorPos(tf, pos);
   dkTextField_makePositionVisible(tf, tf->cursor);
   return 1;
 }
 
-/* Move cursor right */
+/* Move cursor right; ptr is the number of characters, NULL for one */
 static long dkTextField_onCmdCursorRight(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *ptr)
 {
   struct dkTextField *tf = (struct dkTextField *)pthis;
-  dkTextField_setCursorPos(tf, dstr_inc(tf->contents, tf->cursor));
+  int n = ptr ? (int)(DKuval)ptr : 1;
+  int len = dstr_getlength(tf->contents);
+  int pos;
+
+  for (pos = tf->cursor; n > 0 && pos < len; n--) pos = dstr_inc(tf->contents, pos);
+  dkTextField_setCursorPos(tf, pos);
   dkTextField_makePositionVisible(tf, tf->cursor);
   return 1;
 }
 
+/* Delete characters; ptr is the number of characters, NULL for one */
 static long dkTextField_onCmdDelete(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector sello, void *ptr)
 {
   struct dkTextField *tf = (struct dkTextField *)pthis;
+  int n = ptr ? (int)(DKuval)ptr : 1;
+  int len = dstr_getlength(tf->contents);
+  int end;
 
-  if (dkTextField_isEditable(tf) && tf->cursor < dstr_getlength(tf->contents)) {
-    dstr_erase(tf->contents, tf->cursor, ds_extent(tf->contents, tf->cursor));
+  if (dkTextField_isEditable(tf) && tf->cursor < len) {
+    for (end = tf->cursor; n > 0 && end < len; n--) end = dstr_inc(tf->contents, end);
+    dstr_erase(tf->contents, tf->cursor, end - tf->cursor);
     dkTextField_layout((struct dkWindow *)tf);
     dkTextField_setCursorPos(tf, tf->cursor);
     dkTextField_setAnchorPos(tf, tf->cursor);
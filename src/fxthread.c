@@ -160,6 +160,19 @@ DKlong dkThreadTime()
 #endif
 }
 
+/* Get time in nanoseconds since arbitrary start time */
+DKlong dkThreadSteadyTime()
+{
+#ifdef CLOCK_MONOTONIC
+	DKlong seconds = 1000000000;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * seconds + ts.tv_nsec;
+#else
+	return dkThreadTime();
+#endif
+}
+
 #else
 /* Get time in nanoseconds since Epoch */
 DKlong dkThreadTime()
@@ -172,4 +185,67 @@ DKlong dkThreadTime()
 	return (now - 116444736000000000L) * 100L;
 #endif
 }
+
+/* Get time in nanoseconds since arbitrary start time */
+DKlong dkThreadSteadyTime()
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (DKlong)(now.QuadPart / freq.QuadPart) * 1000000000 +
+	    (DKlong)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+#endif
+
+/* Atomically replace pointer, returning the old one */
+void *dkAtomicSwapPtr(void *volatile *ptr, void *v)
+{
+#if defined(WIN32)
+	return InterlockedExchangePointer((PVOID volatile *)ptr, v);
+#elif defined(__ATOMIC_SEQ_CST)
+	return __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST);
+#else
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ptr, v);
 #endif
+}
+
+/* Atomically read pointer */
+void *dkAtomicGetPtr(void *volatile *ptr)
+{
+#if defined(WIN32)
+	return InterlockedCompareExchangePointer((PVOID volatile *)ptr, NULL, NULL);
+#elif defined(__ATOMIC_ACQUIRE)
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+	void *v = *ptr;
+	__sync_synchronize();
+	return v;
+#endif
+}
+
+/* Atomically store pointer */
+void dkAtomicPutPtr(void *volatile *ptr, void *v)
+{
+#if defined(WIN32)
+	InterlockedExchangePointer((PVOID volatile *)ptr, v);
+#elif defined(__ATOMIC_RELEASE)
+	__atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+#else
+	__sync_synchronize();
+	*ptr = v;
+#endif
+}
+
+/* Atomically replace int, returning the old one */
+int dkAtomicSwapInt(volatile int *ptr, int v)
+{
+#if defined(WIN32)
+	return (int)InterlockedExchange((LONG volatile *)ptr, (LONG)v);
+#elif defined(__ATOMIC_SEQ_CST)
+	return __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST);
+#else
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ptr, v);
+#endif
+}
@@ -147,6 +147,8 @@ DtkCreateTopWindow(void *pthis)
 static void dkTopWindowPosition(struct dkWindow *win, int x, int y, int w, int h)
 {
   struct dkWindow *tw = win;
+  int ow = win->width;
+  int oh = win->height;
 
   if ((tw->flags & FLAG_DIRTY) || (x != tw->xpos) || (y != tw->ypos) ||
 	    (w != tw->width) || (h != tw->height)) {
@@ -166,53 +168,57 @@ static void dkTopWindowPosition(struct dkWindow *win, int x, int y, int w, int h
       AdjustWindowRectEx(&rect, dwStyle, FALSE, dwExStyle);  /* Calculate based on *client* rectange */
       SetWindowPos((HWND)tw->xid, NULL, rect.left, rect.top, FXMAX(rect.right - rect.left, 1), FXMAX(rect.bottom - rect.top, 1), SWP_NOZORDER | SWP_NOOWNERZORDER);
 #else
-      XWindowChanges changes;
-      XSizeHints size;
-      size.flags = USSize | PSize | PWinGravity | USPosition | PPosition;
-      size.x = tw->xpos;
-      size.y = tw->ypos;
-      size.width = tw->width;
-      size.height = tw->height;
-      size.min_width = 0;
-      size.min_height = 0;
-      size.max_width = 0;
-      size.max_height = 0;
-      size.width_inc = 0;
-      size.height_inc = 0;
-      size.min_aspect.x = 0;
-      size.min_aspect.y = 0;
-      size.max_aspect.x = 0;
-      size.max_aspect.y = 0;
-      size.base_width = 0;
-      size.base_height = 0;
-      size.win_gravity = NorthWestGravity;                        // Tim Alexeevsky <realtim@mail.ru>
-      size.win_gravity = StaticGravity;                           // Account for border (ICCCM)
-      if (!(tw->options & DECOR_SHRINKABLE)) {
-        if (!(tw->options & DECOR_STRETCHABLE)) {                       // Cannot change at all
-          size.flags |= PMinSize | PMaxSize;
-          size.min_width = size.max_width = tw->width;
-          size.min_height = size.max_height = tw->height;
-        } else {                                                   // Cannot get smaller than default
-          size.flags |= PMinSize;
-          size.min_width = tw->getDefaultWidth((struct dkWindow *)tw);
-          size.min_height = tw->getDefaultHeight((struct dkWindow *)tw);
+      if (!tw->app->display_opened) {
+        if ((tw->width != ow) || (tw->height != oh)) dtkNullExpose(tw);
+      } else {
+        XWindowChanges changes;
+        XSizeHints size;
+        size.flags = USSize | PSize | PWinGravity | USPosition | PPosition;
+        size.x = tw->xpos;
+        size.y = tw->ypos;
+        size.width = tw->width;
+        size.height = tw->height;
+        size.min_width = 0;
+        size.min_height = 0;
+        size.max_width = 0;
+        size.max_height = 0;
+        size.width_inc = 0;
+        size.height_inc = 0;
+        size.min_aspect.x = 0;
+        size.min_aspect.y = 0;
+        size.max_aspect.x = 0;
+        size.max_aspect.y = 0;
+        size.base_width = 0;
+        size.base_height = 0;
+        size.win_gravity = NorthWestGravity;                        // Tim Alexeevsky <realtim@mail.ru>
+        size.win_gravity = StaticGravity;                           // Account for border (ICCCM)
+        if (!(tw->options & DECOR_SHRINKABLE)) {
+          if (!(tw->options & DECOR_STRETCHABLE)) {                       // Cannot change at all
+            size.flags |= PMinSize | PMaxSize;
+            size.min_width = size.max_width = tw->width;
+            size.min_height = size.max_height = tw->height;
+          } else {                                                   // Cannot get smaller than default
+            size.flags |= PMinSize;
+            size.min_width = tw->getDefaultWidth((struct dkWindow *)tw);
+            size.min_height = tw->getDefaultHeight((struct dkWindow *)tw);
+          }
+        } else if (!(tw->options & DECOR_STRETCHABLE)) {                    // Cannot get larger than default
+          size.flags |= PMaxSize;
+          size.max_width = tw->getDefaultWidth((struct dkWindow *)tw);
+          size.max_height = tw->getDefaultHeight((struct dkWindow *)tw);
         }
-      } else if (!(tw->options & DECOR_STRETCHABLE)) {                    // Cannot get larger than default
-        size.flags |= PMaxSize;
-        size.max_width = tw->getDefaultWidth((struct dkWindow *)tw);
-        size.max_height = tw->getDefaultHeight((struct dkWindow *)tw);
+        XSetWMNormalHints(tw->app->display, tw->xid, &size);
+        changes.x = tw->xpos;
+        changes.y = tw->ypos;
+        changes.width = tw->width;
+        changes.height = tw->height;
+        changes.border_width = 0;
+        changes.sibling = None;
+        changes.stack_mode = Above;
+        XReconfigureWMWindow(tw->app->display, tw->xid,
+  			    DefaultScreen(tw->app->display), CWX | CWY | CWWidth | CWHeight,
+  					&changes);
       }
-      XSetWMNormalHints(tw->app->display, tw->xid, &size);
-      changes.x = tw->xpos;
-      changes.y = tw->ypos;
-      changes.width = tw->width;
-      changes.height = tw->height;
-      changes.border_width = 0;
-      changes.sibling = None;
-      changes.stack_mode = Above;
-      XReconfigureWMWindow(tw->app->display, tw->xid,
-			    DefaultScreen(tw->app->display), CWX | CWY | CWWidth | CWHeight,
-					&changes);
 #endif
       tw->layout(tw);
     }
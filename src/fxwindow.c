@@ -55,6 +55,21 @@
 /* These events are grabbed for mouse grabs */
 #define GRAB_EVENT_MASK    (ButtonPressMask|ButtonReleaseMask|PointerMotionMask|EnterWindowMask|LeaveWindowMask)
 
+/* Events to select for window; the pointer events of an enabled window
+ * come through XInput2 instead when it is in use, unless the window only
+ * wants motion on demand, which XInput2 has no notion of */
+static long dkWindowEventMask(struct dkWindow *w)
+{
+  long events = BASIC_EVENT_MASK;
+
+  if (w->flags & FLAG_SHELL) events |= SHELL_EVENT_MASK;
+  if (w->flags & FLAG_ENABLED) {
+    if (w->flags & FLAG_MOTIONHINT) events |= ENABLED_EVENT_MASK | PointerMotionHintMask;
+    else if (!w->app->xiopcode) events |= ENABLED_EVENT_MASK;
+  }
+  return events;
+}
+
 #endif
 
 /* Side layout modes */
@@ -222,6 +237,7 @@ DtkWindowShellCtor(struct dkWindow *win, struct dkApp *app, struct dkWindow *own
 	win->owner = own;
 	win->visual = app->defaultVisual;
 	win->first = win->last = NULL;
+	win->stack = ++app->stackserial;
 	win->prev = win->parent->last;
 	win->next = NULL;
 	win->parent->last = win;
@@ -288,6 +304,7 @@ void dkWindowChildInit(struct dkWindow *pthis, struct dkWindow *comp, DKuint opt
 
 	pthis->visual = pthis->parent->visual;
 	pthis->first = pthis->last = NULL;
+	pthis->stack = ++pthis->app->stackserial;
 	pthis->prev = pthis->parent->last;
 	pthis->next = NULL;
 	pthis->parent->last = pthis;
@@ -333,7 +350,10 @@ static void dkWindowPosition(struct dkWindow *win, int x, int y, int w, int h)
 			// there are ways to change the placement w/o going through
 			// position()!
 #ifndef WIN32
-			if (0 < w && 0 < h) {
+			if (!win->app->display_opened) {
+				if ((w != ow) || (h != oh)) dtkNullExpose(win);
+			}
+			else if (0 < w && 0 < h) {
 				if((win->flags & FLAG_SHOWN) && (ow <= 0 || oh <= 0)) {
 					XMapWindow(win->app->display, win->xid);
 				}
@@ -388,7 +408,7 @@ int dkWindowAcquireSelection(struct dkWindow *w, DKDragType *types, DKuint numty
     app->xselTypeList = NULL;
     app->xselNumTypes = 0;
   }
-  if (w->xid) {
+  if (w->xid && app->display_opened) {
 #ifndef WIN32
       XSetSelectionOwner(app->display, XA_PRIMARY, w->xid, app->event.time);
       if (XGetSelectionOwner(app->display, XA_PRIMARY) != w->xid) return 0;
@@ -489,10 +509,12 @@ DtkCreateWindow(void *pthis)
   if (w->xid)
     return;
 
-  if (!w->app->display_opened)
+  if (w->app->headless)
+    dtkNullCreateWindow(w);
+  else if (w->app->display_opened)
+    DtkDrvCreateWindow(w);
+  else
     return;
-
-  DtkDrvCreateWindow(w);
   w->flags |= FLAG_OWNED;
 }
 
@@ -545,9 +567,10 @@ void dkWindow_enable(struct dkWindow *w)
     w->flags |= FLAG_ENABLED;
     if (w->xid) {
 #ifndef WIN32
-      DKuint events = BASIC_EVENT_MASK | ENABLED_EVENT_MASK;
-      if (w->flags & FLAG_SHELL) events |= SHELL_EVENT_MASK;
-      XSelectInput(w->app->display, w->xid, events);
+      if (w->app->display_opened) {
+        XSelectInput(w->app->display, w->xid, dkWindowEventMask(w));
+        dtkDrvSelectPointer(w);
+      }
 #else
       EnableWindow((HWND)w->xid, TRUE);
 #endif
@@ -563,18 +586,23 @@ void dkWindow_disable(struct dkWindow *w)
     w->flags &= ~FLAG_ENABLED;
     if (w->xid) {
 #ifndef WIN32
-      DKuint events = BASIC_EVENT_MASK;
-      if (w->flags & FLAG_SHELL) events |= SHELL_EVENT_MASK;
-      XSelectInput(w->app->display, w->xid, events);
+      if (w->app->display_opened) {
+        XSelectInput(w->app->display, w->xid, dkWindowEventMask(w));
+        dtkDrvSelectPointer(w);
+      }
       if (w->app->mouseGrabWindow == w) {
-        XUngrabPointer(w->app->display, CurrentTime);
-        XFlush(w->app->display);
+        if (w->app->display_opened) {
+          XUngrabPointer(w->app->display, CurrentTime);
+          XFlush(w->app->display);
+        }
         ((struct dkObject *)w)->handle(w, (struct dkObject *)w, SEL_UNGRABBED, 0, &w->app->event);
         w->app->mouseGrabWindow = NULL;
       }
       if (w->app->keyboardGrabWindow == w) {
-        XUngrabKeyboard(w->app->display, w->app->event.time);
-        XFlush(w->app->display);
+        if (w->app->display_opened) {
+          XUngrabKeyboard(w->app->display, w->app->event.time);
+          XFlush(w->app->display);
+        }
         w->app->keyboardGrabWindow = NULL;
       }
 #else
@@ -599,12 +627,14 @@ int dkWindowIsEnabled(struct dkWindow *w)
   return (w->flags & FLAG_ENABLED) != 0;
 }
 
-/* Raise (but do not activate!) */
+/* Raise (but do not activate!); the order of the children is left
+ * alone, as layout and focus traversal go by it */
 void dkWindow_raise(struct dkWindow *w)
 {
+  w->stack = ++w->app->stackserial;
   if (w->xid) {
 #ifndef WIN32
-    XRaiseWindow(w->app->display, w->xid);
+    if (w->app->display_opened) XRaiseWindow(w->app->display, w->xid);
 #else
     SetWindowPos((HWND)w->xid, HWND_TOP, 0, 0, 0, 0,
         SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
@@ -631,20 +661,9 @@ void dkWindow_scroll(struct dkWindow *win, int x, int y, int w, int h, int dx, i
     /* Has overlap, so blit contents and repaint the exposed parts */
     else {
       int tx, ty, fx, fy, ex, ey, ew, eh;
-      XEvent event;
-
-      /* Force server to catch up */
-      XSync(win->app->display, False);
 
-      /* Pull any outstanding repaint events into our own repaint rectangle list */
-      while (XCheckWindowEvent(win->app->display, win->xid, ExposureMask, &event)) {
-        if (event.xany.type == NoExpose) continue;
-        dkAppAddRepaint(win->app, win->xid, event.xexpose.x,
-            event.xexpose.y, event.xexpose.width, event.xexpose.height, 0);
-        if (event.xgraphicsexpose.count == 0) break;
-      }
-
-      /* Scroll all repaint rectangles of this window by the dx, dy */
+      /* Scroll all repaint rectangles of this window by the dx, dy; any
+       * exposures still on their way are scrolled when they come in */
       dkAppScrollRepaints(win->app, win->xid, dx, dy);
 
       /* Compute blitted area */
@@ -670,10 +689,13 @@ void dkWindow_scroll(struct dkWindow *win, int x, int y, int w, int h, int dx, i
         eh = -dy;
       }
 
-      /* BLIT the contents */
-      XCopyArea(win->app->display, win->xid,
-          win->xid, (GC)win->visual->scrollgc,
-          fx, fy, w - ew, h - eh, tx, ty);
+      /* BLIT the contents; with no display there is nothing to copy */
+      if (win->app->display_opened) {
+        dkAppTrackCopy(win->app, win->xid, dx, dy);
+        XCopyArea(win->app->display, win->xid,
+            win->xid, (GC)win->visual->scrollgc,
+            fx, fy, w - ew, h - eh, tx, ty);
+      }
 
       /* Post additional rectangles for the uncovered areas */
       if (dy) {
@@ -708,7 +730,10 @@ DtkWindowShow(struct dkWindow *w)
     w->flags |= FLAG_SHOWN;
     if (w->xid) {
 #ifndef WIN32
-      DtkDrvWindowShow(w);
+      if (w->app->display_opened)
+        DtkDrvWindowShow(w);
+      else
+        dtkNullExpose(w);
 #else
       ShowWindow((HWND)w->xid, SW_SHOWNOACTIVATE);
 #endif
@@ -725,17 +750,21 @@ void dkWindowHide(struct dkWindow *w)
     if (w->xid) {
 #ifndef WIN32
       if (w->app->mouseGrabWindow == w) {
-        XUngrabPointer(w->app->display, CurrentTime);
-        XFlush(w->app->display);
+        if (w->app->display_opened) {
+          XUngrabPointer(w->app->display, CurrentTime);
+          XFlush(w->app->display);
+        }
         ((struct dkObject *)w)->handle(w, (struct dkObject *)w, SEL_UNGRABBED, 0, &w->app->event);
         w->app->mouseGrabWindow = NULL;
       }
       if (w->app->keyboardGrabWindow == w) {
-        XUngrabKeyboard(w->app->display, w->app->event.time);
-        XFlush(w->app->display);
+        if (w->app->display_opened) {
+          XUngrabKeyboard(w->app->display, w->app->event.time);
+          XFlush(w->app->display);
+        }
         w->app->keyboardGrabWindow = NULL;
       }
-      XUnmapWindow(w->app->display, w->xid);
+      if (w->app->display_opened) XUnmapWindow(w->app->display, w->xid);
 #else
       if (w->app->mouseGrabWindow == w) {
         ReleaseCapture();
@@ -802,11 +831,53 @@ DtkWindowPaint(void *pthis, struct dkObject *obj, DKSelector selhi, DKSelector s
   return 1;
 }
 
+/* Find offset of window inside its shell window, and the shell window;
+ * positions inside a shell are ours, so translating between windows in
+ * the same shell needs no help from the server */
+static struct dkWindow *dkWindowShellOffset(struct dkWindow *w, int *x, int *y)
+{
+  *x = *y = 0;
+  while (w->parent && w->parent->parent) {
+    *x += w->xpos;
+    *y += w->ypos;
+    w = w->parent;
+  }
+  return w;
+}
+
+/* Return topmost shown child containing x,y, or NULL; children stack
+ * in the order they were created or last raised */
+struct dkWindow *dkWindowGetChildAt(struct dkWindow *pthis, int x, int y)
+{
+  struct dkWindow *c, *top = NULL;
+
+  for (c = pthis->first; c; c = c->next) {
+    if (c->xid && (c->flags & FLAG_SHOWN) && c->xpos <= x && c->ypos <= y && x < c->xpos + c->width && y < c->ypos + c->height &&
+        (!top || c->stack > top->stack))
+      top = c;
+  }
+  return top;
+}
+
 /* Get coordinates from another window (for symmetry) */
 void dkWindowTranslateCoordinatesFrom(struct dkWindow *pthis, int *tox, int *toy, struct dkWindow *fromwindow, int fromx, int fromy)
 {
+  struct dkWindow *fs, *ts;
+  int fx, fy, tx, ty;
+
   if (fromwindow == NULL) { printf("%s: from-window is NULL.\n", __func__); }
   if (pthis->xid && fromwindow->xid) {
+    fs = dkWindowShellOffset(fromwindow, &fx, &fy);
+    ts = dkWindowShellOffset(pthis, &tx, &ty);
+    if (fs == ts || !pthis->app->display_opened) {
+      if (fs != ts) {
+        fx += fs->xpos; fy += fs->ypos;
+        tx += ts->xpos; ty += ts->ypos;
+      }
+      *tox = fromx + fx - tx;
+      *toy = fromy + fy - ty;
+      return;
+    }
 #ifndef WIN32
     Window tmp;
     XTranslateCoordinates(pthis->app->display, fromwindow->xid, pthis->xid, fromx, fromy, tox, toy, &tmp);
@@ -825,8 +896,22 @@ void dkWindowTranslateCoordinatesFrom(struct dkWindow *pthis, int *tox, int *toy
 /* Get coordinates to another window (for symmetry) */
 void dkWindowTranslateCoordinatesTo(struct dkWindow *pthis, int *tox, int *toy, struct dkWindow *towindow, int fromx, int fromy)
 {
+  struct dkWindow *fs, *ts;
+  int fx, fy, tx, ty;
+
   if (towindow == NULL) { printf("%s to-window is NULL.\n", __func__); }
   if (pthis->xid && towindow->xid) {
+    fs = dkWindowShellOffset(pthis, &fx, &fy);
+    ts = dkWindowShellOffset(towindow, &tx, &ty);
+    if (fs == ts || !pthis->app->display_opened) {
+      if (fs != ts) {
+        fx += fs->xpos; fy += fs->ypos;
+        tx += ts->xpos; ty += ts->ypos;
+      }
+      *tox = fromx + fx - tx;
+      *toy = fromy + fy - ty;
+      return;
+    }
 #ifndef WIN32
     Window tmp;
     XTranslateCoordinates(pthis->app->display, pthis->xid, towindow->xid, fromx, fromy, tox, toy, &tmp);
@@ -848,14 +933,14 @@ void dkWindowGrab(struct dkWindow *win)
   struct dkApp *app = win->app;
 
   if (win->xid) {
-    if (win->dragCursor->xid == 0) {
+    if (app->display_opened && win->dragCursor->xid == 0) {
       printf("%s: Cursor has not been created yet.\n", __func__);
     }
     if (!(win->flags & FLAG_SHOWN)) {
       printf("%s: Window is not visible.\n", __func__);
     }
 #ifndef WIN32
-    if (GrabSuccess != XGrabPointer(app->display, win->xid, FALSE, GRAB_EVENT_MASK, GrabModeAsync, GrabModeAsync, None, win->dragCursor->xid, app->event.time)) {
+    if (app->display_opened && GrabSuccess != XGrabPointer(app->display, win->xid, FALSE, GRAB_EVENT_MASK, GrabModeAsync, GrabModeAsync, None, win->dragCursor->xid, app->event.time)) {
       XGrabPointer(app->display, win->xid, FALSE, GRAB_EVENT_MASK, GrabModeAsync, GrabModeAsync, None, win->dragCursor->xid, CurrentTime);
     }
 #else
@@ -877,8 +962,10 @@ void dkWindowUngrab(struct dkWindow *win)
   if (win->xid) {
     app->mouseGrabWindow = NULL;
 #ifndef WIN32
-    XUngrabPointer(app->display, app->event.time);
-    XFlush(app->display);
+    if (app->display_opened) {
+      XUngrabPointer(app->display, app->event.time);
+      XFlush(app->display);
+    }
 #else
     ReleaseCapture();
     SetCursor((HCURSOR)win->defaultCursor->xid);
@@ -886,6 +973,30 @@ void dkWindowUngrab(struct dkWindow *win)
   }
 }
 
+/* Have motion on demand only; each motion event then stands for all
+ * the motion since the one before, which is enough for widgets that only
+ * track hovering.  Windows coalesces mouse moves already. */
+void dkWindowSetMotionHint(struct dkWindow *win, DKbool hint)
+{
+  DKuint flags = hint ? (win->flags | FLAG_MOTIONHINT) : (win->flags & ~FLAG_MOTIONHINT);
+
+  if (flags != win->flags) {
+    win->flags = flags;
+#ifndef WIN32
+    if (win->xid && win->app->display_opened) {
+      XSelectInput(win->app->display, win->xid, dkWindowEventMask(win));
+      dtkDrvSelectPointer(win);
+    }
+#endif
+  }
+}
+
+/* Whether motion is on demand only */
+DKbool dkWindowGetMotionHint(struct dkWindow *win)
+{
+  return (win->flags & FLAG_MOTIONHINT) != 0;
+}
+
 /* Find common ancestor between window a and b */
 struct dkWindow * dkWindowCommonAncestor(struct dkWindow *a, struct dkWindow *b)
 {
@@ -1095,6 +1206,12 @@ int dkWindowGetCursorPosition(struct dkWindow *w, int *x, int *y, DKuint *button
 #ifndef WIN32
     Window dum;
     int rx, ry;
+    if (!w->app->display_opened) {
+      /* The pointer is where the last event left it */
+      dkWindowTranslateCoordinatesFrom(w, x, y, (struct dkWindow *)w->app->root, w->app->event.root_x, w->app->event.root_y);
+      *buttons = w->app->event.state;
+      return TRUE;
+    }
     return XQueryPointer(w->app->display, w->xid, &dum, &dum, &rx, &ry, x, y, buttons);
 #else
     POINT pt;
@@ -1234,14 +1351,8 @@ DtkDrvCreateWindow(struct dkWindow *w)
 	mask = CWBackPixmap | CWWinGravity | CWBitGravity | CWBorderPixel | CWEventMask |
 	    CWDontPropagate | CWCursor | CWOverrideRedirect | CWSaveUnder | CWColormap;
 
-	/* Events for normal windows */
-	wattr.event_mask = BASIC_EVENT_MASK;
-
-	/* Events for shell windows */
-	if (w->flags & FLAG_SHELL) wattr.event_mask |= SHELL_EVENT_MASK;
-
-	/* If enabled, turn on some more events */
-	if (w->flags & FLAG_ENABLED) wattr.event_mask |= ENABLED_EVENT_MASK;
+	/* Events for normal and shell windows; if enabled, some more */
+	wattr.event_mask = dkWindowEventMask(w);
 
 	/* FOX will not propagate events to ancestor windows */
 	wattr.do_not_propagate_mask = NOT_PROPAGATE_MASK;
@@ -1294,6 +1405,9 @@ DtkDrvCreateWindow(struct dkWindow *w)
 	/* Store the xid to object mapping */
 	DtkWindowHashInsert((void *)w->xid, w);
 
+	/* Pointer events through XInput2 */
+	dtkDrvSelectPointer(w);
+
 	/* Set resource and class name for toplevel windows.
 	 * In a perfect world this would be set in FXTopWindow, but for some strange reasons
 	 * some window-managers (e.g. fvwm) this will be too late and they will not recognize
@@ -1355,7 +1469,7 @@ int dkWindow_releaseSelection(struct dkWindow *pthis)
     free(app->xselTypeList);
     app->xselTypeList = NULL;
     app->xselNumTypes = 0;
-    if (pthis->xid) {
+    if (pthis->xid && app->display_opened) {
 #ifndef WIN32
       XSetSelectionOwner(app->display, XA_PRIMARY, None, app->event.time);
 #endif